@@ -27,6 +27,8 @@
 #include <QtCore/QLinkedList>
 #include <QtCore/QVariant>
 #include <QtCore/QThread>
+#include <QtCore/QTime>
+#include <QtCore/QTimer>
 
 namespace Tomahawk {
 
@@ -111,12 +113,8 @@ public:
     
 signals:
     void info( QString caller, Tomahawk::InfoSystem::InfoType type, QVariant input, QVariant output, Tomahawk::InfoSystem::InfoCustomDataHash customData );
-    void getCachedInfo( QHash< QString, QString > criteria, QString caller, Tomahawk::InfoSystem::InfoType type, QVariant input, QVariant output, Tomahawk::InfoSystem::InfoCustomDataHash customData );
     void finished( QString, Tomahawk::InfoSystem::InfoType );
     
-//public slots:
-    //void notInCacheSlot( QString caller, Tomahawk::InfoSystem::InfoType type, QVariant input, QVariant output, Tomahawk::InfoSystem::InfoCustomDataHash customData ) = 0;
-    
 protected:
     InfoType m_type;
 };
@@ -142,13 +140,42 @@ public:
 signals:
     void info( QString caller, Tomahawk::InfoSystem::InfoType, QVariant input, QVariant output, Tomahawk::InfoSystem::InfoCustomDataHash customData );
     void finished( QString target );
+
+    void getCachedInfo( QString key, Tomahawk::InfoSystem::InfoType type );
+    void updateCache( QString key, Tomahawk::InfoSystem::InfoType type, QVariant output );
     
 public slots:
     void infoSlot( QString target, Tomahawk::InfoSystem::InfoType type, QVariant input, QVariant output, Tomahawk::InfoSystem::InfoCustomDataHash customData );
     void finishedSlot( QString target,Tomahawk::InfoSystem::InfoType type);
+
+private slots:
+    void cachedInfoSlot( QString key, Tomahawk::InfoSystem::InfoType type, QVariant output );
+    void notInCacheSlot( QString key, Tomahawk::InfoSystem::InfoType type );
+    void pluginFinishedSlot( QString target, Tomahawk::InfoSystem::InfoType type );
+    void checkLookupTimeouts();
     
 private:
+    struct InfoRequest
+    {
+        QString caller;
+        InfoType type;
+        QVariant input;
+        InfoCustomDataHash customData;
+    };
+
+    // identical lookups waiting on the cache or on the one plugin request sent for them,
+    // the answer to which is tagged with id, as a later lookup may reuse the cache key
+    struct PendingLookup
+    {
+        quint64 id;
+        bool dispatched;
+        QList< InfoRequest > requests;
+        QTime started;
+    };
+
     QLinkedList< InfoPluginPtr > determineOrderedMatches( const InfoType type ) const;
+    bool dispatchInfo( const InfoRequest& request );
+    void answerLookup( const QString& key, const QVariant& output, bool skipDispatched );
     
     QMap< InfoType, QLinkedList< InfoPluginPtr > > m_infoMap;
     
@@ -156,6 +183,12 @@ private:
     QLinkedList< InfoPluginPtr > m_plugins;
     
     QHash< QString, QHash< Tomahawk::InfoSystem::InfoType, int > > m_dataTracker;
+    QHash< QString, PendingLookup > m_pendingLookups;
+    quint64 m_nextLookupId;
+    QTimer* m_lookupTimer;
+    // plugin requests of timed out lookups, by caller and type
+    QHash< QString, QHash< Tomahawk::InfoSystem::InfoType, int > > m_abandoned;
+    int m_coalesced;
     
     InfoSystemCache* m_cache;
     QThread* m_infoSystemCacheThreadController;
@@ -165,6 +198,7 @@ private:
 
 }
 
+Q_DECLARE_METATYPE( Tomahawk::InfoSystem::InfoType );
 Q_DECLARE_METATYPE( Tomahawk::InfoSystem::InfoGenericMap );
 Q_DECLARE_METATYPE( Tomahawk::InfoSystem::InfoCustomDataHash );
 
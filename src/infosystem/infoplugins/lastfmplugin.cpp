@@ -197,7 +197,13 @@ LastFmPlugin::coverArtReturned()
     qDebug() << Q_FUNC_INFO;
     QNetworkReply* reply = qobject_cast<QNetworkReply*>( sender() );
     QUrl redir = reply->attribute( QNetworkRequest::RedirectionTargetAttribute ).toUrl();
-    if ( redir.isEmpty() )
+    if ( reply->error() != QNetworkReply::NoError )
+    {
+        // no output, so the InfoSystem doesn't cache the failure
+        InfoCustomDataHash customData = reply->property( "customData" ).value< Tomahawk::InfoSystem::InfoCustomDataHash >();
+        dataError( reply->property( "caller" ).toString(), (Tomahawk::InfoSystem::InfoType)(reply->property( "type" ).toUInt()), reply->property( "origData" ), customData );
+    }
+    else if ( redir.isEmpty() )
     {
         const QByteArray ba = reply->readAll();
         Tomahawk::InfoSystem::InfoCustomDataHash returnedData;
@@ -17,6 +17,7 @@
  */
 
 #include <QCoreApplication>
+#include <QTimer>
 
 #include "tomahawk/infosystem.h"
 #include "tomahawkutils.h"
@@ -25,33 +26,52 @@
 #include "infoplugins/musixmatchplugin.h"
 #include "infoplugins/lastfmplugin.h"
 
+// customData keys tagging a plugin request with the cache key and the lookup it answers
+#define CACHE_KEY_PROPERTY "InfoSystemCacheKey"
+#define LOOKUP_ID_PROPERTY "InfoSystemLookupId"
+// ms after which a lookup stops waiting on a plugin request that never answered
+#define LOOKUP_TIMEOUT 60000
+// how often pending lookups are checked for that
+#define LOOKUP_CHECK_INTERVAL 5000
+
 using namespace Tomahawk::InfoSystem;
 
 InfoPlugin::InfoPlugin(QObject *parent)
         :QObject( parent )
     {
         qDebug() << Q_FUNC_INFO;
-        InfoSystem *system = qobject_cast< InfoSystem* >( parent );
-        if( system )
-                QObject::connect( system->getCache(),
-                    SIGNAL( notInCache( QString, Tomahawk::InfoSystem::InfoType, QVariant, QVariant, Tomahawk::InfoSystem::InfoCustomDataHash ) ),
-                    this,
-                    SLOT( notInCacheSlot( QString, Tomahawk::InfoSystem::InfoType, QVariant, QVariant, Tomahawk::InfoSystem::InfoCustomDataHash ) )
-                );
     }
 
 
 InfoSystem::InfoSystem(QObject *parent)
     : QObject(parent)
+    , m_nextLookupId(0)
+    , m_coalesced(0)
 {
     qDebug() << Q_FUNC_INFO;
+    qRegisterMetaType<Tomahawk::InfoSystem::InfoType>("Tomahawk::InfoSystem::InfoType");
     qRegisterMetaType<QMap< QString, QMap< QString, QString > > >("Tomahawk::InfoSystem::InfoGenericMap");
     qRegisterMetaType<QHash<QString, QVariant > >("Tomahawk::InfoSystem::InfoCustomDataHash");
+    // the cache writes results to disk through QDataStream
+    qRegisterMetaTypeStreamOperators<QMap< QString, QMap< QString, QString > > >("Tomahawk::InfoSystem::InfoGenericMap");
+    qRegisterMetaTypeStreamOperators<QHash<QString, QVariant > >("Tomahawk::InfoSystem::InfoCustomDataHash");
     
     m_infoSystemCacheThreadController = new QThread( this );
     m_cache = new Tomahawk::InfoSystem::InfoSystemCache();
     m_cache->moveToThread( m_infoSystemCacheThreadController );
+    connect(this,    SIGNAL(getCachedInfo(QString, Tomahawk::InfoSystem::InfoType)),
+            m_cache, SLOT(getCachedInfoSlot(QString, Tomahawk::InfoSystem::InfoType)));
+    connect(this,    SIGNAL(updateCache(QString, Tomahawk::InfoSystem::InfoType, QVariant)),
+            m_cache, SLOT(updateCacheSlot(QString, Tomahawk::InfoSystem::InfoType, QVariant)));
+    connect(m_cache, SIGNAL(cachedInfo(QString, Tomahawk::InfoSystem::InfoType, QVariant)),
+            this,    SLOT(cachedInfoSlot(QString, Tomahawk::InfoSystem::InfoType, QVariant)));
+    connect(m_cache, SIGNAL(notInCache(QString, Tomahawk::InfoSystem::InfoType)),
+            this,    SLOT(notInCacheSlot(QString, Tomahawk::InfoSystem::InfoType)));
     m_infoSystemCacheThreadController->start( QThread::IdlePriority );
+
+    m_lookupTimer = new QTimer( this );
+    m_lookupTimer->setInterval( LOOKUP_CHECK_INTERVAL );
+    connect(m_lookupTimer, SIGNAL(timeout()), this, SLOT(checkLookupTimeouts()));
     
     InfoPluginPtr enptr(new EchoNestPlugin(this));
     m_plugins.append(enptr);
@@ -112,28 +132,56 @@ void InfoSystem::getInfo(const QString &caller, const InfoType type, const QVari
 {
     qDebug() << Q_FUNC_INFO;
     QLinkedList< InfoPluginPtr > providers = determineOrderedMatches(type);
-    if (providers.isEmpty())
+    if (providers.isEmpty() || !providers.first())
     {
         emit info(QString(), Tomahawk::InfoSystem::InfoNoInfo, QVariant(), QVariant(), customData);
         emit finished(caller);
         return;
     }
     
-    InfoPluginPtr ptr = providers.first();
-    if (!ptr)
+    m_dataTracker[caller][type] = m_dataTracker[caller][type] + 1;
+    qDebug() << "current count in dataTracker for type" << type << "is" << m_dataTracker[caller][type];
+
+    InfoRequest request = { caller, type, data, customData };
+    const QString key = InfoSystemCache::cacheKey(type, data);
+    if (key.isEmpty())
     {
-        emit info(QString(), Tomahawk::InfoSystem::InfoNoInfo, QVariant(), QVariant(), customData);
-        emit finished(caller);
+        dispatchInfo(request);
         return;
     }
-    
-    m_dataTracker[caller][type] = m_dataTracker[caller][type] + 1;
-    qDebug() << "current count in dataTracker for type" << type << "is" << m_dataTracker[caller][type];
+
+    if (m_pendingLookups.contains(key))
+    {
+        m_coalesced++;
+        qDebug() << "joining pending lookup for type" << type << "- coalesced so far:" << m_coalesced;
+        m_pendingLookups[key].requests << request;
+        return;
+    }
+
+    PendingLookup &lookup = m_pendingLookups[key];
+    lookup.id = ++m_nextLookupId;
+    lookup.dispatched = false;
+    lookup.requests << request;
+    lookup.started.start();
+    if (!m_lookupTimer->isActive())
+        m_lookupTimer->start();
+
+    emit getCachedInfo(key, type);
+}
+
+bool InfoSystem::dispatchInfo(const InfoRequest &request)
+{
+    QLinkedList< InfoPluginPtr > providers = determineOrderedMatches(request.type);
+    if (providers.isEmpty() || !providers.first())
+        return false;
+
+    InfoPluginPtr ptr = providers.first();
     connect(ptr.data(), SIGNAL(info(QString, Tomahawk::InfoSystem::InfoType, QVariant, QVariant, Tomahawk::InfoSystem::InfoCustomDataHash)),
             this,       SLOT(infoSlot(QString, Tomahawk::InfoSystem::InfoType, QVariant, QVariant, Tomahawk::InfoSystem::InfoCustomDataHash)), Qt::UniqueConnection);
     connect(ptr.data(), SIGNAL(finished(QString, Tomahawk::InfoSystem::InfoType)),
-            this,       SLOT(finishedSlot(QString, Tomahawk::InfoSystem::InfoType)), Qt::UniqueConnection);
-    ptr.data()->getInfo(caller, type, data, customData);
+            this,       SLOT(pluginFinishedSlot(QString, Tomahawk::InfoSystem::InfoType)), Qt::UniqueConnection);
+    ptr.data()->getInfo(request.caller, request.type, request.input, request.customData);
+    return true;
 }
 
 void InfoSystem::getInfo(const QString &caller, const InfoMap &input, InfoCustomDataHash customData)
@@ -145,6 +193,24 @@ void InfoSystem::getInfo(const QString &caller, const InfoMap &input, InfoCustom
 void InfoSystem::infoSlot(QString target, Tomahawk::InfoSystem::InfoType type, QVariant input, QVariant output, Tomahawk::InfoSystem::InfoCustomDataHash customData)
 {
     qDebug() << Q_FUNC_INFO;
+    if (customData.contains(CACHE_KEY_PROPERTY))
+    {
+        // answer to a lookup the cache missed: keep it and hand it to everyone who joined it
+        const QString key = customData.take(CACHE_KEY_PROPERTY).toString();
+        const quint64 id = customData.take(LOOKUP_ID_PROPERTY).toULongLong();
+        if (type != Tomahawk::InfoSystem::InfoNoInfo && output.isValid())
+            emit updateCache(key, type, output);
+
+        // the lookup timed out meanwhile, all of its requests got answered then
+        if (!m_pendingLookups.contains(key) || m_pendingLookups[key].id != id)
+        {
+            qDebug() << "late answer for lookup" << id << "- dropping it";
+            return;
+        }
+
+        answerLookup(key, output, true);
+    }
+
     qDebug() << "current count in dataTracker is " << m_dataTracker[target][type];
     if (m_dataTracker[target][type] == 0)
     {
@@ -154,6 +220,84 @@ void InfoSystem::infoSlot(QString target, Tomahawk::InfoSystem::InfoType type, Q
     emit info(target, type, input, output, customData);
 }
 
+void InfoSystem::cachedInfoSlot(QString key, Tomahawk::InfoSystem::InfoType type, QVariant output)
+{
+    qDebug() << Q_FUNC_INFO << "type" << type << "- cache hits:" << m_cache->hits() << "misses:" << m_cache->misses();
+    answerLookup(key, output, false);
+}
+
+void InfoSystem::notInCacheSlot(QString key, Tomahawk::InfoSystem::InfoType type)
+{
+    qDebug() << Q_FUNC_INFO << "type" << type << "- cache hits:" << m_cache->hits() << "misses:" << m_cache->misses();
+    if (!m_pendingLookups.contains(key))
+        return;
+
+    // only the first request goes out, the ones that joined it get its answer
+    PendingLookup &lookup = m_pendingLookups[key];
+    InfoRequest request = lookup.requests.first();
+    request.customData[CACHE_KEY_PROPERTY] = key;
+    request.customData[LOOKUP_ID_PROPERTY] = lookup.id;
+    lookup.dispatched = true;
+    if (!dispatchInfo(request))
+        answerLookup(key, QVariant(), false);
+}
+
+void InfoSystem::checkLookupTimeouts()
+{
+    Q_FOREACH(const QString &key, m_pendingLookups.keys())
+    {
+        // answering may have started new lookups, or ended this one
+        if (!m_pendingLookups.contains(key) || m_pendingLookups[key].started.elapsed() < LOOKUP_TIMEOUT)
+            continue;
+
+        const PendingLookup &lookup = m_pendingLookups[key];
+        qDebug() << "lookup" << lookup.id << "timed out, releasing its" << lookup.requests.count() << "requests";
+
+        // the plugin may still finish the request it got, which we do here already
+        if (lookup.dispatched)
+        {
+            const InfoRequest &request = lookup.requests.first();
+            m_abandoned[request.caller][request.type]++;
+        }
+
+        answerLookup(key, QVariant(), false);
+    }
+
+    if (m_pendingLookups.isEmpty())
+        m_lookupTimer->stop();
+}
+
+void InfoSystem::answerLookup(const QString &key, const QVariant &output, bool skipDispatched)
+{
+    if (!m_pendingLookups.contains(key))
+        return;
+
+    const PendingLookup lookup = m_pendingLookups.take(key);
+    for (int i = skipDispatched ? 1 : 0; i < lookup.requests.count(); i++)
+    {
+        const InfoRequest &request = lookup.requests.at(i);
+        emit info(request.caller, request.type, request.input, output, request.customData);
+        finishedSlot(request.caller, request.type);
+    }
+}
+
+void InfoSystem::pluginFinishedSlot(QString target, Tomahawk::InfoSystem::InfoType type)
+{
+    // a request of a timed out lookup, finished back then
+    if (m_abandoned.contains(target) && m_abandoned[target].value(type) > 0)
+    {
+        if (--m_abandoned[target][type] == 0)
+        {
+            m_abandoned[target].remove(type);
+            if (m_abandoned[target].isEmpty())
+                m_abandoned.remove(target);
+        }
+        return;
+    }
+
+    finishedSlot(target, type);
+}
+
 void InfoSystem::finishedSlot(QString target, Tomahawk::InfoSystem::InfoType type)
 {
     qDebug() << Q_FUNC_INFO;
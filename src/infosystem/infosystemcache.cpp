@@ -0,0 +1,290 @@
+/* === This file is part of Tomahawk Player - <http://tomahawk-player.org> ===
+ *
+ *   Copyright 2010-2011, Christian Muehlhaeuser <muesli@tomahawk-player.org>
+ *
+ *   Tomahawk is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Tomahawk is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Tomahawk. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "infosystemcache.h"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+
+#include "tomahawkutils.h"
+
+// bytes of results kept in memory
+#define MEMORY_CACHE_BYTES ( 4 * 1024 * 1024 )
+// bytes of results kept on disk, pruned down to 3/4 of it when exceeded
+#define DISK_CACHE_BYTES ( 64 * 1024 * 1024 )
+// marks an entry file, bump when its layout changes
+#define CACHE_FILE_MAGIC 0x54494331
+
+#define DAY ( 24 * 60 * 60 )
+
+using namespace Tomahawk::InfoSystem;
+
+
+static qint64
+now()
+{
+    return QDateTime::currentDateTime().toUTC().toTime_t();
+}
+
+
+InfoSystemCache::InfoSystemCache( QObject* parent )
+    : QObject( parent )
+    , m_memoryCache( MEMORY_CACHE_BYTES )
+    , m_diskScanned( false )
+    , m_diskBytes( 0 )
+{
+    qDebug() << Q_FUNC_INFO;
+    m_cacheDir = TomahawkUtils::appDataDir().absoluteFilePath( "InfoSystemCache" );
+}
+
+
+InfoSystemCache::~InfoSystemCache()
+{
+    qDebug() << Q_FUNC_INFO << "hits:" << (int)m_hits << "misses:" << (int)m_misses;
+}
+
+
+int
+InfoSystemCache::ttl( InfoType type )
+{
+    switch ( type )
+    {
+        case InfoMiscSubmitNowPlaying:
+        case InfoMiscSubmitScrobble:
+        case InfoNoInfo:
+            return 0;
+
+        case InfoArtistFamiliarity:
+        case InfoArtistHotttness:
+        case InfoArtistNews:
+        case InfoArtistBlog:
+        case InfoMiscTopHotttness:
+        case InfoMiscTopTerms:
+            return DAY;
+
+        case InfoAlbumCoverArt:
+        case InfoArtistImages:
+        case InfoTrackLyrics:
+            return 30 * DAY;
+
+        default:
+            return 7 * DAY;
+    }
+}
+
+
+QString
+InfoSystemCache::cacheKey( InfoType type, const QVariant& input )
+{
+    if ( ttl( type ) <= 0 )
+        return QString();
+
+    // QMap keeps the criteria sorted, so equal lookups hash equally
+    QMap< QString, QString > criteria;
+    if ( input.canConvert< Tomahawk::InfoSystem::InfoCustomDataHash >() )
+    {
+        const InfoCustomDataHash hash = input.value< Tomahawk::InfoSystem::InfoCustomDataHash >();
+        foreach ( const QString& key, hash.keys() )
+            criteria[ key ] = hash[ key ].toString();
+    }
+    else if ( input.type() == QVariant::String || input.isNull() )
+        criteria[ "input" ] = input.toString();
+    else
+        return QString();
+
+    QCryptographicHash sha1( QCryptographicHash::Sha1 );
+    sha1.addData( QByteArray::number( (int)type ) );
+    QMapIterator< QString, QString > it( criteria );
+    while ( it.hasNext() )
+    {
+        it.next();
+        sha1.addData( QByteArray( 1, '\0' ) + it.key().toUtf8() );
+        sha1.addData( QByteArray( 1, '\0' ) + it.value().toUtf8() );
+    }
+
+    return QString::fromLatin1( sha1.result().toHex() );
+}
+
+
+QString
+InfoSystemCache::filePath( const QString& key, InfoType type ) const
+{
+    return QString( "%1/%2/%3" ).arg( m_cacheDir ).arg( (int)type ).arg( key );
+}
+
+
+void
+InfoSystemCache::getCachedInfoSlot( QString key, Tomahawk::InfoSystem::InfoType type )
+{
+    if ( !m_diskScanned )
+        scanDiskCache();
+
+    CacheEntry* entry = m_memoryCache.object( key );
+    if ( entry && entry->expires > now() )
+    {
+        m_hits.ref();
+        emit cachedInfo( key, type, entry->output );
+        return;
+    }
+    m_memoryCache.remove( key );
+
+    entry = new CacheEntry;
+    int cost = 0;
+    if ( loadFromDisk( key, type, entry, &cost ) )
+    {
+        m_hits.ref();
+        const QVariant output = entry->output;
+        m_memoryCache.insert( key, entry, cost );
+        emit cachedInfo( key, type, output );
+        return;
+    }
+    delete entry;
+
+    m_misses.ref();
+    emit notInCache( key, type );
+}
+
+
+void
+InfoSystemCache::updateCacheSlot( QString key, Tomahawk::InfoSystem::InfoType type, QVariant output )
+{
+    if ( !m_diskScanned )
+        scanDiskCache();
+
+    CacheEntry* entry = new CacheEntry;
+    entry->output = output;
+    entry->expires = now() + ttl( type );
+
+    QByteArray data;
+    QDataStream out( &data, QIODevice::WriteOnly );
+    out << (quint32)CACHE_FILE_MAGIC << entry->expires << entry->output;
+    if ( out.status() != QDataStream::Ok )
+    {
+        qDebug() << "Can't serialize info of type" << type;
+        delete entry;
+        return;
+    }
+
+    m_memoryCache.insert( key, entry, data.size() );
+
+    const QString path = filePath( key, type );
+    QDir().mkpath( QFileInfo( path ).absolutePath() );
+
+    QFile file( path );
+    const qint64 previous = file.exists() ? file.size() : 0;
+    if ( !file.open( QIODevice::WriteOnly | QIODevice::Truncate ) || file.write( data ) != data.size() )
+    {
+        qDebug() << "Can't write info cache file" << path;
+        file.remove();
+        m_diskBytes -= previous;
+        return;
+    }
+
+    m_diskBytes += data.size() - previous;
+    if ( m_diskBytes > DISK_CACHE_BYTES )
+        pruneDiskCache();
+}
+
+
+bool
+InfoSystemCache::loadFromDisk( const QString& key, InfoType type, CacheEntry* entry, int* cost )
+{
+    QFile file( filePath( key, type ) );
+    if ( !file.open( QIODevice::ReadOnly ) )
+        return false;
+
+    *cost = file.size();
+
+    quint32 magic;
+    QDataStream in( &file );
+    in >> magic >> entry->expires >> entry->output;
+
+    if ( in.status() == QDataStream::Ok && magic == CACHE_FILE_MAGIC && entry->expires > now() )
+        return true;
+
+    // stale or unreadable, drop it
+    file.close();
+    if ( file.remove() )
+        m_diskBytes -= *cost;
+
+    return false;
+}
+
+
+void
+InfoSystemCache::scanDiskCache()
+{
+    m_diskScanned = true;
+    m_diskBytes = 0;
+
+    const qint64 time = now();
+    QDir dir( m_cacheDir );
+    foreach ( const QString& typeDir, dir.entryList( QDir::Dirs | QDir::NoDotAndDotDot ) )
+    {
+        const int typeTtl = ttl( (InfoType)typeDir.toInt() );
+        foreach ( const QFileInfo& fi, QDir( dir.absoluteFilePath( typeDir ) ).entryInfoList( QDir::Files ) )
+        {
+            if ( typeTtl <= 0 || fi.lastModified().toUTC().toTime_t() + typeTtl < time )
+                QFile::remove( fi.absoluteFilePath() );
+            else
+                m_diskBytes += fi.size();
+        }
+    }
+
+    qDebug() << Q_FUNC_INFO << "info cache on disk:" << m_diskBytes << "bytes";
+
+    if ( m_diskBytes > DISK_CACHE_BYTES )
+        pruneDiskCache();
+}
+
+
+static bool
+olderThan( const QFileInfo& a, const QFileInfo& b )
+{
+    return a.lastModified() < b.lastModified();
+}
+
+
+void
+InfoSystemCache::pruneDiskCache()
+{
+    QFileInfoList files;
+    QDir dir( m_cacheDir );
+    foreach ( const QString& typeDir, dir.entryList( QDir::Dirs | QDir::NoDotAndDotDot ) )
+        files << QDir( dir.absoluteFilePath( typeDir ) ).entryInfoList( QDir::Files );
+
+    qSort( files.begin(), files.end(), olderThan );
+
+    m_diskBytes = 0;
+    foreach ( const QFileInfo& fi, files )
+        m_diskBytes += fi.size();
+
+    // oldest writes go first, their entries may still live on in memory
+    const qint64 target = (qint64)DISK_CACHE_BYTES * 3 / 4;
+    for ( int i = 0; i < files.count() && m_diskBytes > target; i++ )
+    {
+        if ( QFile::remove( files.at( i ).absoluteFilePath() ) )
+            m_diskBytes -= files.at( i ).size();
+    }
+
+    qDebug() << Q_FUNC_INFO << "pruned info cache on disk to" << m_diskBytes << "bytes";
+}
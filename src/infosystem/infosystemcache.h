@@ -1,5 +1,5 @@
 /* === This file is part of Tomahawk Player - <http://tomahawk-player.org> ===
- * 
+ *
  *   Copyright 2010-2011, Christian Muehlhaeuser <muesli@tomahawk-player.org>
  *
  *   Tomahawk is free software: you can redistribute it and/or modify
@@ -20,34 +20,74 @@
 #define TOMAHAWK_INFOSYSTEMCACHE_H
 
 #include <QObject>
+#include <QAtomicInt>
+#include <QCache>
+#include <QVariant>
 #include <QtDebug>
 
+#include "tomahawk/infosystem.h"
+
 namespace Tomahawk
 {
-    
+
 namespace InfoSystem
 {
 
+/*
+    Two-tier cache for info plugin results, living on the InfoSystem's
+    idle-priority thread: a memory LRU bounded by bytes in front of a
+    bounded on-disk store. Entries are keyed by cacheKey() and expire after
+    the ttl() of their type.
+*/
 class InfoSystemCache : public QObject
 {
 Q_OBJECT
 
 public:
-    InfoSystemCache( QObject *parent = 0 )
-        : QObject( parent )
-    {
-        qDebug() << Q_FUNC_INFO;
-    }
-    
-    virtual ~InfoSystemCache()
+    InfoSystemCache( QObject *parent = 0 );
+    virtual ~InfoSystemCache();
+
+    /// seconds a result of this type stays valid, 0 if it must not be cached
+    static int ttl( InfoType type );
+
+    /// key for a lookup of type with input, empty if it can't be cached
+    static QString cacheKey( InfoType type, const QVariant& input );
+
+    int hits() const { return m_hits; }
+    int misses() const { return m_misses; }
+
+signals:
+    void cachedInfo( QString key, Tomahawk::InfoSystem::InfoType type, QVariant output );
+    void notInCache( QString key, Tomahawk::InfoSystem::InfoType type );
+
+public slots:
+    void getCachedInfoSlot( QString key, Tomahawk::InfoSystem::InfoType type );
+    void updateCacheSlot( QString key, Tomahawk::InfoSystem::InfoType type, QVariant output );
+
+private:
+    struct CacheEntry
     {
-        qDebug() << Q_FUNC_INFO;
-    }
+        QVariant output;
+        qint64 expires;
+    };
+
+    QString filePath( const QString& key, InfoType type ) const;
+    bool loadFromDisk( const QString& key, InfoType type, CacheEntry* entry, int* cost );
+    void scanDiskCache();
+    void pruneDiskCache();
+
+    QCache< QString, CacheEntry > m_memoryCache;
+
+    QString m_cacheDir;
+    bool m_diskScanned;
+    qint64 m_diskBytes;
 
+    QAtomicInt m_hits;
+    QAtomicInt m_misses;
 };
 
 } //namespace InfoSystem
 
 } //namespace Tomahawk
 
-#endif //TOMAHAWK_INFOSYSTEMCACHE_H
\ No newline at end of file
+#endif //TOMAHAWK_INFOSYSTEMCACHE_H
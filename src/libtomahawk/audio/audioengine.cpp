@@ -22,6 +22,7 @@
 #include <QMutexLocker>
 
 #include "playlistinterface.h"
+#include "tomahawksettings.h"
 
 #include "database/database.h"
 #include "database/databasecommand_logplayback.h"
@@ -35,6 +36,16 @@
 #include "flactranscode.h"
 #endif
 
+// longest we decode in one go before giving the event loop a turn
+#define DECODE_SLICE 20
+// bounds for sleeping while the output buffer drains
+#define MIN_SLEEP 10
+#define MAX_SLEEP 250
+// how often the elapsed time is reported
+#define TIMER_INTERVAL 250
+// longest we let the previous track play out before reopening the output in another format
+#define SPLICE_DRAIN 2000
+
 AudioEngine* AudioEngine::s_instance = 0;
 
 
@@ -51,7 +62,22 @@ AudioEngine::AudioEngine()
     , m_currentTrackPlaylist( 0 )
     , m_queue( 0 )
     , m_timeElapsed( 0 )
-    , m_i( 0 )
+    , m_loopTimer( 0 )
+    , m_bytesPerSecond( 0 )
+    , m_starved( false )
+    , m_underruns( 0 )
+    , m_preloadReady( false )
+    , m_preloaded( false )
+    , m_preloadFromPlaylist( false )
+    , m_preloadMs( TomahawkSettings::instance()->audioPreloadSeconds() * 1000 )
+    , m_splicing( false )
+    , m_sampleRate( 0 )
+    , m_channels( 0 )
+    , m_bytesWritten( 0 )
+    , m_trackStart( 0 )
+    , m_reopenPending( false )
+    , m_pendingRate( 0 )
+    , m_pendingChannels( 0 )
 {
     s_instance = this;
     qDebug() << "Init AudioEngine";
@@ -101,6 +127,7 @@ AudioEngine::play()
     {
         QMutexLocker lock( &m_mutex );
         m_audio->resume();
+        kickLoop();
         emit resumed();
     }
     else
@@ -125,6 +152,10 @@ AudioEngine::stop()
     qDebug() << Q_FUNC_INFO;
     QMutexLocker lock( &m_mutex );
 
+    clearPreload();
+    m_splicing = false;
+    m_reopenPending = false;
+
     if ( !m_input.isNull() )
     {
         m_input->close();
@@ -200,27 +231,17 @@ AudioEngine::loadTrack( const Tomahawk::result_ptr& result )
         QMutexLocker lock( &m_mutex );
         QSharedPointer<QIODevice> io;
 
+        // whatever was lined up to follow the current track is superseded
+        clearPreload();
+
         if ( result.isNull() )
             err = true;
         else
         {
             setCurrentTrack( result );
-            io = Servent::instance()->getIODeviceForUrl( m_currentTrack );
-            if ( m_currentTrack->url().startsWith( "http://" ) )
-            {
-                m_readReady = false;
-                connect( io.data(), SIGNAL( downloadProgress( qint64, qint64 ) ), SLOT( onDownloadProgress( qint64, qint64 ) ) );
-            }
-            else
-                m_readReady = true;
-
-            if ( !io || io.isNull() )
-            {
-                qDebug() << "Error getting iodevice for item";
+            io = openInput( m_currentTrack, &m_readReady );
+            if ( io.isNull() )
                 err = true;
-            }
-            else
-                connect( io.data(), SIGNAL( aboutToClose() ), SLOT( onTrackAboutToClose() ), Qt::DirectConnection );
         }
 
         if ( !err )
@@ -235,42 +256,21 @@ AudioEngine::loadTrack( const Tomahawk::result_ptr& result )
             }
 
             if ( m_lastTrack.isNull() || ( m_currentTrack->mimetype() != m_lastTrack->mimetype() ) )
-            {
-                if ( !m_transcode.isNull() )
-                {
-                    m_transcode.clear();
-                }
-
-                if ( m_currentTrack->mimetype() == "audio/mpeg" )
-                {
-                    m_transcode = QSharedPointer<TranscodeInterface>(new MADTranscode());
-                }
-#ifndef NO_OGG
-                else if ( m_currentTrack->mimetype() == "application/ogg" )
-                {
-                    m_transcode = QSharedPointer<TranscodeInterface>(new VorbisTranscode());
-                }
-#endif
-#ifndef NO_FLAC
-                else if ( m_currentTrack->mimetype() == "audio/flac" )
-                {
-                    m_transcode = QSharedPointer<TranscodeInterface>(new FLACTranscode());
-                }
-#endif
-                else
-                    qDebug() << "Could NOT find suitable transcoder! Stopping audio.";
-
-                if ( !m_transcode.isNull() )
-                    connect( m_transcode.data(), SIGNAL( streamInitialized( long, int ) ), SLOT( setStreamData( long, int ) ), Qt::DirectConnection );
-            }
+                createTranscoder( m_currentTrack->mimetype() );
 
             if ( !m_transcode.isNull() )
             {
                 m_transcode->clearBuffers();
+                m_trackStart = m_bytesWritten;
                 m_input = io;
+                m_splicing = false;
+                m_reopenPending = false;
+                m_starved = false;
 
                 if ( m_audio->isPaused() )
                     m_audio->resume();
+
+                kickLoop();
             }
         }
     }
@@ -292,6 +292,151 @@ AudioEngine::loadTrack( const Tomahawk::result_ptr& result )
 }
 
 
+void
+AudioEngine::createTranscoder( const QString& mimetype )
+{
+    m_transcode.clear();
+
+    if ( mimetype == "audio/mpeg" )
+    {
+        m_transcode = QSharedPointer<TranscodeInterface>(new MADTranscode());
+    }
+#ifndef NO_OGG
+    else if ( mimetype == "application/ogg" )
+    {
+        m_transcode = QSharedPointer<TranscodeInterface>(new VorbisTranscode());
+    }
+#endif
+#ifndef NO_FLAC
+    else if ( mimetype == "audio/flac" )
+    {
+        m_transcode = QSharedPointer<TranscodeInterface>(new FLACTranscode());
+    }
+#endif
+    else
+        qDebug() << "Could NOT find suitable transcoder! Stopping audio.";
+
+    if ( !m_transcode.isNull() )
+        connect( m_transcode.data(), SIGNAL( streamInitialized( long, int ) ), SLOT( setStreamData( long, int ) ), Qt::DirectConnection );
+}
+
+
+QSharedPointer<QIODevice>
+AudioEngine::openInput( const Tomahawk::result_ptr& result, bool* readReady )
+{
+    QSharedPointer<QIODevice> io = Servent::instance()->getIODeviceForUrl( result );
+    if ( !io || io.isNull() )
+    {
+        qDebug() << "Error getting iodevice for item";
+        return QSharedPointer<QIODevice>();
+    }
+
+    if ( result->url().startsWith( "http://" ) )
+    {
+        *readReady = false;
+        connect( io.data(), SIGNAL( downloadProgress( qint64, qint64 ) ), SLOT( onDownloadProgress( qint64, qint64 ) ) );
+    }
+    else
+        *readReady = true;
+
+    connect( io.data(), SIGNAL( aboutToClose() ), SLOT( onTrackAboutToClose() ), Qt::DirectConnection );
+    // wakes up the decoder when it's waiting for input:
+    connect( io.data(), SIGNAL( readyRead() ), SLOT( loop() ), Qt::QueuedConnection );
+
+    return io;
+}
+
+
+/*
+    Called a little before the current track ends, see remainingMs(), or
+    once it is completely decoded at the latest: advances the queue or
+    playlist and opens the next track's input, so it can be decoded
+    straight into the same output.
+ */
+void
+AudioEngine::preloadNextTrack()
+{
+    Tomahawk::result_ptr result;
+
+    if ( m_queue && m_queue->trackCount() )
+    {
+        result = m_queue->nextItem();
+    }
+
+    bool fromPlaylist = false;
+    if ( m_playlist && result.isNull() )
+    {
+        result = m_playlist->nextItem();
+        fromPlaylist = !result.isNull();
+    }
+
+    QMutexLocker lock( &m_mutex );
+
+    m_preloaded = true;
+    m_preloadFromPlaylist = fromPlaylist;
+    m_preloadTrack = result;
+    if ( !result.isNull() )
+    {
+        qDebug() << "Preloading next song from url:" << result->url();
+        m_preload = openInput( result, &m_preloadReady );
+    }
+}
+
+
+void
+AudioEngine::spliceNextTrack()
+{
+    {
+        QMutexLocker lock( &m_mutex );
+        qDebug() << "Continuing without a gap from url:" << m_preloadTrack->url();
+
+        setCurrentTrack( m_preloadTrack );
+        emit loading( m_currentTrack );
+
+        if ( m_transcode.isNull() || m_currentTrack->mimetype() != m_lastTrack->mimetype() )
+            createTranscoder( m_currentTrack->mimetype() );
+        else
+            m_transcode->clearBuffers();
+
+        m_input->close();
+        m_input = m_preload;
+        m_readReady = m_preloadReady;
+
+        m_preload.clear();
+        m_preloadTrack.clear();
+        m_preloaded = false;
+
+        // the output is left running, see setStreamData()
+        m_splicing = true;
+        m_trackStart = m_bytesWritten;
+    }
+
+    if ( m_transcode.isNull() )
+    {
+        stop();
+        emit error( AudioEngine::DecodeError );
+        return;
+    }
+
+    kickLoop();
+}
+
+
+void
+AudioEngine::clearPreload()
+{
+    if ( !m_preload.isNull() )
+    {
+        m_preload->close();
+        m_preload.clear();
+    }
+
+    m_preloadTrack.clear();
+    m_preloaded = false;
+    m_preloadFromPlaylist = false;
+}
+
+
 void
 AudioEngine::loadPreviousTrack()
 {
@@ -303,6 +448,15 @@ AudioEngine::loadPreviousTrack()
         return;
     }
 
+    // the playlist may have moved on to the track lined up next already
+    bool preloaded;
+    {
+        QMutexLocker lock( &m_mutex );
+        preloaded = m_preloaded && m_preloadFromPlaylist;
+    }
+    if ( preloaded )
+        m_playlist->previousItem();
+
     Tomahawk::result_ptr result = m_playlist->previousItem();
     if ( !result.isNull() )
         loadTrack( result );
@@ -318,12 +472,20 @@ AudioEngine::loadNextTrack()
 
     Tomahawk::result_ptr result;
 
-    if ( m_queue && m_queue->trackCount() )
+    // the queue or playlist already moved on to the track lined up next
+    bool preloaded;
+    {
+        QMutexLocker lock( &m_mutex );
+        preloaded = m_preloaded;
+        result = m_preloadTrack;
+    }
+
+    if ( !preloaded && m_queue && m_queue->trackCount() )
     {
         result = m_queue->nextItem();
     }
 
-    if ( m_playlist && result.isNull() )
+    if ( !preloaded && m_playlist && result.isNull() )
     {
         result = m_playlist->nextItem();
     }
@@ -349,6 +511,11 @@ AudioEngine::playItem( PlaylistInterface* playlist, const Tomahawk::result_ptr&
 }
 
 
+/*
+    Called by the transcoder from within loop(), with m_mutex held. The
+    output is reopened on loop()'s next turn, see reopenOutput(), so we
+    never wait for a spliced track to play out under the lock.
+ */
 void
 AudioEngine::setStreamData( long sampleRate, int channels )
 {
@@ -357,28 +524,96 @@ AudioEngine::setStreamData( long sampleRate, int channels )
     if ( sampleRate < 44100 )
         sampleRate = 44100;
 
-    m_audio->initAudio( sampleRate, channels );
-    if ( m_audio->startPlayback() )
+    // when splicing into a track of the same format, the output just keeps playing
+    if ( m_splicing && m_audio->isPlaying() && sampleRate == m_sampleRate && channels == m_channels )
     {
-        emit started( m_currentTrack );
-
-        DatabaseCommand_LogPlayback* cmd = new DatabaseCommand_LogPlayback( m_currentTrack, DatabaseCommand_LogPlayback::Started );
-        Database::instance()->enqueue( QSharedPointer<DatabaseCommand>(cmd) );
+        streamStarted();
+        return;
     }
-    else
+
+    m_pendingRate = sampleRate;
+    m_pendingChannels = channels;
+    m_reopenPending = true;
+    m_drainTime.start();
+}
+
+
+/*
+    Opens the output in the format setStreamData() found. When splicing,
+    the previous track gets to play out first: until it has, loop() is
+    rescheduled and false returned. Also false if the device can't be opened.
+ */
+bool
+AudioEngine::reopenOutput()
+{
     {
+        QMutexLocker lock( &m_mutex );
+
+        // play() kicks the loop again
+        if ( !m_reopenPending || m_audio->isPaused() )
+            return false;
+
+        if ( m_splicing && m_audio->haveData() && m_audio->isPlaying() && m_drainTime.elapsed() < SPLICE_DRAIN )
+        {
+            m_loopTimer->start( drainDelay() );
+            return false;
+        }
+
+        m_reopenPending = false;
+        m_sampleRate = m_pendingRate;
+        m_channels = m_pendingChannels;
+        m_bytesPerSecond = m_sampleRate * m_channels * 2;
+        m_bytesWritten = 0;
+        m_trackStart = 0;
+
+        m_audio->initAudio( m_sampleRate, m_channels );
+        if ( m_audio->startPlayback() )
+        {
+            // what got decoded while we waited
+            if ( !m_transcode.isNull() && m_transcode->haveData() )
+            {
+                QByteArray rawdata = m_transcode->data();
+                m_bytesWritten += rawdata.size();
+                m_audio->processData( rawdata );
+            }
+
+            streamStarted();
+            return true;
+        }
+
         qDebug() << "Can't open device for audio output!";
-        stop();
-        emit error( AudioEngine::AudioDeviceError );
+        m_splicing = false;
     }
 
-    qDebug() << Q_FUNC_INFO << sampleRate << channels << "done";
+    stop();
+    emit error( AudioEngine::AudioDeviceError );
+    return false;
+}
+
+
+void
+AudioEngine::streamStarted()
+{
+    m_splicing = false;
+    emit started( m_currentTrack );
+
+    DatabaseCommand_LogPlayback* cmd = new DatabaseCommand_LogPlayback( m_currentTrack, DatabaseCommand_LogPlayback::Started );
+    Database::instance()->enqueue( QSharedPointer<DatabaseCommand>(cmd) );
+
+    qDebug() << Q_FUNC_INFO << m_sampleRate << m_channels << "done";
 }
 
 
 void
 AudioEngine::timerTriggered( unsigned int seconds )
 {
+    // the output counts from when it was opened, which may be a few tracks ago
+    if ( m_bytesPerSecond > 0 )
+    {
+        const unsigned int offset = m_trackStart / m_bytesPerSecond;
+        seconds = seconds > offset ? seconds - offset : 0;
+    }
+
     m_timeElapsed = seconds;
     emit timerSeconds( seconds );
 
@@ -428,54 +663,115 @@ AudioEngine::setCurrentTrack( const Tomahawk::result_ptr& result )
 void
 AudioEngine::onDownloadProgress( qint64 recv, qint64 total )
 {
-    if ( ( recv > 1024 * 32 ) || recv > total ) 
-        m_readReady = true;
+    if ( ( recv > 1024 * 32 ) || recv > total )
+    {
+        if ( !m_preload.isNull() && sender() == m_preload.data() )
+            m_preloadReady = true;
+        else
+            m_readReady = true;
+    }
 }
 
 
 void
 AudioEngine::run()
 {
-    QTimer::singleShot( 0, this, SLOT( engineLoop() ) );
+    // created here, so it lives in the engine thread
+    m_loopTimer = new QTimer();
+    m_loopTimer->setSingleShot( true );
+    connect( m_loopTimer, SIGNAL( timeout() ), SLOT( loop() ) );
+    m_timerMark.start();
+
     exec();
     qDebug() << "AudioEngine event loop stopped";
+
+    delete m_loopTimer;
+    m_loopTimer = 0;
 }
 
 
 void
-AudioEngine::engineLoop()
+AudioEngine::kickLoop()
 {
-    qDebug() << "AudioEngine thread:" << this->thread();
-    loop();
+    // may be called from any thread, loop() always runs in ours
+    QMetaObject::invokeMethod( this, "loop", Qt::QueuedConnection );
 }
 
 
+int
+AudioEngine::bufferedMs() const
+{
+    if ( m_bytesPerSecond <= 0 )
+        return 0;
+
+    return (qint64)m_audio->bufferSize() * 1000 / m_bytesPerSecond;
+}
+
+
+/// how long until the current track has played out, -1 if we can't tell
+int
+AudioEngine::remainingMs() const
+{
+    if ( m_currentTrack.isNull() || m_currentTrack->duration() == 0 || m_bytesPerSecond <= 0 )
+        return -1;
+
+    // what is left to decode, plus what is decoded but still in the output
+    const qint64 decodedMs = ( m_bytesWritten - m_trackStart ) * 1000 / m_bytesPerSecond;
+    return qMax( (qint64)0, (qint64)m_currentTrack->duration() * 1000 - decodedMs ) + bufferedMs();
+}
+
+
+int
+AudioEngine::drainDelay() const
+{
+    // sleep until about half of what's buffered has been played
+    return qBound( MIN_SLEEP, bufferedMs() / 2, MAX_SLEEP );
+}
+
+
+/*
+    Decodes until the output buffer is above its watermark or the input runs
+    dry, then sleeps: until the output has drained a bit, until the input's
+    readyRead(), or - without a track or while paused - until it's kicked.
+ */
 void
 AudioEngine::loop()
 {
-    m_i++;
-    //if( m_i % 500 == 0 ) qDebug() << Q_FUNC_INFO << thread();
+    int nextdelay = -1;
+    int remaining = -1;
+
+    // the stream changed format, see setStreamData()
+    if ( m_reopenPending && !reopenOutput() )
+        return;
 
     {
         QMutexLocker lock( &m_mutex );
 
-/*        if ( m_i % 200 == 0 )
+        if ( m_audio->isPlaying() && m_timerMark.elapsed() >= TIMER_INTERVAL )
         {
-            if ( !m_input.isNull() )
-                qDebug() << "Outer audio loop" << m_input->bytesAvailable() << m_audio->needData();
-        }*/
-
-        if ( m_i % 10 == 0 && m_audio->isPlaying() )
             m_audio->triggerTimers();
+            m_timerMark.restart();
+        }
+
+        if ( m_input.isNull() || m_transcode.isNull() || m_audio->isPaused() )
+            return;
 
-        if( !m_transcode.isNull() &&
-            !m_input.isNull() &&
-            m_input->bytesAvailable() &&
-            m_audio->needData() &&
-            !m_audio->isPaused() )
+        QTime slice;
+        slice.start();
+        while ( !m_reopenPending &&
+                m_input->bytesAvailable() &&
+                m_audio->needData() &&
+                slice.elapsed() < DECODE_SLICE )
         {
-            //if ( m_i % 50 == 0 )
-            //    qDebug() << "Inner audio loop";
+            // ran dry while playing: count it once until the buffer recovers
+            if ( m_audio->isPlaying() && !m_audio->haveData() )
+            {
+                if ( !m_starved )
+                    m_underruns++;
+                m_starved = true;
+            }
+            else
+                m_starved = false;
 
             if ( m_transcode->needData() > 0 )
             {
@@ -483,37 +779,69 @@ AudioEngine::loop()
                 m_transcode->processData( encdata, m_input->atEnd() );
             }
 
-            if ( m_transcode->haveData() )
+            // held back once the output needs reopening for it
+            if ( m_transcode->haveData() && !m_reopenPending )
             {
                 QByteArray rawdata = m_transcode->data();
+                m_bytesWritten += rawdata.size();
                 m_audio->processData( rawdata );
             }
-
-            QTimer::singleShot( 0, this, SLOT( loop() ) );
-            return;
         }
+
+        if ( m_input->bytesAvailable() && m_audio->needData() )
+            nextdelay = 0;  // out of time, not out of work
+        else if ( m_input->bytesAvailable() || m_audio->haveData() )
+            nextdelay = drainDelay();
+        else if ( !m_input->atEnd() )
+            nextdelay = MAX_SLEEP; // waiting for input, readyRead() may wake us earlier
+
+        if ( !m_reopenPending )
+            remaining = remainingMs();
     }
 
-    unsigned int nextdelay = 50;
-    // are we cleanly at the end of a track, and ready for the next one?
+    // open the next track early, remote ones take a while to start streaming
+    if ( !m_preloaded && remaining >= 0 && remaining <= m_preloadMs )
+        preloadNextTrack();
+
+    // is the current track completely decoded?
     if ( !m_input.isNull() &&
           m_input->atEnd() &&
-          m_readReady && 
+          m_readReady &&
+         !m_reopenPending &&
          !m_input->bytesAvailable() &&
-         !m_audio->haveData() &&
          !m_audio->isPaused() )
     {
-        qDebug() << "Starting next track then";
-        loadNextTrack();
-        // will need data immediately:
-        nextdelay = 0;
+        if ( !m_preloaded )
+            preloadNextTrack();
+
+        // decode the next track right behind it, while the output plays the rest
+        if ( !m_preload.isNull() )
+        {
+            spliceNextTrack();
+            return;
+        }
+
+        // nothing to splice in: wait until the output ran dry, as we did before
+        if ( !m_audio->haveData() )
+        {
+            qDebug() << "Starting next track then";
+            Tomahawk::result_ptr next = m_preloadTrack;
+            if ( next.isNull() )
+                stop();
+            else
+                loadTrack( next );
+            return;
+        }
     }
     else if ( !m_input.isNull() && !m_input->isOpen() )
     {
         qDebug() << "AudioEngine IODev closed. errorString:" << m_input->errorString();
         loadNextTrack();
-        nextdelay = 0;
+        return;
     }
 
-    QTimer::singleShot( nextdelay, this, SLOT( loop() ) );
+    if ( nextdelay < 0 )
+        nextdelay = drainDelay();
+
+    m_loopTimer->start( nextdelay );
 }
@@ -22,6 +22,8 @@
 #include <QThread>
 #include <QMutex>
 #include <QBuffer>
+#include <QTime>
+#include <QTimer>
 
 #include "result.h"
 #include "typedefs.h"
@@ -58,6 +60,11 @@ public:
     /* Returns the PlaylistInterface of the current playlist. Note: The currently playing track might still be from a different playlist! */
     PlaylistInterface* playlist() const { return m_playlist; }
 
+    /* Milliseconds of decoded audio waiting in the output buffer */
+    int bufferedMs() const;
+    /* How often the output buffer ran dry while playing, since startup */
+    unsigned int underruns() const { return m_underruns; }
+
 public slots:
     void playPause();
     void play();
@@ -106,7 +113,6 @@ private slots:
     void setStreamData( long sampleRate, int channels );
     void timerTriggered( unsigned int seconds );
 
-    void engineLoop();
     void loop();
 
     void setCurrentTrack( const Tomahawk::result_ptr& result );
@@ -114,6 +120,18 @@ private slots:
 private:
     void run();
     void clearBuffers();
+    void kickLoop();
+    int drainDelay() const;
+    int remainingMs() const;
+    bool reopenOutput();
+    void streamStarted();
+
+    void createTranscoder( const QString& mimetype );
+    QSharedPointer<QIODevice> openInput( const Tomahawk::result_ptr& result, bool* readReady );
+
+    void preloadNextTrack();
+    void spliceNextTrack();
+    void clearPreload();
 
     QSharedPointer<QIODevice> m_input;
     QSharedPointer<TranscodeInterface> m_transcode;
@@ -133,7 +151,33 @@ private:
 
     bool m_readReady;
     unsigned int m_timeElapsed;
-    int m_i;
+
+    QTimer* m_loopTimer;
+    QTime m_timerMark;
+    int m_bytesPerSecond;
+    bool m_starved;
+    unsigned int m_underruns;
+
+    // the next track, opened m_preloadMs before the current one ends
+    QSharedPointer<QIODevice> m_preload;
+    Tomahawk::result_ptr m_preloadTrack;
+    bool m_preloadReady;
+    bool m_preloaded;
+    bool m_preloadFromPlaylist; // m_playlist has moved on to it
+    int m_preloadMs;
+
+    // set while decoding into an output that still plays the previous track
+    bool m_splicing;
+    long m_sampleRate;
+    int m_channels;
+    qint64 m_bytesWritten;
+    qint64 m_trackStart;
+
+    // the format the output gets reopened in on loop()'s next turn
+    bool m_reopenPending;
+    long m_pendingRate;
+    int m_pendingChannels;
+    QTime m_drainTime;
 
     static AudioEngine* s_instance;
 };
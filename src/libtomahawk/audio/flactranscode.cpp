@@ -18,10 +18,13 @@
 
 #include "flactranscode.h"
 
+#include "pcmconvert.h"
+
 
 FLACTranscode::FLACTranscode()
     : m_FLACRunning( false )
     , m_finished( false )
+    , m_bitsPerSample( 16 )
 {
     qDebug() << Q_FUNC_INFO;
 
@@ -96,22 +99,15 @@ FLACTranscode::read_callback( FLAC__byte buffer[], size_t *bytes )
 ::FLAC__StreamDecoderWriteStatus
 FLACTranscode::write_callback( const ::FLAC__Frame *frame, const FLAC__int32 *const buffer[] )
 {
-    union PCMDATA
-    {
-        FLAC__int32 i;
-        unsigned char b[2];
-    } pcmDataLeft, pcmDataRight;
+    const int channels = frame->header.channels;
+    const int frames = frame->header.blocksize;
 
-    for ( unsigned int sample = 0; sample < frame->header.blocksize; sample++ )
-    {
-        pcmDataLeft.i  = buffer[0][sample];
-        pcmDataRight.i = buffer[1][sample];
+    const int offset = m_outBuffer.size();
+    m_outBuffer.resize( offset + frames * channels * sizeof( qint16 ) );
 
-        m_outBuffer.append( pcmDataLeft.b[0] );
-        m_outBuffer.append( pcmDataLeft.b[1] );
-        m_outBuffer.append( pcmDataRight.b[0] );
-        m_outBuffer.append( pcmDataRight.b[1] );
-    }
+    // scale anything above 16 bit down, instead of keeping just the low bytes
+    PcmConvert::interleaveInt32( (const qint32* const*)buffer, channels, frames,
+                                 qMax( 0, m_bitsPerSample - 16 ), (qint16*)( m_outBuffer.data() + offset ) );
 
     return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
 }
@@ -137,6 +133,7 @@ FLACTranscode::metadata_callback( const ::FLAC__StreamMetadata *metadata )
 
             // Try to determine samplerate
             qDebug() << "FLACTranscode( BitsPerSample:" << stream_info.get_bits_per_sample() << "Samplerate:" << stream_info.get_sample_rate() << "Channels:" << stream_info.get_channels() << ")";
+            m_bitsPerSample = stream_info.get_bits_per_sample();
             emit streamInitialized( stream_info.get_sample_rate(), stream_info.get_channels() );
 
             m_FLACRunning = true;
@@ -82,6 +82,7 @@ class DLLEXPORT FLACTranscode : public TranscodeInterface , protected FLAC::Deco
 
         bool m_FLACRunning;
         bool m_finished;
+        int m_bitsPerSample;
 };
 
 #endif
@@ -157,24 +157,18 @@ MADTranscode::processData( const QByteArray &buffer, bool finish )
                 emit streamInitialized( sampleRate, channels > 0 ? channels : 2 );
             }
 
+            // grow once per frame and write the samples in place
+            const int channels = synth.pcm.channels == 2 ? 2 : 1;
+            const int offset = m_decodedBuffer.size();
+            m_decodedBuffer.resize( offset + synth.pcm.length * channels * sizeof( qint16 ) );
+            qint16* out = (qint16*)( m_decodedBuffer.data() + offset );
+
+            // the noise shaping feeds back from sample to sample, so this stays scalar
             for ( int i = 0; i < synth.pcm.length; i++ )
             {
-                union PCMDATA
-                {
-                    short i;
-                    unsigned char b[2];
-                } pcmData;
-
-                pcmData.i = dither( synth.pcm.samples[0][i], &left_dither );
-                m_decodedBuffer.append( pcmData.b[0] );
-                m_decodedBuffer.append( pcmData.b[1] );
-
-                if ( synth.pcm.channels == 2 )
-                {
-                    pcmData.i = dither( synth.pcm.samples[1][i], &right_dither );
-                    m_decodedBuffer.append( pcmData.b[0] );
-                    m_decodedBuffer.append( pcmData.b[1] );
-                }
+                *out++ = dither( synth.pcm.samples[0][i], &left_dither );
+                if ( channels == 2 )
+                    *out++ = dither( synth.pcm.samples[1][i], &right_dither );
             }
 
             if ( timer.seconds != last_timer.seconds )
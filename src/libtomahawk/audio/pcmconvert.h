@@ -0,0 +1,101 @@
+/* === This file is part of Tomahawk Player - <http://tomahawk-player.org> ===
+ *
+ *   Copyright 2010-2011, Christian Muehlhaeuser <muesli@tomahawk-player.org>
+ *
+ *   Tomahawk is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Tomahawk is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Tomahawk. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+    Sample conversion kernels shared by the decoders and the audio outputs.
+
+    They work on caller-provided spans, never allocate, and use SSE2 where the
+    compiler targets it (always the case on x86-64), with a scalar fallback
+    giving the same results everywhere else.
+*/
+#ifndef PCMCONVERT_H
+#define PCMCONVERT_H
+
+#include <QtGlobal>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace PcmConvert
+{
+
+/// out[i] = in[i] * volume, truncated like a plain (qint16) cast. in and out may be the same span.
+inline void
+scaleInt16( const qint16* in, qint16* out, int count, float volume )
+{
+    int i = 0;
+
+#ifdef __SSE2__
+    const __m128 vol = _mm_set1_ps( volume );
+    for ( ; i + 8 <= count; i += 8 )
+    {
+        const __m128i s = _mm_loadu_si128( (const __m128i*)( in + i ) );
+
+        // sign-extend to 32 bit, scale as float, truncate back
+        const __m128i lo = _mm_srai_epi32( _mm_unpacklo_epi16( s, s ), 16 );
+        const __m128i hi = _mm_srai_epi32( _mm_unpackhi_epi16( s, s ), 16 );
+        const __m128i slo = _mm_cvttps_epi32( _mm_mul_ps( _mm_cvtepi32_ps( lo ), vol ) );
+        const __m128i shi = _mm_cvttps_epi32( _mm_mul_ps( _mm_cvtepi32_ps( hi ), vol ) );
+
+        _mm_storeu_si128( (__m128i*)( out + i ), _mm_packs_epi32( slo, shi ) );
+    }
+#endif
+
+    for ( ; i < count; i++ )
+        out[i] = (qint16)( (float)in[i] * volume );
+}
+
+
+/// interleaves planar 32 bit samples into 16 bit frames, shifting right by shift bits and clipping
+inline void
+interleaveInt32( const qint32* const* in, int channels, int frames, int shift, qint16* out )
+{
+    int i = 0;
+
+#ifdef __SSE2__
+    if ( channels == 2 )
+    {
+        const __m128i count = _mm_cvtsi32_si128( shift );
+        for ( ; i + 8 <= frames; i += 8 )
+        {
+            const __m128i l0 = _mm_sra_epi32( _mm_loadu_si128( (const __m128i*)( in[0] + i ) ), count );
+            const __m128i l1 = _mm_sra_epi32( _mm_loadu_si128( (const __m128i*)( in[0] + i + 4 ) ), count );
+            const __m128i r0 = _mm_sra_epi32( _mm_loadu_si128( (const __m128i*)( in[1] + i ) ), count );
+            const __m128i r1 = _mm_sra_epi32( _mm_loadu_si128( (const __m128i*)( in[1] + i + 4 ) ), count );
+
+            // saturate to 16 bit, then zip left and right together
+            const __m128i l = _mm_packs_epi32( l0, l1 );
+            const __m128i r = _mm_packs_epi32( r0, r1 );
+
+            _mm_storeu_si128( (__m128i*)( out + i * 2 ), _mm_unpacklo_epi16( l, r ) );
+            _mm_storeu_si128( (__m128i*)( out + i * 2 + 8 ), _mm_unpackhi_epi16( l, r ) );
+        }
+    }
+#endif
+
+    for ( ; i < frames; i++ )
+    {
+        for ( int c = 0; c < channels; c++ )
+            out[i * channels + c] = (qint16)qBound( -32768, in[c][i] >> shift, 32767 );
+    }
+}
+
+}
+
+#endif // PCMCONVERT_H
@@ -0,0 +1,188 @@
+/* === This file is part of Tomahawk Player - <http://tomahawk-player.org> ===
+ *
+ *   Copyright 2010-2011, Christian Muehlhaeuser <muesli@tomahawk-player.org>
+ *
+ *   Tomahawk is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Tomahawk is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Tomahawk. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+    PcmRingBuffer is a fixed-capacity FIFO of raw PCM bytes between exactly
+    one producer (the thread decoding audio) and one consumer (the audio
+    callback or playback thread).
+
+    Neither side locks or allocates. Both positions only ever grow, and
+    each side publishes its own with release semantics and reads the other
+    with acquire semantics. The capacity is a power of two, so positions are
+    simply masked into the buffer.
+
+    Producer: fill(), freeSpace(), write(), discard()
+    Consumer: readable(), peek(), consume(), read()
+
+    reset() is the only call that must not race with either side.
+*/
+#ifndef PCMRINGBUFFER_H
+#define PCMRINGBUFFER_H
+
+#include <QAtomicInt>
+#include <QtGlobal>
+
+#include <string.h>
+
+#define PCMRINGBUFFER_CACHELINE 64
+
+class PcmRingBuffer
+{
+public:
+    explicit PcmRingBuffer( int capacity = 0 )
+        : m_data( 0 )
+        , m_capacity( 0 )
+        , m_mask( 0 )
+    {
+        reset( capacity );
+    }
+
+    ~PcmRingBuffer()
+    {
+        qFreeAligned( m_data );
+    }
+
+    /// (re)allocates for at least capacity bytes, rounded up to a power of two
+    void reset( int capacity )
+    {
+        qFreeAligned( m_data );
+        m_data = 0;
+        m_capacity = 0;
+
+        if ( capacity > 0 )
+        {
+            m_capacity = 1;
+            while ( m_capacity < capacity )
+                m_capacity <<= 1;
+
+            m_data = (char*)qMallocAligned( m_capacity, PCMRINGBUFFER_CACHELINE );
+            memset( m_data, 0, m_capacity );
+        }
+
+        m_mask = m_capacity - 1;
+        m_write = 0;
+        m_read = 0;
+        m_discardTo = 0;
+        m_discard = 0;
+    }
+
+    int capacity() const { return m_capacity; }
+
+    /// producer: bytes waiting for the consumer, including a discard not yet picked up
+    int fill() const
+    {
+        int read = m_read.fetchAndAddAcquire( 0 );
+        if ( m_discard.fetchAndAddAcquire( 0 ) )
+            read = later( read, m_discardTo.fetchAndAddAcquire( 0 ) );
+
+        return distance( read, m_write );
+    }
+
+    /// producer
+    int freeSpace() const { return m_capacity - fill(); }
+
+    /// producer: appends as much of data as fits, returns the number of bytes taken
+    int write( const char* data, int len )
+    {
+        const int write = m_write;
+        len = qMin( len, m_capacity - distance( m_read.fetchAndAddAcquire( 0 ), write ) );
+        if ( len <= 0 )
+            return 0;
+
+        const int offset = write & m_mask;
+        const int first = qMin( len, m_capacity - offset );
+        memcpy( m_data + offset, data, first );
+        memcpy( m_data, data + first, len - first );
+
+        m_write.fetchAndStoreRelease( advance( write, len ) );
+        return len;
+    }
+
+    /// producer: drops everything written so far, the consumer skips it on its next call
+    void discard()
+    {
+        m_discardTo.fetchAndStoreRelease( m_write );
+        m_discard.fetchAndStoreRelease( 1 );
+    }
+
+    /// consumer: bytes ready to be read
+    int readable()
+    {
+        if ( m_discard.testAndSetAcquire( 1, 0 ) )
+            m_read.fetchAndStoreRelease( later( m_read, m_discardTo.fetchAndAddAcquire( 0 ) ) );
+
+        return distance( m_read, m_write.fetchAndAddAcquire( 0 ) );
+    }
+
+    /// consumer: points data at the readable bytes up to the end of the buffer, returns their count
+    int peek( const char** data )
+    {
+        const int len = qMin( readable(), m_capacity - ( m_read & m_mask ) );
+        *data = m_data + ( m_read & m_mask );
+        return len;
+    }
+
+    /// consumer: releases len bytes obtained through peek()
+    void consume( int len )
+    {
+        m_read.fetchAndStoreRelease( advance( m_read, len ) );
+    }
+
+    /// consumer: copies up to len bytes into data, returns the number of bytes read
+    int read( char* data, int len )
+    {
+        int done = 0;
+        while ( done < len )
+        {
+            const char* span;
+            const int n = qMin( peek( &span ), len - done );
+            if ( n <= 0 )
+                break;
+
+            memcpy( data + done, span, n );
+            consume( n );
+            done += n;
+        }
+
+        return done;
+    }
+
+private:
+    Q_DISABLE_COPY( PcmRingBuffer )
+
+    // positions wrap around, so only their difference is meaningful
+    static int distance( int from, int to ) { return (int)( (uint)to - (uint)from ); }
+    // unsigned, as adding to an int position overflows once 2GB went through
+    static int advance( int pos, int len ) { return (int)( (uint)pos + (uint)len ); }
+    static int later( int a, int b ) { return distance( a, b ) > 0 ? b : a; }
+
+    char* m_data;
+    int m_capacity;
+    int m_mask;
+
+    // each position on its own cache line, so the two sides don't contend
+    char m_pad0[PCMRINGBUFFER_CACHELINE];
+    mutable QAtomicInt m_write;
+    char m_pad1[PCMRINGBUFFER_CACHELINE - sizeof( QAtomicInt )];
+    mutable QAtomicInt m_read;
+    char m_pad2[PCMRINGBUFFER_CACHELINE - sizeof( QAtomicInt )];
+    mutable QAtomicInt m_discardTo;
+    mutable QAtomicInt m_discard;
+};
+
+#endif // PCMRINGBUFFER_H
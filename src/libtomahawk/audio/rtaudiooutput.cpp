@@ -22,14 +22,19 @@
 #include <QDebug>
 
 #include "rtaudiooutput.h"
+#include "pcmconvert.h"
 
 #define BUFFER_SIZE 512
+// bytes of decoded PCM we keep ahead of the sound card, and room for one more decoded chunk
+#define BUFFER_HIGHWATER 65535
+#define BUFFER_CAPACITY 131072
 
+// Runs on the real-time audio thread: no locks, no allocations.
 int
 audioCallback( void *outputBuffer, void *inputBuffer, unsigned int bufferSize, double streamTime, RtAudioStreamStatus status, void* data_src )
 {
     RTAudioOutput* parent = (RTAudioOutput*)data_src;
-    QMutexLocker locker( parent->mutex() );
+    PcmRingBuffer* ring = parent->buffer();
 
     char* buffer = (char*)outputBuffer;
 
@@ -39,29 +44,27 @@ audioCallback( void *outputBuffer, void *inputBuffer, unsigned int bufferSize, d
     int bufs = bufferSize * 2 * parent->sourceChannels();
     memset( buffer, 0, bufs );
 
-    if ( parent->buffer()->size() >= bufs && !parent->isPaused() )
+    if ( !parent->isPaused() && ring->readable() >= bufs )
     {
-        // Apply volume scaling
-        for ( int i = 0; i < bufs / 2; i++ )
-        {
-            union PCMDATA
-            {
-                short i;
-                unsigned char b[2];
-            } pcmData;
+        const float volume = parent->volume();
 
-            pcmData.b[0] = parent->buffer()->at( i * 2 );
-            pcmData.b[1] = parent->buffer()->at( i * 2 + 1 );
+        int done = 0;
+        while ( done < bufs )
+        {
+            const char* data;
+            int len = qMin( ring->peek( &data ), bufs - done );
+            len -= len % 2;
+            if ( len <= 0 )
+                break;
 
-            float pcmValue = (float)pcmData.i * parent->volume();
-            pcmData.i = (short)pcmValue;
+            // Apply volume scaling
+            PcmConvert::scaleInt16( (const qint16*)data, (qint16*)( buffer + done ), len / 2, volume );
 
-            buffer[i * 2] = pcmData.b[0];
-            buffer[i * 2 + 1] = pcmData.b[1];
+            ring->consume( len );
+            done += len;
         }
 
         parent->m_pcmCounter += bufs;
-        parent->buffer()->remove( 0, bufs );
     }
 
     return 0;
@@ -73,6 +76,7 @@ RTAudioOutput::RTAudioOutput() :
     m_audio( new RtAudio() ),
     m_bufferEmpty( true ),
     m_volume( 0.75 ),
+    m_buffer( BUFFER_CAPACITY ),
     m_paused( false ),
     m_playing( false ),
     m_bps( -1 )
@@ -161,7 +165,8 @@ RTAudioOutput::stopPlayback()
 
     delete m_audio; // FIXME
     m_audio = new RtAudio();
-    m_buffer.clear();
+    m_buffer.reset( BUFFER_CAPACITY );
+    m_pending.clear();
     m_paused = false;
     m_playing = false;
     m_bps = -1;
@@ -192,7 +197,8 @@ RTAudioOutput::initAudio( long sampleRate, int channels )
         //options.flags = RTAUDIO_SCHEDULE_REALTIME;
 
         m_sourceChannels = channels;
-        m_buffer.clear();
+        m_buffer.reset( BUFFER_CAPACITY );
+        m_pending.clear();
 
 /*        if ( m_audio->isStreamRunning() )
             m_audio->abortStream();
@@ -212,13 +218,16 @@ RTAudioOutput::initAudio( long sampleRate, int channels )
 bool
 RTAudioOutput::needData()
 {
-    if ( m_buffer.isEmpty() && !m_bufferEmpty )
+    QMutexLocker locker( &m_mutex );
+    flushPending();
+
+    if ( m_buffer.fill() == 0 && m_pending.isEmpty() && !m_bufferEmpty )
     {
         m_bufferEmpty = true;
         emit bufferEmpty();
     }
 
-    return ( m_buffer.size() < 65535 ); // FIXME constant value
+    return ( m_pending.isEmpty() && m_buffer.fill() < BUFFER_HIGHWATER );
 }
 
 
@@ -227,7 +236,18 @@ RTAudioOutput::processData( const QByteArray &buffer )
 {
     QMutexLocker locker( &m_mutex );
 
-    m_buffer.append( buffer );
+    if ( m_pending.isEmpty() )
+    {
+        int written = m_buffer.write( buffer.constData(), buffer.size() );
+        if ( written < buffer.size() )
+            m_pending = buffer.mid( written );
+    }
+    else
+    {
+        m_pending.append( buffer );
+        flushPending();
+    }
+
     if ( m_bufferEmpty && !buffer.isEmpty() )
     {
         m_bufferEmpty = false;
@@ -236,13 +256,26 @@ RTAudioOutput::processData( const QByteArray &buffer )
 }
 
 
+void
+RTAudioOutput::flushPending()
+{
+    if ( m_pending.isEmpty() )
+        return;
+
+    int written = m_buffer.write( m_pending.constData(), m_pending.size() );
+    m_pending.remove( 0, written );
+}
+
+
 void
 RTAudioOutput::clearBuffers()
 {
     qDebug() << Q_FUNC_INFO;
     QMutexLocker locker( &m_mutex );
 
-    m_buffer.clear();
+    // the callback drops what's left on its next run
+    m_buffer.discard();
+    m_pending.clear();
     m_bufferEmpty = true;
     emit bufferEmpty();
 }
@@ -20,6 +20,7 @@
 #define RTAUDIOPLAYBACK_H
 
 #include "RtAudio.h"
+#include "pcmringbuffer.h"
 
 #include <QObject>
 #include <QMutex>
@@ -38,18 +39,19 @@ class RTAudioOutput : public QObject
         bool isPaused() { return m_paused; }
         virtual bool isPlaying() { return m_playing; }
 
-        bool haveData() { return m_buffer.length() > 2048; }
+        bool haveData() { return m_buffer.fill() + m_pending.size() > 2048; }
         bool needData();
         void processData( const QByteArray &buffer );
+        int bufferSize() { return m_buffer.fill() + m_pending.size(); }
 
         QStringList soundSystems();
         QStringList devices();
         int sourceChannels() { return m_sourceChannels; }
 
-        QMutex* mutex() { return &m_mutex; }
-        QByteArray* buffer() { return &m_buffer; }
+        // consumed by the audio callback, which must never lock:
+        PcmRingBuffer* buffer() { return &m_buffer; }
 
-        int m_pcmCounter;
+        unsigned int m_pcmCounter;
 
     public slots:
         void clearBuffers();
@@ -75,7 +77,8 @@ class RTAudioOutput : public QObject
         bool m_bufferEmpty;
 
         float m_volume;
-        QByteArray m_buffer;
+        PcmRingBuffer m_buffer;
+        QByteArray m_pending; // what didn't fit into m_buffer yet
         QMutex m_mutex;
 
         int m_sourceChannels;
@@ -84,6 +87,7 @@ class RTAudioOutput : public QObject
         int m_bps;
         
         int internalSoundCardID( int settingsID );
+        void flushPending();
 };
 
 #endif
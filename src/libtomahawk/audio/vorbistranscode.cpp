@@ -18,6 +18,9 @@
 
 #include "vorbistranscode.h"
 
+// most decoded bytes a single ov_read() may hand us
+#define OGG_READ_SIZE 16384
+
 
 size_t
 vorbis_read( void* data_ptr, size_t byteSize, size_t sizeToRead, void* data_src )
@@ -123,16 +126,11 @@ VorbisTranscode::processData( const QByteArray& data, bool )
 
     while ( m_buffer.size() >= OGG_BUFFER && result > 0 )
     {
-        char tempBuffer[16384];
-        result = ov_read( &m_vorbisFile, tempBuffer, sizeof( tempBuffer ), 0, 2, 1, &currentSection );
-
-        if ( result > 0 )
-        {
-            for ( int i = 0; i < ( result / 2 ); i++ )
-            {
-                m_outBuffer.append( tempBuffer[i * 2] );
-                m_outBuffer.append( tempBuffer[i * 2 + 1] );
-            }
-        }
+        // let libvorbis write its 16 bit samples straight into our output
+        const int offset = m_outBuffer.size();
+        m_outBuffer.resize( offset + OGG_READ_SIZE );
+
+        result = ov_read( &m_vorbisFile, m_outBuffer.data() + offset, OGG_READ_SIZE, 0, 2, 1, &currentSection );
+        m_outBuffer.resize( offset + qMax( result, 0L ) );
     }
 }
@@ -77,6 +77,8 @@ public:
 
 signals:
     void tracksAdded( const QList<Tomahawk::query_ptr>& tracks );
+    /// the last page of tracks requested by tracks() has been added
+    void tracksLoaded();
     void tracksRemoved( const QList<Tomahawk::query_ptr>& tracks );
 
     void playlistsAdded( const QList<Tomahawk::playlist_ptr>& );
@@ -18,7 +18,8 @@
 
 #include "database.h"
 
-#define WORKER_THREADS 5
+#define MIN_WORKER_THREADS 2
+#define MAX_WORKER_THREADS 8
 
 Database* Database::s_instance = 0;
 
@@ -38,6 +39,15 @@ Database::Database( const QString& dbname, QObject* parent )
     s_instance = this;
 
     m_workerRW->start();
+
+    int threads = qBound( MIN_WORKER_THREADS, QThread::idealThreadCount(), MAX_WORKER_THREADS );
+    for ( int i = 0; i < threads; i++ )
+    {
+        DatabaseWorker* worker = new DatabaseWorker( m_impl, this, false );
+        worker->start();
+
+        m_workers << worker;
+    }
 }
 
 
@@ -69,41 +79,53 @@ Database::enqueue( QSharedPointer<DatabaseCommand> lc )
     }
     else
     {
-        // find existing amount of worker threads for commandname
-        // create new thread if < WORKER_THREADS
-        if ( m_workers.count( lc->commandname() ) < WORKER_THREADS )
-        {
-            DatabaseWorker* worker = new DatabaseWorker( m_impl, this, false );
-            worker->start();
-
-            m_workers.insertMulti( lc->commandname(), worker );
-        }
-
-        // find thread for commandname with lowest amount of outstanding jobs and enqueue job
-        int busyThreads = 0;
+        // find thread with lowest amount of outstanding jobs and enqueue job
         DatabaseWorker* happyThread = 0;
-        QList< DatabaseWorker* > workers = m_workers.values( lc->commandname() );
-        for ( int i = 0; i < workers.count(); i++ )
+        foreach ( DatabaseWorker* worker, m_workers )
         {
-            DatabaseWorker* worker = workers.at( i );
+            if ( worker->failed() )
+                continue;
 
             if ( !worker->busy() )
             {
                 happyThread = worker;
                 break;
             }
-            busyThreads++;
 
             if ( !happyThread || worker->outstandingJobs() < happyThread->outstandingJobs() )
                 happyThread = worker;
         }
 
-        qDebug() << "Enqueueing command to thread:" << happyThread << busyThreads << lc->commandname();
+        // none of them could open a read-only connection, use the primary one
+        if ( !happyThread )
+            happyThread = m_workerRW;
+
+        qDebug() << "Enqueueing command to thread:" << happyThread << happyThread->outstandingJobs() << lc->commandname();
         happyThread->enqueue( lc );
     }
 }
 
 
+void
+Database::enqueue( const QList< QSharedPointer<DatabaseCommand> >& lc )
+{
+    QList< QSharedPointer<DatabaseCommand> > mutating;
+    foreach ( const QSharedPointer<DatabaseCommand>& cmd, lc )
+    {
+        if ( cmd->doesMutates() )
+            mutating << cmd;
+        else
+            enqueue( cmd );
+    }
+
+    if ( mutating.isEmpty() )
+        return;
+
+    qDebug() << "Enqueueing batch of" << mutating.count() << "commands to rw thread";
+    m_workerRW->enqueue( mutating );
+}
+
+
 QString
 Database::dbid() const
 {
@@ -59,11 +59,13 @@ signals:
 
 public slots:
     void enqueue( QSharedPointer<DatabaseCommand> lc );
+    /// mutating commands in this list are committed in one transaction
+    void enqueue( const QList< QSharedPointer<DatabaseCommand> >& lc );
 
 private:
     DatabaseImpl* m_impl;
     DatabaseWorker* m_workerRW;
-    QHash< QString, DatabaseWorker* > m_workers;
+    QList< DatabaseWorker* > m_workers;
     bool m_indexReady;
 
     static Database* s_instance;
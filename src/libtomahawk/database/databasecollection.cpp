@@ -67,9 +67,13 @@ DatabaseCollection::loadTracks()
 
     setLoaded();
     DatabaseCommand_AllTracks* cmd = new DatabaseCommand_AllTracks( source()->collection() );
+    // in the order collection views show by default, so the tracks arriving first are the top rows
+    cmd->setSortOrder( DatabaseCommand_AllTracks::ArtistName );
 
     connect( cmd, SIGNAL( tracks( QList<Tomahawk::query_ptr> ) ),
                     SLOT( setTracks( QList<Tomahawk::query_ptr> ) ) );
+    connect( cmd, SIGNAL( done( Tomahawk::collection_ptr ) ),
+                    SIGNAL( tracksLoaded() ) );
 
     Database::instance()->enqueue( QSharedPointer<DatabaseCommand>( cmd ) );
 }
@@ -65,6 +65,8 @@ public:
 
     // stuff to do once transaction applied ok.
     // Don't change the database from in here, duh.
+    // exec() runs again if its batch got rolled back (see DatabaseWorker::doWork),
+    // so signals and anything cached outside the db belong in here.
     void postCommit() { postCommitHook(); emit committed(); }
     virtual void postCommitHook(){};
 
@@ -25,6 +25,7 @@
 #include "collection.h"
 #include "database/database.h"
 #include "databasecommand_collectionstats.h"
+#include "databasecommand_updatesearchindex.h"
 #include "databaseimpl.h"
 #include "network/controlconnection.h"
 
@@ -36,7 +37,7 @@ QVariantList
 DatabaseCommand_AddFiles::files() const
 {
     QVariantList list;
-    foreach ( const QVariant& v, m_files )
+    foreach ( const QVariant& v, m_filesWithIds.isEmpty() ? m_files : m_filesWithIds )
     {
         // replace url with the id, we don't leak file paths over the network.
         QVariantMap m = v.toMap();
@@ -53,12 +54,59 @@ void
 DatabaseCommand_AddFiles::postCommitHook()
 {
     qDebug() << Q_FUNC_INFO;
+
+    emit done( m_filesWithIds, source()->collection() );
+
+    // only index what we touched, instead of rebuilding the whole index
+    if ( !m_searchIndexUpdates.isEmpty() )
+    {
+        DatabaseCommand* cmd = new DatabaseCommand_UpdateSearchIndex( m_searchIndexUpdates, QMap< QString, QList< unsigned int > >() );
+        Database::instance()->enqueue( QSharedPointer<DatabaseCommand>( cmd ) );
+    }
+
     if ( source().isNull() || source()->collection().isNull() )
     {
         qDebug() << "Source has gone offline, not emitting to GUI.";
         return;
     }
 
+    m_queries.clear();
+    foreach ( const NewTrack& t, m_newTracks )
+    {
+        const QVariantMap& m = t.file;
+        const QString artist = m.value( "artist" ).toString();
+        const QString album = m.value( "album" ).toString();
+        const QString track = m.value( "track" ).toString();
+
+        QVariantMap attr;
+        Tomahawk::query_ptr query = Tomahawk::Query::get( artist, track, album );
+        attr["releaseyear"] = m.value( "year" );
+
+        Tomahawk::artist_ptr artistptr = Tomahawk::Artist::get( t.artistid, artist );
+        Tomahawk::album_ptr albumptr = Tomahawk::Album::get( t.albumid, album, artistptr );
+        Tomahawk::result_ptr result = Tomahawk::result_ptr( new Tomahawk::Result() );
+        result->setModificationTime( m.value( "mtime" ).toInt() );
+        result->setSize( m.value( "size" ).toUInt() );
+        result->setMimetype( m.value( "mimetype" ).toString() );
+        result->setDuration( m.value( "duration" ).toUInt() );
+        result->setBitrate( m.value( "bitrate" ).toUInt() );
+        result->setArtist( artistptr );
+        result->setAlbum( albumptr );
+        result->setTrack( track );
+        result->setAlbumPos( m.value( "albumpos" ).toUInt() );
+        result->setAttributes( attr );
+        result->setCollection( source()->collection() );
+        result->setScore( 1.0 );
+        result->setUrl( t.url );
+        result->setId( t.trackid );
+
+        QList<Tomahawk::result_ptr> results;
+        results << result;
+        query->addResults( results );
+
+        m_queries << query;
+    }
+
     // make the collection object emit its tracksAdded signal, so the
     // collection browser will update/fade in etc.
     Collection* coll = source()->collection().data();
@@ -97,12 +145,17 @@ DatabaseCommand_AddFiles::exec( DatabaseImpl* dbi )
     query_file_del.prepare( QString( "DELETE FROM file WHERE source %1 AND url = ?" )
                                .arg( source()->isLocal() ? "IS NULL" : QString( "= %1" ).arg( source()->id() ) ) );
 
-    int added = 0;
+    m_filesWithIds = m_files;
+    m_newTracks.clear();
+    m_searchIndexUpdates.clear();
+
+    int added = 0, inserted = 0, replaced = 0;
+    uint newestMtime = 0;
     QVariant srcid = source()->isLocal() ? QVariant( QVariant::Int ) : source()->id();
     qDebug() << "Adding" << m_files.length() << "files to db for source" << srcid;
 
     QList<QVariant>::iterator it;
-    for( it = m_files.begin(); it != m_files.end(); ++it )
+    for( it = m_filesWithIds.begin(); it != m_filesWithIds.end(); ++it )
     {
         QVariant& v = *it;
         QVariantMap m = v.toMap();
@@ -123,6 +176,7 @@ DatabaseCommand_AddFiles::exec( DatabaseImpl* dbi )
         int fileid = 0, artistid = 0, albumid = 0, trackid = 0;
         query_file_del.bindValue( 0, url );
         query_file_del.exec();
+        replaced += qMax( 0, query_file_del.numRowsAffected() );
 
         query_file.bindValue( 0, srcid );
         query_file.bindValue( 1, url );
@@ -145,6 +199,9 @@ DatabaseCommand_AddFiles::exec( DatabaseImpl* dbi )
             if( added % 1000 == 0 )
                 qDebug() << "Inserted" << added;
         }
+        inserted++;
+        newestMtime = qMax( newestMtime, (uint)mtime );
+
         // get internal IDs for art/alb/trk
         fileid = query_file.lastInsertId().toInt();
         m.insert( "id", fileid );
@@ -175,47 +232,29 @@ DatabaseCommand_AddFiles::exec( DatabaseImpl* dbi )
             continue;
         }
 
+        m_searchIndexUpdates[ "artist" ].insert( artistid, artist );
+        m_searchIndexUpdates[ "track" ].insert( trackid, track );
+        if ( albumid > 0 )
+            m_searchIndexUpdates[ "album" ].insert( albumid, album );
+
         query_trackattr.bindValue( 0, trackid );
         query_trackattr.bindValue( 1, "releaseyear" );
         query_trackattr.bindValue( 2, year );
         query_trackattr.exec();
 
-        QVariantMap attr;
-        Tomahawk::query_ptr query = Tomahawk::Query::get( artist, track, album );
-        attr["releaseyear"] = m.value( "year" );
-
-        Tomahawk::artist_ptr artistptr = Tomahawk::Artist::get( artistid, artist );
-        Tomahawk::album_ptr albumptr = Tomahawk::Album::get( albumid, album, artistptr );
-        Tomahawk::result_ptr result = Tomahawk::result_ptr( new Tomahawk::Result() );
-        result->setModificationTime( mtime );
-        result->setSize( size );
-        result->setMimetype( mimetype );
-        result->setDuration( duration );
-        result->setBitrate( bitrate );
-        result->setArtist( artistptr );
-        result->setAlbum( albumptr );
-        result->setTrack( track );
-        result->setAlbumPos( albumpos );
-        result->setAttributes( attr );
-        result->setCollection( source()->collection() );
-        result->setScore( 1.0 );
-        result->setUrl( url );
-        result->setId( trackid );
-
-        QList<Tomahawk::result_ptr> results;
-        results << result;
-        query->addResults( results );
-
-        m_queries << query;
+        // artist and album objects are cached by id, don't create any before the ids are committed
+        NewTrack t;
+        t.file = m;
+        t.url = url;
+        t.artistid = artistid;
+        t.albumid = albumid;
+        t.trackid = trackid;
+        m_newTracks << t;
 
         added++;
     }
     qDebug() << "Inserted" << added;
-
-    // TODO building the index could be a separate job, outside this transaction
-    if ( added )
-        dbi->updateSearchIndex();
+    dbi->filesChanged( source()->isLocal() ? 0 : source()->id(), inserted - replaced, newestMtime );
 
     qDebug() << "Committing" << added << "tracks...";
-    emit done( m_files, source()->collection() );
 }
@@ -58,8 +58,24 @@ signals:
     void notify( const QList<Tomahawk::query_ptr>& );
 
 private:
+    // a file exec() added, turned into a query once committed
+    struct NewTrack
+    {
+        QVariantMap file;
+        QString url;
+        int artistid;
+        int albumid;
+        int trackid;
+    };
+
+    // exec() may run again after a rollback, so it leaves m_files as it got them
     QVariantList m_files;
+    QVariantList m_filesWithIds;
+    QList< NewTrack > m_newTracks;
     QList<Tomahawk::query_ptr> m_queries;
+
+    // artist/album/track entries touched, to be (re-)indexed after commit
+    QMap< QString, QMap< unsigned int, QString > > m_searchIndexUpdates;
 };
 
 #endif // DATABASECOMMAND_ADDFILES_H
@@ -25,6 +25,12 @@
 #include "album.h"
 #include "sourcelist.h"
 
+// tracks are handed out in pages of this many, so the first ones show up before the query is done
+#define TRACKS_PAGE 5000
+// separators of the attributes folded into each row, chosen not to appear in tag values
+#define ATTR_SEPARATOR QChar( 0x1e )
+#define KEY_SEPARATOR QChar( 0x1f )
+
 
 void
 DatabaseCommand_AllTracks::exec( DatabaseImpl* dbi )
@@ -49,15 +55,24 @@ DatabaseCommand_AllTracks::exec( DatabaseImpl* dbi )
         case AlbumPosition:
             m_orderToken = "file_join.albumpos";
             break;
+
+        case ArtistName:
+            m_orderToken = "artist.name COLLATE NOCASE, album.name COLLATE NOCASE, file_join.albumpos";
+            break;
     }
 
 
     if ( !m_collection.isNull() )
         sourceToken = QString( "AND file.source %1" ).arg( m_collection->source()->isLocal() ? "IS NULL" : QString( "= %1" ).arg( m_collection->source()->id() ) );
 
+    // the track's attributes come along in the same row, instead of a query per track
+    QString attrToken = QString( "( SELECT group_concat( k || '%1' || v, '%2' ) FROM track_attributes WHERE track_attributes.id = track.id ) " )
+                           .arg( KEY_SEPARATOR ).arg( ATTR_SEPARATOR );
+
     QString sql = QString(
             "SELECT file.id, artist.name, album.name, track.name, file.size, "
-                   "file.duration, file.bitrate, file.url, file.source, file.mtime, file.mimetype, file_join.albumpos, artist.id, album.id, track.id "
+                   "file.duration, file.bitrate, file.url, file.source, file.mtime, file.mimetype, file_join.albumpos, artist.id, album.id, track.id, "
+                   + attrToken +
             "FROM file, artist, track, file_join "
             "LEFT OUTER JOIN album "
             "ON file_join.album = album.id "
@@ -77,13 +92,12 @@ DatabaseCommand_AllTracks::exec( DatabaseImpl* dbi )
     query.prepare( sql );
     query.exec();
 
-    int i = 0;
+    int total = 0;
     while( query.next() )
     {
         Tomahawk::result_ptr result = Tomahawk::result_ptr( new Tomahawk::Result() );
 
         QVariantMap attr;
-        TomahawkSqlQuery attrQuery = dbi->newquery();
         Tomahawk::source_ptr s;
 
         if( query.value( 8 ).toUInt() == 0 )
@@ -125,12 +139,14 @@ DatabaseCommand_AllTracks::exec( DatabaseImpl* dbi )
         result->setScore( 1.0 );
         result->setCollection( s->collection() );
 
-        attrQuery.prepare( "SELECT k, v FROM track_attributes WHERE id = ?" );
-        attrQuery.bindValue( 0, result->dbid() );
-        attrQuery.exec();
-        while ( attrQuery.next() )
+        const QString attrs = query.value( 15 ).toString();
+        if ( !attrs.isEmpty() )
         {
-            attr[ attrQuery.value( 0 ).toString() ] = attrQuery.value( 1 ).toString();
+            foreach ( const QString& pair, attrs.split( ATTR_SEPARATOR ) )
+            {
+                const int sep = pair.indexOf( KEY_SEPARATOR );
+                attr[ pair.left( sep ) ] = pair.mid( sep + 1 );
+            }
         }
 
         result->setAttributes( attr );
@@ -140,9 +156,16 @@ DatabaseCommand_AllTracks::exec( DatabaseImpl* dbi )
         qry->addResults( results );
 
         ql << qry;
+        total++;
+
+        if ( ql.count() >= TRACKS_PAGE )
+        {
+            emit tracks( ql );
+            ql.clear();
+        }
     }
 
-    qDebug() << Q_FUNC_INFO << ql.length();
+    qDebug() << Q_FUNC_INFO << total;
 
     emit tracks( ql );
     emit done( m_collection );
@@ -37,7 +37,8 @@ public:
         None = 0,
         Album = 1,
         ModificationTime = 2,
-        AlbumPosition = 3
+        AlbumPosition = 3,
+        ArtistName = 4
     };
 
     explicit DatabaseCommand_AllTracks( const Tomahawk::collection_ptr& collection = Tomahawk::collection_ptr(), QObject* parent = 0 )
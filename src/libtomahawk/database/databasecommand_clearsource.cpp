@@ -0,0 +1,165 @@
+/* === This file is part of Tomahawk Player - <http://tomahawk-player.org> ===
+ * 
+ *   Copyright 2010-2011, Christian Muehlhaeuser <muesli@tomahawk-player.org>
+ *
+ *   Tomahawk is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Tomahawk is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Tomahawk. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "databasecommand_clearsource.h"
+
+#include "collection.h"
+#include "playlist.h"
+#include "database/database.h"
+#include "databasecommand_updatesearchindex.h"
+
+using namespace Tomahawk;
+
+
+DatabaseCommand_ClearSource::DatabaseCommand_ClearSource( const source_ptr& source, QObject* parent )
+    : DatabaseCommand( source, parent )
+{
+}
+
+
+void
+DatabaseCommand_ClearSource::exec( DatabaseImpl* lib )
+{
+    Q_ASSERT( !source()->isLocal() );
+    qDebug() << Q_FUNC_INFO << source()->id();
+
+    m_files.clear();
+    m_playlists.clear();
+    m_dynamicPlaylists.clear();
+    m_searchIndexRemovals.clear();
+
+    TomahawkSqlQuery query = lib->newquery();
+    query.prepare( "SELECT url FROM file WHERE source = ?" );
+    query.addBindValue( source()->id() );
+    query.exec();
+    while ( query.next() )
+        m_files << QString( "servent://%1\t%2" ).arg( source()->userName() ).arg( query.value( 0 ).toString() );
+
+    query.prepare( "SELECT guid, dynplaylist FROM playlist WHERE source = ?" );
+    query.addBindValue( source()->id() );
+    query.exec();
+    while ( query.next() )
+    {
+        if ( query.value( 1 ).toBool() )
+            m_dynamicPlaylists << query.value( 0 ).toString();
+        else
+            m_playlists << query.value( 0 ).toString();
+    }
+
+    // catalog entries the files refer to, some may be left without any files
+    QMap< QString, QList< unsigned int > > catalog;
+    foreach ( const QString& table, QStringList() << "artist" << "album" << "track" )
+    {
+        query.prepare( QString( "SELECT DISTINCT file_join.%1 FROM file, file_join "
+                                "WHERE file.id = file_join.file AND file.source = ? AND file_join.%1 IS NOT NULL" ).arg( table ) );
+        query.addBindValue( source()->id() );
+        query.exec();
+        while ( query.next() )
+            catalog[ table ] << query.value( 0 ).toUInt();
+    }
+
+    // file_join, playlist items and revisions go with them
+    query.prepare( "DELETE FROM file WHERE source = ?" );
+    query.addBindValue( source()->id() );
+    query.exec();
+    lib->filesCleared( source()->id() );
+    removeOrphansFromIndex( lib, catalog );
+
+    query.prepare( "DELETE FROM playlist WHERE source = ?" );
+    query.addBindValue( source()->id() );
+    query.exec();
+
+    query.prepare( "DELETE FROM dynamic_playlist WHERE guid = ?" );
+    foreach ( const QString& guid, m_dynamicPlaylists )
+    {
+        query.bindValue( 0, guid );
+        query.exec();
+    }
+
+    query.prepare( "DELETE FROM playback_log WHERE source = ?" );
+    query.addBindValue( source()->id() );
+    query.exec();
+
+    query.prepare( "UPDATE source SET lastop = '' WHERE id = ?" );
+    query.addBindValue( source()->id() );
+    query.exec();
+
+    qDebug() << "Cleared" << m_files.count() << "files and" << m_playlists.count() + m_dynamicPlaylists.count()
+             << "playlists of source" << source()->id();
+}
+
+
+void
+DatabaseCommand_ClearSource::postCommitHook()
+{
+    qDebug() << Q_FUNC_INFO;
+
+    // before the snapshot's ops are applied, they re-index what is still there
+    if ( !m_searchIndexRemovals.isEmpty() )
+    {
+        DatabaseCommand* cmd = new DatabaseCommand_UpdateSearchIndex( QMap< QString, QMap< unsigned int, QString > >(), m_searchIndexRemovals );
+        Database::instance()->enqueue( QSharedPointer<DatabaseCommand>( cmd ) );
+    }
+
+    if ( source().isNull() || source()->collection().isNull() )
+    {
+        qDebug() << "Source has gone offline, not emitting to GUI.";
+        return;
+    }
+
+    source()->setLastOpGuid( QString() );
+
+    Collection* coll = source()->collection().data();
+    connect( this, SIGNAL( notify( QStringList ) ),
+             coll,   SLOT( delTracks( QStringList ) ), Qt::QueuedConnection );
+    emit notify( m_files );
+
+    foreach ( const QString& guid, m_playlists )
+    {
+        playlist_ptr playlist = coll->playlist( guid );
+        if ( !playlist.isNull() )
+            playlist->reportDeleted( playlist );
+    }
+
+    foreach ( const QString& guid, m_dynamicPlaylists )
+    {
+        dynplaylist_ptr playlist = coll->dynamicPlaylist( guid );
+        if ( !playlist.isNull() )
+            playlist->reportDeleted( playlist );
+    }
+}
+
+
+/// like DatabaseCommand_DeleteFiles: entries without any files left are dropped from the search index
+void
+DatabaseCommand_ClearSource::removeOrphansFromIndex( DatabaseImpl* lib, const QMap< QString, QList< unsigned int > >& catalog )
+{
+    foreach ( const QString& table, catalog.keys() )
+    {
+        TomahawkSqlQuery query = lib->newquery();
+        query.prepare( QString( "SELECT 1 FROM file_join WHERE %1 = ? LIMIT 1" ).arg( table ) );
+
+        foreach ( unsigned int id, catalog.value( table ) )
+        {
+            query.bindValue( 0, id );
+            query.exec();
+            if ( !query.next() )
+                m_searchIndexRemovals[ table ] << id;
+        }
+    }
+}
@@ -0,0 +1,55 @@
+/* === This file is part of Tomahawk Player - <http://tomahawk-player.org> ===
+ * 
+ *   Copyright 2010-2011, Christian Muehlhaeuser <muesli@tomahawk-player.org>
+ *
+ *   Tomahawk is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Tomahawk is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Tomahawk. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DATABASECOMMAND_CLEARSOURCE_H
+#define DATABASECOMMAND_CLEARSOURCE_H
+
+#include <QMap>
+#include <QStringList>
+
+#include "databasecommand.h"
+#include "databaseimpl.h"
+
+#include "dllmacro.h"
+
+/// Drops our cached copy of a peer's collection, playlists and playback log,
+/// before it is replaced by a snapshot of its compacted oplog.
+class DLLEXPORT DatabaseCommand_ClearSource : public DatabaseCommand
+{
+Q_OBJECT
+
+public:
+    explicit DatabaseCommand_ClearSource( const Tomahawk::source_ptr& source, QObject* parent = 0 );
+
+    virtual QString commandname() const { return "clearsource"; }
+    virtual bool doesMutates() const { return true; }
+    virtual void exec( DatabaseImpl* lib );
+    virtual void postCommitHook();
+
+signals:
+    void notify( const QStringList& files );
+
+private:
+    void removeOrphansFromIndex( DatabaseImpl* lib, const QMap< QString, QList< unsigned int > >& catalog );
+
+    QStringList m_files;
+    QStringList m_playlists, m_dynamicPlaylists;
+    QMap< QString, QList< unsigned int > > m_searchIndexRemovals;
+};
+
+#endif // DATABASECOMMAND_CLEARSOURCE_H
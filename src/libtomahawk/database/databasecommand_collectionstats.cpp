@@ -29,38 +29,47 @@ DatabaseCommand_CollectionStats::DatabaseCommand_CollectionStats( const source_p
 }
 
 
+/// numfiles and lastmodified come from DatabaseImpl's stats, scanning the files only when they aren't known yet
 void
 DatabaseCommand_CollectionStats::exec( DatabaseImpl* dbi )
 {
     Q_ASSERT( source()->isLocal() || source()->id() >= 1 );
     TomahawkSqlQuery query = dbi->newquery();
 
-    QVariantMap m;
-    if ( source()->isLocal() )
+    const int id = source()->isLocal() ? 0 : source()->id();
+    int numfiles = 0;
+    uint lastmodified = 0, generation = 0;
+    if ( !dbi->collectionStats( id, numfiles, lastmodified, generation ) )
     {
-        query.exec( "SELECT count(*), max(mtime), (SELECT guid FROM oplog WHERE source IS NULL ORDER BY id DESC LIMIT 1) "
-                    "FROM file "
-                    "WHERE source IS NULL" );
-    }
-    else
-    {
-        query.prepare( "SELECT count(*), max(mtime), (SELECT lastop FROM source WHERE id = ?) "
-                       "FROM file "
-                       "WHERE source = ?" );
-        query.addBindValue( source()->id() );
-        query.addBindValue( source()->id() );
+        query.prepare( QString( "SELECT count(*), max(mtime) FROM file WHERE source %1" )
+                          .arg( source()->isLocal() ? "IS NULL" : QString( "= %1" ).arg( id ) ) );
         query.exec();
+        if ( query.next() )
+        {
+            numfiles = query.value( 0 ).toInt();
+            lastmodified = query.value( 1 ).toUInt();
+            dbi->setCollectionStats( id, numfiles, lastmodified, generation );
+        }
     }
 
-    if ( query.next() )
-    {
-        m.insert( "numfiles", query.value( 0 ).toInt() );
-        m.insert( "lastmodified", query.value( 1 ).toInt() );
+    QVariantMap m;
+    m.insert( "numfiles", numfiles );
+    m.insert( "lastmodified", lastmodified );
 
-        if ( !source()->isLocal() && !source()->lastOpGuid().isEmpty() )
-            m.insert( "lastop", source()->lastOpGuid() );
+    if ( !source()->isLocal() && !source()->lastOpGuid().isEmpty() )
+        m.insert( "lastop", source()->lastOpGuid() );
+    else
+    {
+        if ( source()->isLocal() )
+            query.exec( "SELECT guid FROM oplog WHERE source IS NULL ORDER BY id DESC LIMIT 1" );
         else
-            m.insert( "lastop", query.value( 2 ).toString() );
+        {
+            query.prepare( "SELECT lastop FROM source WHERE id = ?" );
+            query.addBindValue( id );
+            query.exec();
+        }
+
+        m.insert( "lastop", query.next() ? query.value( 0 ).toString() : QString() );
     }
 
     emit done( m );
@@ -0,0 +1,388 @@
+/* === This file is part of Tomahawk Player - <http://tomahawk-player.org> ===
+ * 
+ *   Copyright 2010-2011, Christian Muehlhaeuser <muesli@tomahawk-player.org>
+ *
+ *   Tomahawk is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Tomahawk is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Tomahawk. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "databasecommand_compactoplog.h"
+
+#include <qjson/parser.h>
+#include <qjson/serializer.h>
+
+#include "playlistrevisiondelta.h"
+#include "tomahawksqlquery.h"
+
+// don't bother with fewer local ops than this
+#define COMPACT_MIN_OPS 1000
+// only rewrite the oplog if that saves at least 1/COMPACT_MIN_SAVING of its bytes
+#define COMPACT_MIN_SAVING 4
+// files per addfiles op in the compacted oplog
+#define FILES_PER_OP 1000
+// same threshold as DatabaseWorker::logOp
+#define COMPRESS_THRESHOLD 512
+
+using namespace Tomahawk;
+
+
+namespace
+{
+    // what's left of the ops on one of our playlists
+    struct PlaylistOps
+    {
+        QVariantMap create;
+        QVariantMap rename;
+        QList< QVariantMap > revisions;
+        QVariantMap currentRevision;
+        QHash< QString, QVariant > entries; // every entry ever added, by guid
+    };
+}
+
+
+static QString
+playlistGuid( const QVariantMap& op )
+{
+    if ( op.contains( "playlistguid" ) )
+        return op.value( "playlistguid" ).toString();
+
+    return op.value( "playlist" ).toMap().value( "guid" ).toString();
+}
+
+
+DatabaseCommand_CompactOplog::DatabaseCommand_CompactOplog( QObject* parent )
+    : DatabaseCommand( parent )
+{
+}
+
+
+void
+DatabaseCommand_CompactOplog::exec( DatabaseImpl* lib )
+{
+    TomahawkSqlQuery query = lib->newquery();
+    query.exec( "SELECT count(*), max(id) FROM oplog WHERE source IS NULL" );
+    if ( !query.next() )
+        return;
+
+    const int opsBefore = query.value( 0 ).toInt();
+    const int lastId = query.value( 1 ).toInt();
+    if ( opsBefore < COMPACT_MIN_OPS )
+    {
+        emit done( opsBefore, opsBefore );
+        return;
+    }
+
+    // our playlists that still exist, and the revision they're at
+    QHash< QString, QString > currentRevisions;
+    query.exec( "SELECT guid, currentrevision FROM playlist WHERE source IS NULL" );
+    while ( query.next() )
+        currentRevisions.insert( query.value( 0 ).toString(), query.value( 1 ).toString() );
+
+    const QStringList playlistCommands = QStringList()
+        << "createplaylist" << "renameplaylist" << "setplaylistrevision" << "deleteplaylist"
+        << "createdynamicplaylist" << "setdynamicplaylistrevision" << "deletedynamicplaylist";
+
+    QJson::Parser parser;
+    QList< int > ids;
+    QString lastGuid;
+    qint64 bytesBefore = 0;
+
+    const int deletionsAfter = keepDeletionsAfter( lib, lastId );
+
+    QStringList playlistOrder;
+    QHash< QString, PlaylistOps > playlists;
+    QList< QVariantMap > deleteOps, otherOps, singletonOps;
+
+    query.exec( "SELECT id, guid, command, singleton, compressed, json "
+                "FROM oplog WHERE source IS NULL ORDER BY id ASC" );
+    while ( query.next() )
+    {
+        ids << query.value( 0 ).toInt();
+        lastGuid = query.value( 1 ).toString();
+        const QString command = query.value( 2 ).toString();
+        QByteArray json = query.value( 5 ).toByteArray();
+        bytesBefore += json.length();
+
+        // replaced by the files we have now, see loadFiles()
+        if ( command == "addfiles" || ( command == "deletefiles" && ids.last() <= deletionsAfter ) )
+            continue;
+
+        if ( query.value( 4 ).toBool() )
+            json = qUncompress( json );
+
+        bool ok;
+        const QVariantMap op = parser.parse( json, &ok ).toMap();
+        if ( !ok )
+        {
+            qDebug() << Q_FUNC_INFO << "Can't parse op" << lastGuid << "- not compacting";
+            emit done( opsBefore, opsBefore );
+            return;
+        }
+
+        if ( query.value( 3 ).toBool() )
+        {
+            singletonOps << op;
+            continue;
+        }
+
+        if ( command == "deletefiles" )
+        {
+            deleteOps << op;
+            continue;
+        }
+
+        if ( !playlistCommands.contains( command ) )
+        {
+            otherOps << op;
+            continue;
+        }
+
+        // everything on deleted playlists goes, including their deletion
+        const QString guid = playlistGuid( op );
+        if ( !currentRevisions.contains( guid ) )
+            continue;
+
+        PlaylistOps& pl = playlists[ guid ];
+        if ( command == "createplaylist" || command == "createdynamicplaylist" )
+        {
+            if ( pl.create.isEmpty() )
+                playlistOrder << guid;
+            pl.create = op;
+        }
+        else if ( command == "renameplaylist" )
+        {
+            pl.rename = op;
+        }
+        else
+        {
+            foreach ( const QVariant& entry, op.value( "addedentries" ).toList() )
+                pl.entries.insert( entry.toMap().value( "guid" ).toString(), entry );
+
+            if ( command == "setplaylistrevision" && op.value( "newrev" ).toString() == currentRevisions.value( guid ) )
+                pl.currentRevision = op;
+
+            pl.revisions << op;
+        }
+    }
+
+    // before the adds, a file deleted and added again is there in the end
+    QList< QVariantMap > ops = deleteOps;
+    loadFiles( lib, ops );
+
+    // playlists we never logged a creation for couldn't be applied by peers anyway
+    foreach ( const QString& guid, playlistOrder )
+    {
+        const PlaylistOps& pl = playlists[ guid ];
+        ops << pl.create;
+        if ( !pl.rename.isEmpty() )
+            ops << pl.rename;
+
+        if ( pl.create.value( "command" ).toString() == "createdynamicplaylist" || pl.currentRevision.isEmpty() )
+        {
+            ops << pl.revisions;
+            continue;
+        }
+
+        // the op may only hold a delta against a revision we're dropping
+        QStringList orderedguids;
+        if ( !PlaylistRevisionDelta::loadEntries( lib, currentRevisions.value( guid ), orderedguids ) )
+        {
+            ops << pl.revisions;
+            continue;
+        }
+
+        // a single revision from nothing to the current one, with the entries it is made of
+        QVariantMap revision = pl.currentRevision;
+        QVariantList ordered, added;
+        foreach ( const QString& entry, orderedguids )
+        {
+            ordered << entry;
+            if ( pl.entries.contains( entry ) )
+                added << pl.entries.value( entry );
+        }
+        revision.insert( "oldrev", QString() );
+        revision.insert( "orderedguids", ordered );
+        revision.remove( "orderedguidsdelta" );
+        revision.insert( "addedentries", added );
+        ops << revision;
+    }
+
+    ops << otherOps;
+    const int firstSingleton = ops.count();
+    ops << singletonOps;
+
+    QJson::Serializer serializer;
+    QList< QByteArray > payloads;
+    QList< bool > compressed;
+    qint64 bytesAfter = 0;
+    for ( int i = 0; i < ops.count(); i++ )
+    {
+        ops[ i ].insert( "guid", uuid() );
+        QByteArray ba = serializer.serialize( ops.at( i ) );
+        compressed << ( ba.length() >= COMPRESS_THRESHOLD );
+        if ( compressed.last() )
+            ba = qCompress( ba, 9 );
+
+        bytesAfter += ba.length();
+        payloads << ba;
+    }
+
+    if ( ops.count() > ids.count() || bytesAfter * COMPACT_MIN_SAVING > bytesBefore * ( COMPACT_MIN_SAVING - 1 ) )
+    {
+        qDebug() << Q_FUNC_INFO << "Not worth it:" << opsBefore << "ops," << bytesBefore << "bytes would become"
+                 << ops.count() << "ops," << bytesAfter << "bytes";
+        emit done( opsBefore, opsBefore );
+        return;
+    }
+
+    query.prepare( "DELETE FROM oplog WHERE source IS NULL AND id <= ?" );
+    query.addBindValue( lastId );
+    if ( !query.exec() )
+        throw "Failed to clear oplog";
+
+    TomahawkSqlQuery insert = lib->newquery();
+    insert.prepare( "INSERT INTO oplog(id, source, guid, command, singleton, compressed, json) "
+                    "VALUES(?, NULL, ?, ?, ?, ?, ?)" );
+    for ( int i = 0; i < ops.count(); i++ )
+    {
+        insert.bindValue( 0, ids.at( i ) );
+        insert.bindValue( 1, ops.at( i ).value( "guid" ) );
+        insert.bindValue( 2, ops.at( i ).value( "command" ) );
+        insert.bindValue( 3, i >= firstSingleton );
+        insert.bindValue( 4, compressed.at( i ) );
+        insert.bindValue( 5, payloads.at( i ) );
+        if ( !insert.exec() )
+            throw "Failed to write compacted oplog";
+    }
+
+    // peers that synced up to here can go on from the ops logged after it
+    query.prepare( "INSERT OR REPLACE INTO settings(k, v) VALUES(?, ?)" );
+    query.addBindValue( "oplog_compacted_id" );
+    query.addBindValue( lastId );
+    query.exec();
+    query.prepare( "INSERT OR REPLACE INTO settings(k, v) VALUES(?, ?)" );
+    query.addBindValue( "oplog_compacted_guid" );
+    query.addBindValue( lastGuid );
+    query.exec();
+
+    qDebug() << Q_FUNC_INFO << "Compacted oplog from" << opsBefore << "ops," << bytesBefore << "bytes to"
+             << ops.count() << "ops," << bytesAfter << "bytes";
+    emit done( opsBefore, ops.count() );
+}
+
+
+/// the id after which deletefiles ops are kept, lastId if none are needed
+int
+DatabaseCommand_CompactOplog::keepDeletionsAfter( DatabaseImpl* lib, int lastId )
+{
+    int after = lastId;
+
+    TomahawkSqlQuery query = lib->newquery();
+    TomahawkSqlQuery idquery = lib->newquery();
+    idquery.prepare( "SELECT id FROM oplog WHERE source IS NULL AND guid = ?" );
+
+    // peers in sync with our last compaction go on after it, see DatabaseCommand_loadOps
+    int compactedId = 0;
+    QString compactedGuid;
+    query.exec( "SELECT k, v FROM settings WHERE k IN ('oplog_compacted_id', 'oplog_compacted_guid')" );
+    while ( query.next() )
+    {
+        if ( query.value( 0 ).toString() == "oplog_compacted_id" )
+            compactedId = query.value( 1 ).toInt();
+        else
+            compactedGuid = query.value( 1 ).toString();
+    }
+
+    // see DatabaseCommand_SetPeerLastOp
+    query.exec( "SELECT v FROM settings WHERE k LIKE 'oplog_peer_lastop_%'" );
+    while ( query.next() )
+    {
+        // a peer that has nothing from us yet has nothing to delete either
+        const QString lastop = query.value( 0 ).toString();
+        if ( lastop.isEmpty() )
+            continue;
+
+        if ( lastop == compactedGuid )
+        {
+            after = qMin( after, compactedId );
+            continue;
+        }
+
+        idquery.bindValue( 0, lastop );
+        idquery.exec();
+
+        // compacted away before, it replays all we have, and needs every deletion we kept
+        if ( !idquery.next() )
+            return 0;
+
+        after = qMin( after, idquery.value( 0 ).toInt() );
+    }
+
+    return after;
+}
+
+
+/// our current files, as addfiles ops
+void
+DatabaseCommand_CompactOplog::loadFiles( DatabaseImpl* lib, QList< QVariantMap >& ops )
+{
+    TomahawkSqlQuery query = lib->newquery();
+    query.exec( "SELECT file.id, file.size, file.mtime, file.md5, file.mimetype, file.duration, file.bitrate, "
+                "artist.name, album.name, track.name, file_join.albumpos, "
+                "(SELECT v FROM track_attributes WHERE track_attributes.id = track.id AND k = 'releaseyear' LIMIT 1) "
+                "FROM file, file_join, artist, track "
+                "LEFT JOIN album ON album.id = file_join.album "
+                "WHERE file.source IS NULL "
+                "AND file_join.file = file.id "
+                "AND artist.id = file_join.artist "
+                "AND track.id = file_join.track "
+                "ORDER BY file.id" );
+
+    QVariantList files;
+    while ( query.next() )
+    {
+        // the way DatabaseCommand_AddFiles::files() puts them on the network
+        QVariantMap m;
+        m["id"]       = query.value( 0 ).toUInt();
+        m["url"]      = query.value( 0 ).toString();
+        m["size"]     = query.value( 1 ).toUInt();
+        m["mtime"]    = query.value( 2 ).toUInt();
+        m["hash"]     = query.value( 3 ).toString();
+        m["mimetype"] = query.value( 4 ).toString();
+        m["duration"] = query.value( 5 ).toUInt();
+        m["bitrate"]  = query.value( 6 ).toUInt();
+        m["artist"]   = query.value( 7 ).toString();
+        m["album"]    = query.value( 8 ).toString();
+        m["track"]    = query.value( 9 ).toString();
+        m["albumpos"] = query.value( 10 ).toUInt();
+        m["year"]     = query.value( 11 ).toInt();
+        files << m;
+
+        if ( files.count() == FILES_PER_OP )
+        {
+            QVariantMap op;
+            op["command"] = "addfiles";
+            op["files"] = files;
+            ops << op;
+            files.clear();
+        }
+    }
+
+    if ( !files.isEmpty() )
+    {
+        QVariantMap op;
+        op["command"] = "addfiles";
+        op["files"] = files;
+        ops << op;
+    }
+}
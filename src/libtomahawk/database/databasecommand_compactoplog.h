@@ -0,0 +1,59 @@
+/* === This file is part of Tomahawk Player - <http://tomahawk-player.org> ===
+ * 
+ *   Copyright 2010-2011, Christian Muehlhaeuser <muesli@tomahawk-player.org>
+ *
+ *   Tomahawk is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Tomahawk is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Tomahawk. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DATABASECOMMAND_COMPACTOPLOG_H
+#define DATABASECOMMAND_COMPACTOPLOG_H
+
+#include <QVariantMap>
+
+#include "databasecommand.h"
+#include "databaseimpl.h"
+
+#include "dllmacro.h"
+
+/*
+    Rewrites our oplog as the shortest list of ops that rebuilds the same
+    state on a peer: our current files as plain adds, and only playlists
+    that still exist, with just their latest title and current revision.
+    File deletions are kept where a peer that can't take snapshots hasn't
+    synced them yet, as it only ever adds to its copy of our files.
+
+    The new ops reuse the ids of the ones they replace, so everything logged
+    afterwards still sorts after them. Peers whose lastop was dropped get a
+    snapshot of the new log instead, see DatabaseCommand_loadOps.
+*/
+class DLLEXPORT DatabaseCommand_CompactOplog : public DatabaseCommand
+{
+Q_OBJECT
+
+public:
+    explicit DatabaseCommand_CompactOplog( QObject* parent = 0 );
+
+    virtual QString commandname() const { return "compactoplog"; }
+    virtual bool doesMutates() const { return true; }
+    virtual void exec( DatabaseImpl* lib );
+
+signals:
+    void done( int opsBefore, int opsAfter );
+
+private:
+    int keepDeletionsAfter( DatabaseImpl* lib, int lastId );
+    void loadFiles( DatabaseImpl* lib, QList< QVariantMap >& ops );
+};
+
+#endif // DATABASECOMMAND_COMPACTOPLOG_H
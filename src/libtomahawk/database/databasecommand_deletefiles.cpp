@@ -25,6 +25,7 @@
 #include "collection.h"
 #include "database/database.h"
 #include "databasecommand_collectionstats.h"
+#include "databasecommand_updatesearchindex.h"
 #include "databaseimpl.h"
 #include "network/controlconnection.h"
 
@@ -37,6 +38,14 @@ DatabaseCommand_DeleteFiles::postCommitHook()
 {
     qDebug() << Q_FUNC_INFO;
 
+    emit done( m_files, source()->collection() );
+
+    if ( !m_searchIndexRemovals.isEmpty() )
+    {
+        DatabaseCommand* cmd = new DatabaseCommand_UpdateSearchIndex( QMap< QString, QMap< unsigned int, QString > >(), m_searchIndexRemovals );
+        Database::instance()->enqueue( QSharedPointer<DatabaseCommand>( cmd ) );
+    }
+
     // make the collection object emit its tracksAdded signal, so the
     // collection browser will update/fade in etc.
     Collection* coll = source()->collection().data();
@@ -68,6 +77,11 @@ DatabaseCommand_DeleteFiles::exec( DatabaseImpl* dbi )
     TomahawkSqlQuery delquery = dbi->newquery();
     QString lastPath;
 
+    m_artists.clear();
+    m_albums.clear();
+    m_tracks.clear();
+    m_searchIndexRemovals.clear();
+
     if ( !m_dir.path().isEmpty() && source()->isLocal() )
     {
         qDebug() << "Deleting" << m_dir.path() << "from db for localsource" << srcid;
@@ -78,9 +92,16 @@ DatabaseCommand_DeleteFiles::exec( DatabaseImpl* dbi )
         delquery.prepare( QString( "DELETE FROM file WHERE source %1 AND id = ?" )
                              .arg( source()->isLocal() ? "IS NULL" : QString( "= %1" ).arg( source()->id() ) ) );
 
+        TomahawkSqlQuery joinquery = dbi->newquery();
+        joinquery.prepare( "SELECT artist, album, track FROM file_join WHERE file = ?" );
+
         dirquery.bindValue( 0, "file://" + m_dir.absolutePath() + "/%" );
         dirquery.exec();
 
+        // filled from the db, also when we run again after a rollback
+        m_ids.clear();
+        m_files.clear();
+
         while ( dirquery.next() )
         {
             QFileInfo fi( dirquery.value( 1 ).toString().mid( 7 ) ); // remove file://
@@ -99,6 +120,9 @@ DatabaseCommand_DeleteFiles::exec( DatabaseImpl* dbi )
 
         foreach ( const QVariant& id, m_ids )
         {
+            joinquery.bindValue( 0, id.toUInt() );
+            collectCatalogIds( joinquery );
+
             delquery.bindValue( 0, id.toUInt() );
             if( !delquery.exec() )
             {
@@ -117,6 +141,12 @@ DatabaseCommand_DeleteFiles::exec( DatabaseImpl* dbi )
         delquery.prepare( QString( "DELETE FROM file WHERE source %1 AND url = ?" )
                              .arg( source()->isLocal() ? "IS NULL" : QString( "= %1" ).arg( source()->id() ) ) );
 
+        TomahawkSqlQuery joinquery = dbi->newquery();
+        joinquery.prepare( QString( "SELECT file_join.artist, file_join.album, file_join.track FROM file, file_join "
+                                    "WHERE file.id = file_join.file AND file.source %1 AND file.url = ?" )
+                              .arg( source()->isLocal() ? "IS NULL" : QString( "= %1" ).arg( source()->id() ) ) );
+
+        m_files.clear();
         foreach( const QVariant& id, m_ids )
         {
             qDebug() << "Deleting" << id.toUInt() << "from db for source" << srcid;
@@ -124,6 +154,9 @@ DatabaseCommand_DeleteFiles::exec( DatabaseImpl* dbi )
             const QString url = QString( "servent://%1\t%2" ).arg( source()->userName() ).arg( id.toString() );
             m_files << url;
 
+            joinquery.bindValue( 0, id.toUInt() );
+            collectCatalogIds( joinquery );
+
             delquery.bindValue( 0, id.toUInt() );
             if( !delquery.exec() )
             {
@@ -134,11 +167,54 @@ DatabaseCommand_DeleteFiles::exec( DatabaseImpl* dbi )
                 continue;
             }
             
-            deleted++;
+            deleted += qMax( 0, delquery.numRowsAffected() );
         }
     }
     
     qDebug() << "Deleted" << deleted << m_ids << m_files;
+    dbi->filesChanged( source()->isLocal() ? 0 : source()->id(), -deleted );
 
-    emit done( m_files, source()->collection() );
+    if ( deleted )
+        removeOrphansFromIndex( dbi );
+}
+
+
+void
+DatabaseCommand_DeleteFiles::collectCatalogIds( TomahawkSqlQuery& query )
+{
+    query.exec();
+    if ( !query.next() )
+        return;
+
+    m_artists << query.value( 0 ).toUInt();
+    if ( !query.value( 1 ).isNull() )
+        m_albums << query.value( 1 ).toUInt();
+    m_tracks << query.value( 2 ).toUInt();
+}
+
+
+void
+DatabaseCommand_DeleteFiles::removeOrphansFromIndex( DatabaseImpl* dbi )
+{
+    // entries without any files left can't be resolved anymore, so we
+    // don't need them in the search index. they get re-indexed by
+    // DatabaseCommand_AddFiles as soon as a file refers to them again.
+    QMap< QString, QSet< unsigned int > > tables;
+    tables.insert( "artist", m_artists );
+    tables.insert( "album", m_albums );
+    tables.insert( "track", m_tracks );
+
+    foreach ( const QString& table, tables.keys() )
+    {
+        TomahawkSqlQuery query = dbi->newquery();
+        query.prepare( QString( "SELECT 1 FROM file_join WHERE %1 = ? LIMIT 1" ).arg( table ) );
+
+        foreach ( unsigned int id, tables.value( table ) )
+        {
+            query.bindValue( 0, id );
+            query.exec();
+            if ( !query.next() )
+                m_searchIndexRemovals[ table ] << id;
+        }
+    }
 }
@@ -21,9 +21,11 @@
 
 #include <QObject>
 #include <QDir>
+#include <QSet>
 #include <QVariantMap>
 
 #include "database/databasecommandloggable.h"
+#include "database/tomahawksqlquery.h"
 #include "typedefs.h"
 #include "query.h"
 
@@ -62,9 +64,17 @@ signals:
     void notify( const QStringList& );
 
 private:
+    void collectCatalogIds( TomahawkSqlQuery& query );
+    void removeOrphansFromIndex( DatabaseImpl* dbi );
+
     QDir m_dir;
     QStringList m_files;
     QVariantList m_ids;
+
+    // artist/album/track ids of the deleted files, and the ones which
+    // have no files left and are to be dropped from the search index
+    QSet< unsigned int > m_artists, m_albums, m_tracks;
+    QMap< QString, QList< unsigned int > > m_searchIndexRemovals;
 };
 
 #endif // DATABASECOMMAND_DELETEFILES_H
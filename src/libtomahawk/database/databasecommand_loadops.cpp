@@ -18,22 +18,47 @@
 
 #include "databasecommand_loadops.h"
 
+#include <qjson/parser.h>
+#include <qjson/serializer.h>
+
+#include "playlistrevisiondelta.h"
+
+// compress expanded ops from this size on, like DatabaseWorker::logOp does
+#define COMPRESS_THRESHOLD 512
+
 
 void
 DatabaseCommand_loadOps::exec( DatabaseImpl* dbi )
 {
     QList< dbop_ptr > ops;
+    bool snapshot = false;
+    int sinceId = 0;
 
     TomahawkSqlQuery query = dbi->newquery();
+    if ( !m_since.isEmpty() )
+    {
+        query.prepare( "SELECT id FROM oplog WHERE guid = ?" );
+        query.addBindValue( m_since );
+        query.exec();
+
+        if ( query.next() )
+            sinceId = query.value( 0 ).toInt();
+        else if ( source()->isLocal() )
+            sinceId = compactedSince( dbi, &snapshot );
+    }
+
     query.prepare( QString(
                    "SELECT guid, command, json, compressed, singleton "
                    "FROM oplog "
                    "WHERE source %1 "
-                   "AND id > coalesce((SELECT id FROM oplog WHERE guid = ?),0) "
-                   "ORDER BY id ASC"
+                   "AND id > ? "
+                   "ORDER BY id ASC %2"
                    ).arg( source()->isLocal() ? "IS NULL" : QString( "= %1" ).arg( source()->id() ) )
+                    .arg( m_limit > 0 ? "LIMIT ?" : "" )
                   );
-    query.addBindValue( m_since );
+    query.addBindValue( sinceId );
+    if ( m_limit > 0 )
+        query.addBindValue( m_limit );
     query.exec();
 
     QString lastguid = m_since;
@@ -46,10 +71,74 @@ DatabaseCommand_loadOps::exec( DatabaseImpl* dbi )
         op->compressed = query.value( 3 ).toBool();
         op->singleton = query.value( 4 ).toBool();
 
+        if ( m_expandDeltas && ( op->command == "setplaylistrevision" || op->command == "setdynamicplaylistrevision" ) )
+            expandPlaylistDelta( dbi, op );
+
         lastguid = op->guid;
         ops << op;
     }
 
 //    qDebug() << "Loaded" << ops.length() << "ops from db";
-    emit done( m_since, lastguid, ops );
+    emit done( m_since, lastguid, ops, snapshot );
+}
+
+
+/// turns a playlist revision op carrying a delta into one with the full orderedguids
+void
+DatabaseCommand_loadOps::expandPlaylistDelta( DatabaseImpl* dbi, const dbop_ptr& op )
+{
+    const QByteArray json = op->compressed ? qUncompress( op->payload ) : op->payload;
+
+    bool ok;
+    QJson::Parser parser;
+    QVariantMap revision = parser.parse( json, &ok ).toMap();
+    if ( !ok || revision.value( "orderedguidsdelta" ).toMap().isEmpty() )
+        return;
+
+    QStringList entries;
+    if ( !PlaylistRevisionDelta::loadEntries( dbi, revision.value( "newrev" ).toString(), entries ) )
+    {
+        qDebug() << "Can't expand playlist revision delta of op" << op->guid;
+        return;
+    }
+
+    QVariantList orderedguids;
+    foreach ( const QString& guid, entries )
+        orderedguids << guid;
+
+    revision.insert( "orderedguids", orderedguids );
+    revision.remove( "orderedguidsdelta" );
+
+    QJson::Serializer serializer;
+    op->payload = serializer.serialize( revision );
+    op->compressed = op->payload.length() >= COMPRESS_THRESHOLD;
+    if ( op->compressed )
+        op->payload = qCompress( op->payload, 9 );
+}
+
+
+/// where to go on from an op we no longer have, see DatabaseCommand_CompactOplog
+int
+DatabaseCommand_loadOps::compactedSince( DatabaseImpl* dbi, bool* snapshot )
+{
+    TomahawkSqlQuery query = dbi->newquery();
+    query.exec( "SELECT k, v FROM settings WHERE k IN ('oplog_compacted_id', 'oplog_compacted_guid')" );
+
+    int compactedId = 0;
+    QString compactedGuid;
+    while ( query.next() )
+    {
+        if ( query.value( 0 ).toString() == "oplog_compacted_id" )
+            compactedId = query.value( 1 ).toInt();
+        else
+            compactedGuid = query.value( 1 ).toString();
+    }
+
+    // the peer was in sync when we compacted, the compacted ops are nothing new to it
+    if ( !compactedGuid.isEmpty() && m_since == compactedGuid )
+        return compactedId;
+
+    // its lastop was compacted away (or never was ours), it needs everything from scratch
+    *snapshot = compactedId > 0;
+    return 0;
 }
@@ -30,19 +30,29 @@ class DLLEXPORT DatabaseCommand_loadOps : public DatabaseCommand
 {
 Q_OBJECT
 public:
-    explicit DatabaseCommand_loadOps( const Tomahawk::source_ptr& src, QString since, QObject* parent = 0 )
-        : DatabaseCommand( src ), m_since( since )
+    // limit > 0 loads at most that many ops, the next page starts after the returned lastguid
+    explicit DatabaseCommand_loadOps( const Tomahawk::source_ptr& src, QString since, int limit = 0, QObject* parent = 0 )
+        : DatabaseCommand( src ), m_since( since ), m_limit( limit ), m_expandDeltas( false )
     {}
 
+    // for peers that don't know PlaylistRevisionDelta: send revisions with their full orderedguids
+    void setExpandPlaylistDeltas( bool expand ) { m_expandDeltas = expand; }
+
     virtual void exec( DatabaseImpl* db );
     virtual bool doesMutates() const { return false; }
     virtual QString commandname() const { return "loadops"; }
 
 signals:
-    void done( QString sinceguid, QString lastguid, QList< dbop_ptr > ops );
+    // snapshot: since was compacted away, ops is our whole log and replaces what the peer has from us
+    void done( QString sinceguid, QString lastguid, QList< dbop_ptr > ops, bool snapshot );
 
 private:
+    int compactedSince( DatabaseImpl* dbi, bool* snapshot );
+    void expandPlaylistDelta( DatabaseImpl* dbi, const dbop_ptr& op );
+
     QString m_since; // guid to load from
+    int m_limit;
+    bool m_expandDeltas;
 };
 
 #endif // DATABASECOMMAND_LOADOPS_H
@@ -21,6 +21,7 @@
 #include <QSqlQuery>
 
 #include "databaseimpl.h"
+#include "playlistrevisiondelta.h"
 
 using namespace Tomahawk;
 
@@ -39,7 +40,7 @@ void
 DatabaseCommand_LoadPlaylistEntries::generateEntries( DatabaseImpl* dbi )
 {
     TomahawkSqlQuery query_entries = dbi->newquery();
-    query_entries.prepare("SELECT entries, playlist, author, timestamp, previous_revision "
+    query_entries.prepare("SELECT playlist, previous_revision "
                           "FROM playlist_revision "
                           "WHERE guid = :guid");
     query_entries.bindValue( ":guid", m_revguid );
@@ -47,14 +48,11 @@ DatabaseCommand_LoadPlaylistEntries::generateEntries( DatabaseImpl* dbi )
     
     qDebug() << "trying to load entries:" << m_revguid;
     QString prevrev;
-    QJson::Parser parser; bool ok;
     
     if( query_entries.next() )
     {
-        // entries should be a list of strings:
-        QVariant v = parser.parse( query_entries.value(0).toByteArray(), &ok );
-        Q_ASSERT( ok && v.type() == QVariant::List ); //TODO
-        m_guids = v.toStringList();
+        if ( !PlaylistRevisionDelta::loadEntries( dbi, m_revguid, m_guids ) )
+            Q_ASSERT( false ); //TODO
         //        qDebug() << "Entries:" << guids;
         
         QString inclause = QString("('%1')").arg(m_guids.join("', '"));
@@ -83,7 +81,7 @@ DatabaseCommand_LoadPlaylistEntries::generateEntries( DatabaseImpl* dbi )
             m_entrymap.insert( e->guid(), e );
         }
         
-        prevrev = query_entries.value( 4 ).toString();
+        prevrev = query_entries.value( 1 ).toString();
 
     }
     else
@@ -94,25 +92,18 @@ DatabaseCommand_LoadPlaylistEntries::generateEntries( DatabaseImpl* dbi )
     if( prevrev.length() )
     {
         TomahawkSqlQuery query_entries_old = dbi->newquery();
-        query_entries_old.prepare( "SELECT entries, "
-                                   "(SELECT currentrevision = ? FROM playlist WHERE guid = ?) "
-                                   "FROM playlist_revision "
-                                   "WHERE guid = ?" );
+        query_entries_old.prepare( "SELECT currentrevision = ? FROM playlist WHERE guid = ?" );
         query_entries_old.addBindValue( m_revguid );
-        query_entries_old.addBindValue( query_entries.value( 1 ).toString() );
-        query_entries_old.addBindValue( prevrev );
+        query_entries_old.addBindValue( query_entries.value( 0 ).toString() );
         
         query_entries_old.exec();
-        if( !query_entries_old.next() )
+        if( !query_entries_old.next() || !PlaylistRevisionDelta::loadEntries( dbi, prevrev, m_oldentries ) )
         {
             return;
             Q_ASSERT( false );
         }
         
-        QVariant v = parser.parse( query_entries_old.value( 0 ).toByteArray(), &ok );
-        Q_ASSERT( ok && v.type() == QVariant::List ); //TODO
-        m_oldentries = v.toStringList();
-        m_islatest = query_entries_old.value( 1 ).toBool();
+        m_islatest = query_entries_old.value( 0 ).toBool();
     }
     
     qDebug() << Q_FUNC_INFO << "entrymap:" << m_entrymap;
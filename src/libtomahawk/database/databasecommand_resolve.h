@@ -45,9 +45,6 @@ public slots:
 
 private:
     Tomahawk::query_ptr m_query;
-
-    float how_similar( const Tomahawk::query_ptr& q, const Tomahawk::result_ptr& r );
-    static int levenshtein( const QString& source, const QString& target );
 };
 
 #endif // DATABASECOMMAND_RESOLVE_H
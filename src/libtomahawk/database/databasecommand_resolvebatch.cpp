@@ -0,0 +1,186 @@
+/* === This file is part of Tomahawk Player - <http://tomahawk-player.org> ===
+ * 
+ *   Copyright 2010-2011, Christian Muehlhaeuser <muesli@tomahawk-player.org>
+ *
+ *   Tomahawk is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Tomahawk is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Tomahawk. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "databasecommand_resolvebatch.h"
+
+#include <QVector>
+
+#include "album.h"
+#include "sourcelist.h"
+#include "resultscorer.h"
+
+#define MINSCORE 0.5
+
+using namespace Tomahawk;
+
+
+DatabaseCommand_ResolveBatch::DatabaseCommand_ResolveBatch( const QList< query_ptr >& queries )
+    : DatabaseCommand()
+    , m_queries( queries )
+{
+}
+
+
+void
+DatabaseCommand_ResolveBatch::exec( DatabaseImpl* lib )
+{
+    QVector< QList< Tomahawk::result_ptr > > res( m_queries.count() );
+    QMap< int, QList< int > > artists, tracks;
+
+    // STEP 1: result-hints and fuzzy lookups for all queries
+    for ( int i = 0; i < m_queries.count(); i++ )
+    {
+        const query_ptr& q = m_queries.at( i );
+        if ( !q->resultHint().isEmpty() )
+        {
+            Tomahawk::result_ptr result = lib->result( q->resultHint() );
+            if ( !result.isNull() && result->collection()->source()->isOnline() )
+            {
+                res[ i ] << result;
+                continue;
+            }
+        }
+
+        QList< int > a = lib->searchTable( "artist", q->artist(), 10 );
+        QList< int > t = lib->searchTable( "track", q->track(), 10 );
+        if ( a.isEmpty() || t.isEmpty() )
+            continue;
+
+        artists.insert( i, a );
+        tracks.insert( i, t );
+    }
+
+    // STEP 2: fetch the candidate files for all queries at once
+    if ( !artists.isEmpty() )
+    {
+        TomahawkSqlQuery query = lib->newquery();
+        query.exec( "CREATE TEMP TABLE IF NOT EXISTS resolve_artist ( query INTEGER NOT NULL, id INTEGER NOT NULL )" );
+        query.exec( "CREATE TEMP TABLE IF NOT EXISTS resolve_track ( query INTEGER NOT NULL, id INTEGER NOT NULL )" );
+        query.exec( "DELETE FROM resolve_artist" );
+        query.exec( "DELETE FROM resolve_track" );
+
+        lib->database().transaction();
+        TomahawkSqlQuery insert_artist = lib->newquery();
+        TomahawkSqlQuery insert_track = lib->newquery();
+        insert_artist.prepare( "INSERT INTO resolve_artist( query, id ) VALUES ( ?, ? )" );
+        insert_track.prepare( "INSERT INTO resolve_track( query, id ) VALUES ( ?, ? )" );
+
+        foreach ( int i, artists.keys() )
+        {
+            foreach ( int id, artists.value( i ) )
+            {
+                insert_artist.bindValue( 0, i );
+                insert_artist.bindValue( 1, id );
+                insert_artist.exec();
+            }
+            foreach ( int id, tracks.value( i ) )
+            {
+                insert_track.bindValue( 0, i );
+                insert_track.bindValue( 1, id );
+                insert_track.exec();
+            }
+        }
+        lib->database().commit();
+
+        TomahawkSqlQuery files_query = lib->newquery();
+        files_query.prepare( "SELECT "
+                             "url, mtime, size, md5, mimetype, duration, bitrate, file_join.artist, file_join.album, file_join.track, "
+                             "artist.name as artname, "
+                             "album.name as albname, "
+                             "track.name as trkname, "
+                             "file.source, "
+                             "file_join.albumpos, "
+                             "artist.id as artid, "
+                             "album.id as albid, "
+                             "resolve_artist.query "
+                             "FROM resolve_artist, resolve_track, file_join, file, artist, track "
+                             "LEFT JOIN album ON album.id = file_join.album "
+                             "WHERE "
+                             "resolve_track.query = resolve_artist.query AND "
+                             "file_join.artist = resolve_artist.id AND "
+                             "file_join.track = resolve_track.id AND "
+                             "artist.id = file_join.artist AND "
+                             "track.id = file_join.track AND "
+                             "file.id = file_join.file" );
+        files_query.exec();
+
+        QHash< int, ResultScorer* > scorers;
+        while( files_query.next() )
+        {
+            const int i = files_query.value( 17 ).toInt();
+            if ( i < 0 || i >= m_queries.count() )
+                continue;
+
+            Tomahawk::result_ptr result( new Tomahawk::Result() );
+            source_ptr s;
+
+            const QString url_str = files_query.value( 0 ).toString();
+            if( files_query.value( 13 ).toUInt() == 0 )
+            {
+                s = SourceList::instance()->getLocal();
+                result->setUrl( url_str );
+            }
+            else
+            {
+                s = SourceList::instance()->get( files_query.value( 13 ).toUInt() );
+                if( s.isNull() )
+                {
+                    Q_ASSERT( false );
+                    continue;
+                }
+
+                result->setUrl( QString( "servent://%1\t%2" ).arg( s->userName() ).arg( url_str ) );
+            }
+
+            Tomahawk::artist_ptr artist = Tomahawk::Artist::get( files_query.value( 15 ).toUInt(), files_query.value( 10 ).toString() );
+            Tomahawk::album_ptr album = Tomahawk::Album::get( files_query.value( 16 ).toUInt(), files_query.value( 11 ).toString(), artist );
+
+            result->setModificationTime( files_query.value( 1 ).toUInt() );
+            result->setSize( files_query.value( 2 ).toUInt() );
+            result->setMimetype( files_query.value( 4 ).toString() );
+            result->setDuration( files_query.value( 5 ).toUInt() );
+            result->setBitrate( files_query.value( 6 ).toUInt() );
+            result->setArtist( artist );
+            result->setAlbum( album );
+            result->setTrack( files_query.value( 12 ).toString() );
+            result->setRID( uuid() );
+            result->setAlbumPos( files_query.value( 14 ).toUInt() );
+            result->setId( files_query.value( 9 ).toUInt() );
+
+            ResultScorer* scorer = scorers.value( i );
+            if ( !scorer )
+            {
+                scorer = new ResultScorer( m_queries.at( i ) );
+                scorers.insert( i, scorer );
+            }
+
+            float score = scorer->score( result, MINSCORE );
+            result->setScore( score );
+            if( score < MINSCORE )
+                continue;
+
+            result->setCollection( s->collection() );
+            res[ i ] << result;
+        }
+
+        qDeleteAll( scorers );
+    }
+
+    for ( int i = 0; i < m_queries.count(); i++ )
+        emit results( m_queries.at( i )->id(), res.at( i ) );
+}
@@ -0,0 +1,43 @@
+/* === This file is part of Tomahawk Player - <http://tomahawk-player.org> ===
+ * 
+ *   Copyright 2010-2011, Christian Muehlhaeuser <muesli@tomahawk-player.org>
+ *
+ *   Tomahawk is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Tomahawk is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Tomahawk. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "databasecommand_setpeerlastop.h"
+
+#include "tomahawksqlquery.h"
+
+
+void
+DatabaseCommand_SetPeerLastOp::exec( DatabaseImpl* lib )
+{
+    const QString key = QString( "oplog_peer_lastop_%1" ).arg( source()->id() );
+
+    TomahawkSqlQuery query = lib->newquery();
+    if ( m_snapshots )
+    {
+        // a snapshot brings it up to date whatever we compact away
+        query.prepare( "DELETE FROM settings WHERE k = ?" );
+        query.addBindValue( key );
+    }
+    else
+    {
+        query.prepare( "INSERT OR REPLACE INTO settings(k, v) VALUES(?, ?)" );
+        query.addBindValue( key );
+        query.addBindValue( m_lastop );
+    }
+    query.exec();
+}
@@ -0,0 +1,47 @@
+/* === This file is part of Tomahawk Player - <http://tomahawk-player.org> ===
+ * 
+ *   Copyright 2010-2011, Christian Muehlhaeuser <muesli@tomahawk-player.org>
+ *
+ *   Tomahawk is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Tomahawk is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Tomahawk. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DATABASECOMMAND_SETPEERLASTOP_H
+#define DATABASECOMMAND_SETPEERLASTOP_H
+
+#include "databasecommand.h"
+#include "databaseimpl.h"
+
+#include "dllmacro.h"
+
+/// Remembers how far a peer that can't take snapshots has synced our oplog,
+/// so DatabaseCommand_CompactOplog keeps the deletions it hasn't seen yet.
+class DLLEXPORT DatabaseCommand_SetPeerLastOp : public DatabaseCommand
+{
+Q_OBJECT
+
+public:
+    explicit DatabaseCommand_SetPeerLastOp( const Tomahawk::source_ptr& peer, const QString& lastop, bool snapshots, QObject* parent = 0 )
+        : DatabaseCommand( peer, parent ), m_lastop( lastop ), m_snapshots( snapshots )
+    {}
+
+    virtual QString commandname() const { return "setpeerlastop"; }
+    virtual bool doesMutates() const { return true; }
+    virtual void exec( DatabaseImpl* lib );
+
+private:
+    QString m_lastop;
+    bool m_snapshots;
+};
+
+#endif // DATABASECOMMAND_SETPEERLASTOP_H
@@ -20,9 +20,13 @@
 
 #include <QSqlQuery>
 
+#include "playlistrevisiondelta.h"
 #include "tomahawksqlquery.h"
 #include "network/servent.h"
 
+// store a full list of entries at least every this many revisions
+#define REVISION_CHECKPOINT_INTERVAL 32
+
 
 DatabaseCommand_SetPlaylistRevision::DatabaseCommand_SetPlaylistRevision(
                       const source_ptr& s,
@@ -95,6 +99,10 @@ DatabaseCommand_SetPlaylistRevision::exec( DatabaseImpl* lib )
 {
     using namespace Tomahawk;
 
+    // we may run again after a rollback
+    m_applied = false;
+    m_addedmap.clear();
+
     // get the current revision for this playlist
     // this also serves to check the playlist exists.
     TomahawkSqlQuery chkq = lib->newquery();
@@ -111,10 +119,6 @@ DatabaseCommand_SetPlaylistRevision::exec( DatabaseImpl* lib )
         return;
     }
 
-    QVariantList vlist = m_orderedguids;
-    QJson::Serializer ser;
-    const QByteArray entries = ser.serialize( vlist );
-
     // add any new items:
     TomahawkSqlQuery adde = lib->newquery();
     if ( m_localOnly )
@@ -164,6 +168,9 @@ DatabaseCommand_SetPlaylistRevision::exec( DatabaseImpl* lib )
         }
     }
 
+    QStringList previous;
+    const QByteArray entries = revisionEntries( lib, previous );
+
     // add / update the revision:
     TomahawkSqlQuery query = lib->newquery();
     QString sql = "INSERT INTO playlist_revision(guid, playlist, entries, author, timestamp, previous_revision) "
@@ -192,27 +199,70 @@ DatabaseCommand_SetPlaylistRevision::exec( DatabaseImpl* lib )
 
         m_applied = true;
 
-        // load previous revision entries, which we need to pass on
+        // previous revision entries, which we need to pass on
         // so the change can be diffed
-        TomahawkSqlQuery query_entries = lib->newquery();
-        query_entries.prepare( "SELECT entries, playlist, author, timestamp, previous_revision "
-                               "FROM playlist_revision "
-                               "WHERE guid = :guid" );
-        query_entries.bindValue( ":guid", m_oldrev );
-        query_entries.exec();
-        if( query_entries.next() )
-        {
-            // entries should be a list of strings:
-            bool ok;
-            QJson::Parser parser;
-            QVariant v = parser.parse( query_entries.value(0).toByteArray(), &ok );
-            Q_ASSERT( ok && v.type() == QVariant::List ); //TODO
-
-            m_previous_rev_orderedguids = v.toStringList();
-        }
+        m_previous_rev_orderedguids = previous;
     }
     else
     {
         qDebug() << "Not updating current revision, optimistic locking fail";
     }
 }
+
+
+/// what goes into playlist_revision.entries: a delta against oldrev, or a checkpoint.
+/// also rebuilds the full list of a revision we got as a delta, and decides how ours is synced.
+QByteArray
+DatabaseCommand_SetPlaylistRevision::revisionEntries( DatabaseImpl* lib, QStringList& previous )
+{
+    int depth = 0;
+    const bool haveOld = !m_oldrev.isEmpty() && PlaylistRevisionDelta::loadEntries( lib, m_oldrev, previous, &depth );
+
+    QStringList current;
+    if ( !m_delta.isEmpty() )
+    {
+        if ( !haveOld || !PlaylistRevisionDelta::apply( previous, m_delta, current ) )
+            throw "Can't apply playlist revision delta";
+
+        m_orderedguids.clear();
+        foreach( const QString& guid, current )
+            m_orderedguids << guid;
+    }
+    else
+    {
+        foreach( const QVariant& v, m_orderedguids )
+            current << v.toString();
+    }
+
+    QJson::Serializer ser;
+    const QByteArray full = ser.serialize( m_orderedguids );
+
+    if ( haveOld && depth + 1 < REVISION_CHECKPOINT_INTERVAL )
+    {
+        QVariantMap delta = m_delta;
+        if ( delta.isEmpty() )
+        {
+            // lists a delta can't express (duplicate guids) get a checkpoint
+            QStringList check;
+            delta = PlaylistRevisionDelta::diff( previous, current );
+            if ( !PlaylistRevisionDelta::apply( previous, delta, check ) || check != current )
+                delta.clear();
+        }
+
+        if ( !delta.isEmpty() )
+        {
+            delta.insert( "depth", depth + 1 );
+            const QByteArray stored = ser.serialize( delta );
+            if ( stored.length() * 2 < full.length() )
+            {
+                delta.remove( "depth" );
+                m_delta = delta;
+                return stored;
+            }
+        }
+    }
+
+    // a checkpoint, synced as the full list too
+    m_delta.clear();
+    return full;
+}
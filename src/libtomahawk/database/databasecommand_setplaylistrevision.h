@@ -34,7 +34,8 @@ Q_OBJECT
 Q_PROPERTY( QString playlistguid      READ playlistguid  WRITE setPlaylistguid )
 Q_PROPERTY( QString newrev            READ newrev        WRITE setNewrev )
 Q_PROPERTY( QString oldrev            READ oldrev        WRITE setOldrev )
-Q_PROPERTY( QVariantList orderedguids READ orderedguids  WRITE setOrderedguids )
+Q_PROPERTY( QVariantList orderedguids READ orderedguidsV WRITE setOrderedguids )
+Q_PROPERTY( QVariantMap orderedguidsdelta READ orderedguidsdelta WRITE setOrderedguidsdelta )
 Q_PROPERTY( QVariantList addedentries READ addedentriesV WRITE setAddedentriesV )
 
 public:
@@ -93,6 +94,11 @@ public:
     void setOrderedguids( const QVariantList& l ) { m_orderedguids = l; }
     QVariantList orderedguids() const { return m_orderedguids; }
 
+    // a revision synced as a delta against oldrev leaves orderedguids empty, see PlaylistRevisionDelta
+    QVariantList orderedguidsV() const { return m_delta.isEmpty() ? m_orderedguids : QVariantList(); }
+    void setOrderedguidsdelta( const QVariantMap& m ) { m_delta = m; }
+    QVariantMap orderedguidsdelta() const { return m_delta; }
+
 protected:
     bool m_applied;
     QStringList m_previous_rev_orderedguids;
@@ -102,7 +108,10 @@ protected:
     
     QString m_currentRevision;
 private:
+    QByteArray revisionEntries( DatabaseImpl* lib, QStringList& previous );
+
     QVariantList m_orderedguids;
+    QVariantMap m_delta;
     QList<Tomahawk::plentry_ptr> m_addedentries, m_entries;
 
     bool m_localOnly;
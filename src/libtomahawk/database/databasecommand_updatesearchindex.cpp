@@ -19,8 +19,50 @@
 #include "databasecommand_updatesearchindex.h"
 
 
+namespace
+{
+    // aborts a rebuild that doesn't get to finish(), so a throw in
+    // between can't leave the index locked for good
+    class IndexingRun
+    {
+    public:
+        explicit IndexingRun( FuzzyIndex* index )
+            : m_index( index )
+        {
+            m_index->beginIndexing();
+        }
+
+        ~IndexingRun()
+        {
+            if ( m_index )
+                m_index->abortIndexing();
+        }
+
+        void finish()
+        {
+            m_index->endIndexing();
+            m_index = 0;
+        }
+
+    private:
+        FuzzyIndex* m_index;
+    };
+}
+
+
 DatabaseCommand_UpdateSearchIndex::DatabaseCommand_UpdateSearchIndex()
     : DatabaseCommand()
+    , m_incremental( false )
+{
+}
+
+
+DatabaseCommand_UpdateSearchIndex::DatabaseCommand_UpdateSearchIndex( const QMap< QString, QMap< unsigned int, QString > >& updated,
+                                                                      const QMap< QString, QList< unsigned int > >& removed )
+    : DatabaseCommand()
+    , m_incremental( true )
+    , m_updated( updated )
+    , m_removed( removed )
 {
 }
 
@@ -48,11 +90,26 @@ DatabaseCommand_UpdateSearchIndex::indexTable( DatabaseImpl* db, const QString&
 void
 DatabaseCommand_UpdateSearchIndex::exec( DatabaseImpl* db )
 {
-    db->m_fuzzyIndex->beginIndexing();
-    
+    if ( m_incremental )
+    {
+        foreach ( const QString& table, m_removed.keys() )
+            db->m_fuzzyIndex->removeFields( table, m_removed.value( table ) );
+        foreach ( const QString& table, m_updated.keys() )
+            db->m_fuzzyIndex->updateFields( table, m_updated.value( table ) );
+
+        db->m_fuzzyIndex->endUpdating();
+        return;
+    }
+
+    // without the version stored, an aborted rebuild is redone on the next start
+    IndexingRun run( db->m_fuzzyIndex );
+
     indexTable( db, "artist" );
     indexTable( db, "album" );
     indexTable( db, "track" );
 
-    db->m_fuzzyIndex->endIndexing();
+    TomahawkSqlQuery query = db->newquery();
+    query.exec( QString( "INSERT OR REPLACE INTO settings(k,v) VALUES('fuzzyindex_version','%1')" ).arg( FUZZYINDEX_VERSION ) );
+
+    run.finish();
 }
@@ -28,7 +28,11 @@ class DLLEXPORT DatabaseCommand_UpdateSearchIndex : public DatabaseCommand
 {
 Q_OBJECT
 public:
+    // rebuilds the whole index from scratch
     explicit DatabaseCommand_UpdateSearchIndex();
+    // only (re-)indexes the given entries and drops the removed ones, per table
+    explicit DatabaseCommand_UpdateSearchIndex( const QMap< QString, QMap< unsigned int, QString > >& updated,
+                                                const QMap< QString, QList< unsigned int > >& removed );
 
     virtual QString commandname() const { return "updatesearchindex"; }
     virtual bool doesMutates() const { return true; }
@@ -39,8 +43,10 @@ signals:
 
 private:
     void indexTable( DatabaseImpl* db, const QString& table );
-    
-    QString table;
+
+    bool m_incremental;
+    QMap< QString, QMap< unsigned int, QString > > m_updated;
+    QMap< QString, QList< unsigned int > > m_removed;
 };
 
 #endif // DATABASECOMMAND_UPDATESEARCHINDEX_H
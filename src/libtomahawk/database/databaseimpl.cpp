@@ -23,6 +23,7 @@
 #include <QStringList>
 #include <QtAlgorithms>
 #include <QFile>
+#include <QSqlError>
 
 #include "database/database.h"
 #include "databasecommand_updatesearchindex.h"
@@ -42,9 +43,12 @@
 
 DatabaseImpl::DatabaseImpl( const QString& dbname, Database* parent )
     : QObject( (QObject*) parent )
+    , m_connectionName( "tomahawk" )
+    , m_readOnly( false )
     , m_lastartid( 0 )
     , m_lastalbid( 0 )
     , m_lasttrkid( 0 )
+    , m_statsCache( new StatsCache )
 {
     connect( this, SIGNAL( indexReady() ), parent, SIGNAL( indexReady() ) );
 
@@ -117,6 +121,8 @@ DatabaseImpl::DatabaseImpl( const QString& dbname, Database* parent )
     qDebug() << "Database ID:" << m_dbid;
 
      // make sqlite behave how we want:
+    // WAL lets the read-only worker connections run alongside the writer
+    query.exec( "PRAGMA journal_mode = WAL" );
     query.exec( "PRAGMA synchronous  = ON" );
     query.exec( "PRAGMA foreign_keys = ON" );
     //query.exec( "PRAGMA temp_store = MEMORY" );
@@ -124,13 +130,62 @@ DatabaseImpl::DatabaseImpl( const QString& dbname, Database* parent )
     // in case of unclean shutdown last time:
     query.exec( "UPDATE source SET isonline = 'false'" );
 
-    m_fuzzyIndex = new FuzzyIndex( *this, schemaUpdated );
+    // a search index in an outdated format needs to be rebuilt once the db is up
+    m_rebuildIndex = false;
+    if ( schemaUpdated )
+    {
+        query.exec( QString( "INSERT OR REPLACE INTO settings(k,v) VALUES('fuzzyindex_version','%1')" ).arg( FUZZYINDEX_VERSION ) );
+    }
+    else
+    {
+        query.exec( "SELECT v FROM settings WHERE k='fuzzyindex_version'" );
+        m_rebuildIndex = !query.next() || query.value( 0 ).toInt() != FUZZYINDEX_VERSION;
+    }
+
+    m_fuzzyIndex = new FuzzyIndex( *this, schemaUpdated || m_rebuildIndex );
+}
+
+
+DatabaseImpl::DatabaseImpl( DatabaseImpl* primary, const QString& connectionName )
+    : QObject()
+    , m_connectionName( connectionName )
+    , m_readOnly( true )
+    , m_lastartid( 0 )
+    , m_lastalbid( 0 )
+    , m_lasttrkid( 0 )
+    , m_dbid( primary->dbid() )
+    , m_fuzzyIndex( primary->m_fuzzyIndex )
+    , m_rebuildIndex( false )
+    , m_statsCache( primary->m_statsCache )
+{
+    db = QSqlDatabase::addDatabase( "QSQLITE", connectionName );
+    db.setDatabaseName( primary->database().databaseName() );
+    db.setConnectOptions( "QSQLITE_OPEN_READONLY;QSQLITE_BUSY_TIMEOUT=5000" );
+    if ( !db.open() )
+    {
+        // the worker using us checks database().isOpen() and leaves the pool
+        qDebug() << "FAILED TO OPEN DB" << connectionName << db.lastError().text();
+        return;
+    }
+
+    TomahawkSqlQuery query = newquery();
+    query.exec( "PRAGMA foreign_keys = ON" );
 }
 
 
 DatabaseImpl::~DatabaseImpl()
 {
-    delete m_fuzzyIndex;
+    if ( !m_readOnly )
+    {
+        delete m_fuzzyIndex;
+        delete m_statsCache;
+        return;
+    }
+
+    // the search index is owned by the primary connection
+    db.close();
+    db = QSqlDatabase();
+    QSqlDatabase::removeDatabase( m_connectionName );
 }
 
 
@@ -138,7 +193,16 @@ void
 DatabaseImpl::loadIndex()
 {
     connect( m_fuzzyIndex, SIGNAL( indexReady() ), SIGNAL( indexReady() ) );
-    m_fuzzyIndex->loadLuceneIndex();
+    connect( m_fuzzyIndex, SIGNAL( rebuildNeeded() ), SLOT( updateSearchIndex() ), Qt::QueuedConnection );
+
+    if ( m_rebuildIndex )
+    {
+        qDebug() << "Search index is outdated, rebuilding it.";
+        m_rebuildIndex = false;
+        updateSearchIndex();
+    }
+    else
+        m_fuzzyIndex->loadLuceneIndex();
 }
 
 
@@ -150,6 +214,105 @@ DatabaseImpl::updateSearchIndex()
 }
 
 
+void
+DatabaseImpl::resetCaches()
+{
+    m_lastart.clear();
+    m_lastalb.clear();
+    m_lasttrk.clear();
+    m_lastartid = m_lastalbid = m_lasttrkid = 0;
+    m_pendingStats.clear();
+}
+
+
+bool
+DatabaseImpl::collectionStats( int source, int& numfiles, uint& lastmodified, uint& generation )
+{
+    QMutexLocker lock( &m_statsCache->mutex );
+    generation = m_statsCache->generations.value( source );
+    if ( !m_statsCache->stats.contains( source ) )
+        return false;
+
+    const SourceStats& st = m_statsCache->stats[ source ];
+    numfiles = st.numfiles;
+    lastmodified = st.lastmodified;
+    return true;
+}
+
+
+void
+DatabaseImpl::setCollectionStats( int source, int numfiles, uint lastmodified, uint generation )
+{
+    QMutexLocker lock( &m_statsCache->mutex );
+
+    // our scan may have missed a commit that went on meanwhile
+    if ( m_statsCache->generations.value( source ) != generation )
+        return;
+
+    SourceStats& st = m_statsCache->stats[ source ];
+    st.numfiles = numfiles;
+    st.lastmodified = lastmodified;
+}
+
+
+void
+DatabaseImpl::filesChanged( int source, int delta, uint mtime )
+{
+    SourceStats& st = m_pendingStats[ source ];
+    st.numfiles += delta;
+    st.lastmodified = qMax( st.lastmodified, mtime );
+}
+
+
+void
+DatabaseImpl::filesCleared( int source )
+{
+    SourceStats& st = m_pendingStats[ source ];
+    st = SourceStats();
+    st.cleared = true;
+}
+
+
+bool
+DatabaseImpl::commit()
+{
+    // a scan on a read connection that sees the committed files must not store its count
+    // under the generation from before the commit, so both happen under the stats lock
+    QMutexLocker lock( m_pendingStats.isEmpty() ? 0 : &m_statsCache->mutex );
+    if ( !db.commit() )
+        return false;
+
+    commitStats();
+    return true;
+}
+
+
+/// called with the stats lock held
+void
+DatabaseImpl::commitStats()
+{
+    foreach ( int source, m_pendingStats.keys() )
+    {
+        const SourceStats& pending = m_pendingStats[ source ];
+        m_statsCache->generations[ source ]++;
+
+        // not cached yet, the next lookup scans anyway
+        if ( !pending.cleared && !m_statsCache->stats.contains( source ) )
+            continue;
+
+        SourceStats& st = m_statsCache->stats[ source ];
+        if ( pending.cleared )
+            st = SourceStats();
+
+        st.numfiles = qMax( 0, st.numfiles + pending.numfiles );
+        st.lastmodified = qMax( st.lastmodified, pending.lastmodified );
+        st.cleared = false;
+    }
+
+    m_pendingStats.clear();
+}
+
+
 bool
 DatabaseImpl::updateSchema( int currentver )
 {
@@ -415,7 +578,29 @@ DatabaseImpl::getTrackFids( int tid )
 QString
 DatabaseImpl::sortname( const QString& str )
 {
-    return str.toLower().trimmed().replace( QRegExp("[\\s]{2,}"), " " );
+    // same as replacing QRegExp( "[\\s]{2,}" ) with a single space, minus the regexp
+    const QString lower = str.toLower().trimmed();
+    const int len = lower.length();
+
+    QString res;
+    res.reserve( len );
+    for ( int i = 0; i < len; )
+    {
+        int j = i + 1;
+        if ( lower.at( i ).isSpace() )
+        {
+            while ( j < len && lower.at( j ).isSpace() )
+                j++;
+        }
+
+        if ( j - i > 1 )
+            res += QLatin1Char( ' ' );
+        else
+            res += lower.at( i );
+        i = j;
+    }
+
+    return res;
 }
 
 
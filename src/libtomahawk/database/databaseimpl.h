@@ -29,6 +29,7 @@
 #include <QSqlQuery>
 #include <QDebug>
 #include <QHash>
+#include <QMutex>
 #include <QThread>
 
 #include "tomahawksqlquery.h"
@@ -46,6 +47,9 @@ friend class DatabaseCommand_UpdateSearchIndex;
 
 public:
     DatabaseImpl( const QString& dbname, Database* parent = 0 );
+    // opens another, read-only connection to the database of primary.
+    // must be created and used in the thread it is going to run queries in.
+    DatabaseImpl( DatabaseImpl* primary, const QString& connectionName );
     ~DatabaseImpl();
 
     TomahawkSqlQuery newquery() { return TomahawkSqlQuery( db ); }
@@ -71,22 +75,38 @@ public:
         return left.second > right.second;
     }
 
-    // indexes entries from "table" where id >= pkey
-    void updateSearchIndex();
-
     QString dbid() const { return m_dbid; }
 
+    /// forget cached artist/album ids and uncommitted stats changes, needed after a rollback
+    void resetCaches();
+
+    // Per source file count and newest file mtime, shared by all connections.
+    // Mutating commands report what they change, it's applied on commit.
+    // source is 0 for the local one.
+    bool collectionStats( int source, int& numfiles, uint& lastmodified, uint& generation );
+    /// stores a scan started at generation, unless a commit changed the source's files since
+    void setCollectionStats( int source, int numfiles, uint lastmodified, uint generation );
+    void filesChanged( int source, int delta, uint mtime = 0 );
+    void filesCleared( int source );
+    /// commits the open transaction and applies its stats changes
+    bool commit();
+
     void loadIndex();
 
 signals:
     void indexReady();
 
 public slots:
+    // indexes entries from "table" where id >= pkey
+    void updateSearchIndex();
 
 private:
     bool updateSchema( int currentver );
+    void commitStats();
 
     QSqlDatabase db;
+    QString m_connectionName;
+    bool m_readOnly;
 
     QString m_lastart, m_lastalb, m_lasttrk;
     int m_lastartid, m_lastalbid, m_lasttrkid;
@@ -94,6 +114,25 @@ private:
     QString m_dbid;
 
     FuzzyIndex* m_fuzzyIndex;
+    bool m_rebuildIndex;
+
+    struct SourceStats
+    {
+        SourceStats() : numfiles( 0 ), lastmodified( 0 ), cleared( false ) {}
+        int numfiles;
+        uint lastmodified; // a high-water mark, removing files doesn't lower it
+        bool cleared;
+    };
+
+    struct StatsCache
+    {
+        QMutex mutex;
+        QHash< int, SourceStats > stats;
+        QHash< int, uint > generations;
+    };
+
+    StatsCache* m_statsCache; // owned by the primary connection
+    QHash< int, SourceStats > m_pendingStats; // changes of the open transaction
 };
 
 #endif // DATABASEIMPL_H
@@ -20,7 +20,9 @@
 
 #include "network/servent.h"
 #include "database/database.h"
-#include "database/databasecommand_resolve.h"
+#include "database/databasecommand_resolvebatch.h"
+
+#include <QTimer>
 
 
 DatabaseResolver::DatabaseResolver( int weight )
@@ -33,13 +35,23 @@ DatabaseResolver::DatabaseResolver( int weight )
 void
 DatabaseResolver::resolve( const Tomahawk::query_ptr& query )
 {
-    DatabaseCommand_Resolve* cmd = new DatabaseCommand_Resolve( query );
+    // the pipeline dispatches many queries at once, collect them into one db job
+    m_pending << query;
+    if ( m_pending.count() == 1 )
+        QTimer::singleShot( 0, this, SLOT( resolvePending() ) );
+}
+
+
+void
+DatabaseResolver::resolvePending()
+{
+    DatabaseCommand_ResolveBatch* cmd = new DatabaseCommand_ResolveBatch( m_pending );
+    m_pending.clear();
 
     connect( cmd, SIGNAL( results( Tomahawk::QID, QList< Tomahawk::result_ptr > ) ),
                     SLOT( gotResults( Tomahawk::QID, QList< Tomahawk::result_ptr > ) ), Qt::QueuedConnection );
 
     Database::instance()->enqueue( QSharedPointer<DatabaseCommand>( cmd ) );
-
 }
 
 
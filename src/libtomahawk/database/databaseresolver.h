@@ -42,10 +42,14 @@ public slots:
     virtual void resolve( const Tomahawk::query_ptr& query );
 
 private slots:
+    void resolvePending();
     void gotResults( const Tomahawk::QID qid, QList< Tomahawk::result_ptr> results );
 
 private:
     int m_weight;
+
+    // queries collected during this event loop iteration, resolved as a batch
+    QList< Tomahawk::query_ptr > m_pending;
 };
 
 #endif // DATABASERESOLVER_H
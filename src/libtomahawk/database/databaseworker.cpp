@@ -28,9 +28,12 @@
 
 DatabaseWorker::DatabaseWorker( DatabaseImpl* lib, Database* db, bool mutates )
     : QThread()
-    , m_dbimpl( lib )
+    , m_primary( lib )
+    , m_dbimpl( mutates ? lib : 0 )
+    , m_mutates( mutates )
     , m_abort( false )
     , m_outstanding( 0 )
+    , m_failed( 0 )
 {
     moveToThread( this );
 
@@ -53,32 +56,87 @@ DatabaseWorker::~DatabaseWorker()
 void
 DatabaseWorker::run()
 {
+    // QSqlDatabase connections can only be used from the thread they were created in
+    if ( !m_mutates )
+    {
+        m_dbimpl = new DatabaseImpl( m_primary, QString( "tomahawk_ro_%1" ).arg( (qlonglong)this ) );
+        if ( !m_dbimpl->database().isOpen() )
+        {
+            qDebug() << Q_FUNC_INFO << "No read-only connection, taking this worker out of the pool";
+            delete m_dbimpl;
+            m_dbimpl = 0;
+            m_failed.fetchAndStoreRelease( 1 );
+        }
+    }
+
     exec();
     qDebug() << Q_FUNC_INFO << "DatabaseWorker finishing...";
+
+    if ( !m_mutates )
+    {
+        delete m_dbimpl;
+        m_dbimpl = 0;
+    }
 }
 
 
 void
 DatabaseWorker::enqueue( const QSharedPointer<DatabaseCommand>& cmd )
 {
-    if ( QThread::currentThread() != thread() )
-    {
-//        qDebug() << Q_FUNC_INFO << "Reinvoking in correct thread.";
-        QMetaObject::invokeMethod( this, "enqueue", Qt::QueuedConnection, Q_ARG( QSharedPointer<DatabaseCommand>, cmd ) );
+    // account for the job right away, even when called from another thread,
+    // so Database can balance the load over its workers
+    QList< QSharedPointer<DatabaseCommand> > cmds;
+    cmds << cmd;
+    enqueue( cmds );
+}
+
+
+void
+DatabaseWorker::enqueue( const QList< QSharedPointer<DatabaseCommand> >& cmds )
+{
+    if ( cmds.isEmpty() )
         return;
-    }
 
     QMutexLocker lock( &m_mut );
     m_outstanding++;
-    m_commands << cmd;
+    m_commands << cmds;
 
     if ( m_outstanding == 1 )
-        QTimer::singleShot( 0, this, SLOT( doWork() ) );
+        QMetaObject::invokeMethod( this, "doWork", Qt::QueuedConnection );
 }
 
 
 void
 DatabaseWorker::doWork()
+{
+    QList< QSharedPointer<DatabaseCommand> > cmds;
+    {
+        QMutexLocker lock( &m_mut );
+        cmds = m_commands.takeFirst();
+    }
+
+    // we have no connection, Database::enqueue() picks another worker now
+    if ( failed() )
+    {
+        foreach ( const QSharedPointer<DatabaseCommand>& cmd, cmds )
+            Database::instance()->enqueue( cmd );
+    }
+    // if a batch fails as a whole, retry it op by op so only the broken ops get lost
+    else if ( cmds.count() == 1 || !execBatch( cmds ) )
+    {
+        foreach ( const QSharedPointer<DatabaseCommand>& cmd, cmds )
+            execCommand( cmd );
+    }
+
+    QMutexLocker lock( &m_mut );
+    m_outstanding--;
+    if ( m_outstanding > 0 )
+        QTimer::singleShot( 0, this, SLOT( doWork() ) );
+}
+
+
+void
+DatabaseWorker::execCommand( const QSharedPointer<DatabaseCommand>& cmd )
 {
     /*
         Run the dbcmd. Only inside a transaction if the cmd does mutates.
@@ -91,12 +149,6 @@ DatabaseWorker::doWork()
     QTime timer;
     timer.start();
 
-    QSharedPointer<DatabaseCommand> cmd;
-    {
-        QMutexLocker lock( &m_mut );
-        cmd = m_commands.takeFirst();
-    }
-
     if( cmd->doesMutates() )
     {
         bool transok = m_dbimpl->database().transaction();
@@ -128,27 +180,14 @@ DatabaseWorker::doWork()
                     // so we can always request just the newer ops in future.
                     //
                     if ( !cmd->singletonCmd() )
-                    {
-                        qDebug() << "Setting lastop for source" << cmd->source()->id() << "to" << cmd->guid();
-
-                        TomahawkSqlQuery query = m_dbimpl->newquery();
-                        query.prepare( "UPDATE source SET lastop = ? WHERE id = ?" );
-                        query.addBindValue( cmd->guid() );
-                        query.addBindValue( cmd->source()->id() );
-
-                        if( !query.exec() )
-                        {
-                            qDebug() << "Failed to set lastop";
-                            throw "Failed to set lastop";
-                        }
-                    }
+                        updateLastOp( cmd->source(), cmd->guid() );
                 }
             }
 
             if( cmd->doesMutates() )
             {
                 qDebug() << "Committing" << cmd->commandname();;
-                if( !m_dbimpl->database().commit() )
+                if( !m_dbimpl->commit() )
                 {
 
                     qDebug() << "*FAILED TO COMMIT TRANSACTION*";
@@ -177,7 +216,10 @@ DatabaseWorker::doWork()
                  << endl;
 
         if( cmd->doesMutates() )
+        {
             m_dbimpl->database().rollback();
+            m_dbimpl->resetCaches();
+        }
 
 //        Q_ASSERT( false );
     }
@@ -185,18 +227,116 @@ DatabaseWorker::doWork()
     {
         qDebug() << "Uncaught exception processing dbcmd";
         if( cmd->doesMutates() )
+        {
             m_dbimpl->database().rollback();
+            m_dbimpl->resetCaches();
+        }
 
         Q_ASSERT( false );
         throw;
     }
 
     cmd->emitFinished();
+}
 
-    QMutexLocker lock( &m_mut );
-    m_outstanding--;
-    if ( m_outstanding > 0 )
-        QTimer::singleShot( 0, this, SLOT( doWork() ) );
+
+bool
+DatabaseWorker::execBatch( const QList< QSharedPointer<DatabaseCommand> >& cmds )
+{
+    /*
+        Same as execCommand, but for a whole batch of mutating commands,
+        e.g. ops received from a peer during dbsync. They are all applied in
+        a single transaction and the lastop of each source is only set once.
+     */
+
+    QTime timer;
+    timer.start();
+
+    m_dbimpl->database().transaction();
+    try
+    {
+        QHash< int, QString > lastOps;
+        QHash< int, Tomahawk::source_ptr > sources;
+
+        foreach ( const QSharedPointer<DatabaseCommand>& cmd, cmds )
+        {
+            Q_ASSERT( cmd->doesMutates() );
+            cmd->_exec( m_dbimpl );
+
+            if( cmd->loggable() && !cmd->localOnly() )
+            {
+                if( cmd->source()->isLocal() )
+                {
+                    DatabaseCommandLoggable* command = (DatabaseCommandLoggable*)cmd.data();
+                    logOp( command );
+                }
+                else if ( !cmd->singletonCmd() )
+                {
+                    lastOps.insert( cmd->source()->id(), cmd->guid() );
+                    sources.insert( cmd->source()->id(), cmd->source() );
+                }
+            }
+        }
+
+        foreach ( int id, lastOps.keys() )
+            updateLastOp( sources.value( id ), lastOps.value( id ) );
+
+        if( !m_dbimpl->commit() )
+        {
+            qDebug() << "*FAILED TO COMMIT TRANSACTION*";
+            throw "commit failed";
+        }
+    }
+    catch( const char * msg )
+    {
+        qDebug() << endl
+                 << "*ERROR* processing batch of" << cmds.count() << "databasecommands:"
+                 << msg
+                 << m_dbimpl->database().lastError().databaseText()
+                 << m_dbimpl->database().lastError().driverText()
+                 << endl;
+
+        m_dbimpl->database().rollback();
+        m_dbimpl->resetCaches();
+        return false;
+    }
+    catch(...)
+    {
+        qDebug() << "Uncaught exception processing batch of dbcmds";
+        m_dbimpl->database().rollback();
+        m_dbimpl->resetCaches();
+
+        Q_ASSERT( false );
+        throw;
+    }
+
+    qDebug() << "Committed batch of" << cmds.count() << "commands in" << timer.elapsed() << "ms";
+
+    foreach ( const QSharedPointer<DatabaseCommand>& cmd, cmds )
+    {
+        cmd->postCommit();
+        cmd->emitFinished();
+    }
+
+    return true;
+}
+
+
+void
+DatabaseWorker::updateLastOp( const Tomahawk::source_ptr& source, const QString& guid )
+{
+    qDebug() << "Setting lastop for source" << source->id() << "to" << guid;
+
+    TomahawkSqlQuery query = m_dbimpl->newquery();
+    query.prepare( "UPDATE source SET lastop = ? WHERE id = ?" );
+    query.addBindValue( guid );
+    query.addBindValue( source->id() );
+
+    if( !query.exec() )
+    {
+        qDebug() << "Failed to set lastop";
+        throw "Failed to set lastop";
+    }
 }
 
 
@@ -22,6 +22,7 @@
 #include <QObject>
 #include <QThread>
 #include <QMutex>
+#include <QAtomicInt>
 #include <QList>
 #include <QSharedPointer>
 
@@ -40,15 +41,21 @@ class DatabaseWorker : public QThread
 Q_OBJECT
 
 public:
+    // read-only workers open their own connection to the database of the
+    // given DatabaseImpl, mutating ones share it
     DatabaseWorker( DatabaseImpl*, Database*, bool mutates );
     ~DatabaseWorker();
 
     bool busy() const { return m_outstanding > 0; }
     unsigned int outstandingJobs() const { return m_outstanding; }
+    /// couldn't open its connection, commands given to it are passed on
+    bool failed() const { return m_failed.fetchAndAddAcquire( 0 ); }
 
 public slots:
     void enqueue( const QSharedPointer<DatabaseCommand>& );
-    
+    /// runs all (mutating) commands in a single transaction
+    void enqueue( const QList< QSharedPointer<DatabaseCommand> >& );
+
 protected:
     void run();
 
@@ -56,14 +63,21 @@ private slots:
     void doWork();
 
 private:
+    void execCommand( const QSharedPointer<DatabaseCommand>& cmd );
+    bool execBatch( const QList< QSharedPointer<DatabaseCommand> >& cmds );
     void logOp( DatabaseCommandLoggable* command );
+    void updateLastOp( const Tomahawk::source_ptr& source, const QString& guid );
 
     QMutex m_mut;
+    DatabaseImpl* m_primary;
     DatabaseImpl* m_dbimpl;
-    QList< QSharedPointer<DatabaseCommand> > m_commands;
+    bool m_mutates;
+    // each entry is a job of one or more commands sharing a transaction
+    QList< QList< QSharedPointer<DatabaseCommand> > > m_commands;
 
     bool m_abort;
     int m_outstanding;
+    mutable QAtomicInt m_failed;
 
     QJson::Serializer m_serializer;
 };
@@ -33,14 +33,42 @@ using namespace lucene::index;
 using namespace lucene::queryParser;
 using namespace lucene::search;
 
+// merge the segments created by incremental updates after this many updates
+#define OPTIMIZE_THRESHOLD 50
+// aborted rebuilds in a row we retry right away, after that the next start does it
+#define MAX_REBUILD_RETRIES 3
+
+
+class FuzzyIndex::Snapshot
+{
+public:
+    explicit Snapshot( Directory* dir )
+    {
+        reader = IndexReader::open( dir );
+        searcher = _CLNEW IndexSearcher( reader );
+    }
+
+    ~Snapshot()
+    {
+        searcher->close();
+        reader->close();
+        delete searcher;
+        delete reader;
+    }
+
+    IndexReader* reader;
+    IndexSearcher* searcher;
+};
+
 
 FuzzyIndex::FuzzyIndex( DatabaseImpl& db, bool wipeIndex )
     : QObject()
     , m_db( db )
-    , m_luceneReader( 0 )
-    , m_luceneSearcher( 0 )
+    , m_dirty( false )
+    , m_failedRebuilds( 0 )
+    , m_updatesSinceOptimize( 0 )
 {
-    QString m_lucenePath = TomahawkUtils::appDataDir().absoluteFilePath( "tomahawk.lucene" );
+    m_lucenePath = TomahawkUtils::appDataDir().absoluteFilePath( "tomahawk.lucene" );
     m_luceneDir = FSDirectory::getDirectory( m_lucenePath.toStdString().c_str() );
     m_analyzer = _CLNEW SimpleAnalyzer();
 
@@ -54,8 +82,7 @@ FuzzyIndex::FuzzyIndex( DatabaseImpl& db, bool wipeIndex )
 
 FuzzyIndex::~FuzzyIndex()
 {
-    delete m_luceneSearcher;
-    delete m_luceneReader;
+    m_snapshot.clear();
     delete m_analyzer;
     delete m_luceneDir;
 }
@@ -64,22 +91,13 @@ FuzzyIndex::~FuzzyIndex()
 void
 FuzzyIndex::beginIndexing()
 {
-    m_mutex.lock();
+    m_writeMutex.lock();
 
     try
     {
+        // searches keep being served from the current snapshot until
+        // endIndexing() publishes the rebuilt index
         qDebug() << Q_FUNC_INFO << "Starting indexing.";
-        if ( m_luceneReader != 0 )
-        {
-            qDebug() << "Deleting old lucene stuff.";
-            m_luceneSearcher->close();
-            m_luceneReader->close();
-            delete m_luceneSearcher;
-            delete m_luceneReader;
-            m_luceneSearcher = 0;
-            m_luceneReader = 0;
-        }
-
         qDebug() << "Creating new index writer.";
         IndexWriter luceneWriter = IndexWriter( m_luceneDir, m_analyzer, true );
     }
@@ -94,44 +112,73 @@ FuzzyIndex::beginIndexing()
 void
 FuzzyIndex::endIndexing()
 {
-    m_mutex.unlock();
+    m_updatesSinceOptimize = 0;
+    m_failedRebuilds = 0;
+    {
+        QMutexLocker lock( &m_mutex );
+        m_dirty = false;
+    }
+    publishSnapshot();
+    m_writeMutex.unlock();
     emit indexReady();
 }
 
 
+/// a rebuild failed half way. the index on disk is wiped or partial now, so
+/// nothing gets published from it until a rebuild completes
+void
+FuzzyIndex::abortIndexing()
+{
+    qDebug() << Q_FUNC_INFO << "Indexing aborted.";
+    {
+        QMutexLocker lock( &m_mutex );
+        m_dirty = true;
+    }
+
+    const bool retry = ++m_failedRebuilds <= MAX_REBUILD_RETRIES;
+    m_writeMutex.unlock();
+
+    if ( retry )
+        emit rebuildNeeded();
+}
+
+
 void
 FuzzyIndex::appendFields( const QString& table, const QMap< unsigned int, QString >& fields )
 {
     try
     {
         qDebug() << "Appending to index:" << fields.count();
-        bool create = !IndexReader::indexExists( TomahawkUtils::appDataDir().absoluteFilePath( "tomahawk.lucene" ).toStdString().c_str() );
+        bool create = !indexExists();
         IndexWriter luceneWriter = IndexWriter( m_luceneDir, m_analyzer, create );
-        Document doc;
+        addDocuments( luceneWriter, table, fields );
+        luceneWriter.close();
+    }
+    catch( CLuceneError& error )
+    {
+        qDebug() << "Caught CLucene error:" << error.what();
+        Q_ASSERT( false );
+    }
+}
 
-        QMapIterator< unsigned int, QString > it( fields );
-        while ( it.hasNext() )
-        {
-            it.next();
-            unsigned int id = it.key();
-            QString name = it.value();
 
-            {
-                Field* field = _CLNEW Field( table.toStdWString().c_str(), DatabaseImpl::sortname( name ).toStdWString().c_str(),
-                                            Field::STORE_YES | Field::INDEX_UNTOKENIZED );
-                doc.add( *field );
-            }
+void
+FuzzyIndex::updateFields( const QString& table, const QMap< unsigned int, QString >& fields )
+{
+    if ( fields.isEmpty() )
+        return;
 
-            {
-                Field* field = _CLNEW Field( _T( "id" ), QString::number( id ).toStdWString().c_str(),
-                Field::STORE_YES | Field::INDEX_NO );
-                doc.add( *field );
-            }
+    QMutexLocker lock( &m_writeMutex );
+    try
+    {
+        qDebug() << "Updating index:" << table << fields.count();
 
-            luceneWriter.addDocument( &doc );
-            doc.clear();
-        }
+        // drop existing documents for these ids first, so we never index them twice
+        deleteDocuments( table, fields.keys() );
 
+        bool create = !indexExists();
+        IndexWriter luceneWriter = IndexWriter( m_luceneDir, m_analyzer, create );
+        addDocuments( luceneWriter, table, fields );
         luceneWriter.close();
     }
     catch( CLuceneError& error )
@@ -139,6 +186,171 @@ FuzzyIndex::appendFields( const QString& table, const QMap< unsigned int, QStrin
         qDebug() << "Caught CLucene error:" << error.what();
         Q_ASSERT( false );
     }
+
+    m_updatesSinceOptimize++;
+    publishSnapshot();
+}
+
+
+void
+FuzzyIndex::removeFields( const QString& table, const QList< unsigned int >& ids )
+{
+    if ( ids.isEmpty() || !indexExists() )
+        return;
+
+    QMutexLocker lock( &m_writeMutex );
+    try
+    {
+        qDebug() << "Removing from index:" << table << ids.count();
+        deleteDocuments( table, ids );
+    }
+    catch( CLuceneError& error )
+    {
+        qDebug() << "Caught CLucene error:" << error.what();
+        Q_ASSERT( false );
+    }
+
+    m_updatesSinceOptimize++;
+    publishSnapshot();
+}
+
+
+void
+FuzzyIndex::endUpdating()
+{
+    optimize();
+
+    // let queries pick up the new entries
+    emit indexReady();
+}
+
+
+void
+FuzzyIndex::optimize()
+{
+    QMutexLocker lock( &m_writeMutex );
+    if ( m_updatesSinceOptimize < OPTIMIZE_THRESHOLD || !indexExists() )
+        return;
+
+    qDebug() << Q_FUNC_INFO << "Merging index after" << m_updatesSinceOptimize << "updates";
+    try
+    {
+        // searches keep using their current snapshot while we merge
+        IndexWriter luceneWriter = IndexWriter( m_luceneDir, m_analyzer, false );
+        luceneWriter.optimize();
+        luceneWriter.close();
+    }
+    catch( CLuceneError& error )
+    {
+        qDebug() << "Caught CLucene error:" << error.what();
+        Q_ASSERT( false );
+    }
+
+    m_updatesSinceOptimize = 0;
+    publishSnapshot();
+}
+
+
+void
+FuzzyIndex::addDocuments( IndexWriter& writer, const QString& table, const QMap< unsigned int, QString >& fields )
+{
+    Document doc;
+
+    QMapIterator< unsigned int, QString > it( fields );
+    while ( it.hasNext() )
+    {
+        it.next();
+        unsigned int id = it.key();
+        QString name = it.value();
+
+        {
+            Field* field = _CLNEW Field( table.toStdWString().c_str(), DatabaseImpl::sortname( name ).toStdWString().c_str(),
+                                        Field::STORE_YES | Field::INDEX_UNTOKENIZED );
+            doc.add( *field );
+        }
+
+        {
+            Field* field = _CLNEW Field( _T( "id" ), QString::number( id ).toStdWString().c_str(),
+            Field::STORE_YES | Field::INDEX_NO );
+            doc.add( *field );
+        }
+
+        {
+            // unique per table and id, so we can find the document again for updates
+            Field* field = _CLNEW Field( _T( "key" ), QString( "%1:%2" ).arg( table ).arg( id ).toStdWString().c_str(),
+            Field::STORE_NO | Field::INDEX_UNTOKENIZED );
+            doc.add( *field );
+        }
+
+        writer.addDocument( &doc );
+        doc.clear();
+    }
+}
+
+
+void
+FuzzyIndex::deleteDocuments( const QString& table, const QList< unsigned int >& ids )
+{
+    if ( !indexExists() )
+        return;
+
+    IndexReader* reader = IndexReader::open( m_luceneDir );
+    foreach ( unsigned int id, ids )
+    {
+        Term* term = _CLNEW Term( _T( "key" ), QString( "%1:%2" ).arg( table ).arg( id ).toStdWString().c_str() );
+        reader->deleteDocuments( term );
+        _CLDECDELETE( term );
+    }
+    reader->close();
+    delete reader;
+}
+
+
+FuzzyIndex::snapshot_ptr
+FuzzyIndex::snapshot()
+{
+    QMutexLocker lock( &m_mutex );
+
+    if ( m_snapshot.isNull() && !m_dirty && indexExists() )
+        m_snapshot = snapshot_ptr( new Snapshot( m_luceneDir ) );
+
+    return m_snapshot;
+}
+
+
+void
+FuzzyIndex::publishSnapshot()
+{
+    {
+        // keep searches on the last complete index until a rebuild replaces it
+        QMutexLocker lock( &m_mutex );
+        if ( m_dirty )
+            return;
+    }
+
+    // open the new reader before taking the lock, searches must not wait for it
+    snapshot_ptr snapshot;
+    try
+    {
+        if ( indexExists() )
+            snapshot = snapshot_ptr( new Snapshot( m_luceneDir ) );
+    }
+    catch( CLuceneError& error )
+    {
+        qDebug() << "Caught CLucene error:" << error.what();
+        Q_ASSERT( false );
+    }
+
+    // the previous snapshot gets closed once the last search using it is done
+    QMutexLocker lock( &m_mutex );
+    m_snapshot = snapshot;
+}
+
+
+bool
+FuzzyIndex::indexExists() const
+{
+    return IndexReader::indexExists( m_lucenePath.toStdString().c_str() );
 }
 
 
@@ -152,21 +364,14 @@ FuzzyIndex::loadLuceneIndex()
 QMap< int, float >
 FuzzyIndex::search( const QString& table, const QString& name )
 {
-    QMutexLocker lock( &m_mutex );
-
     QMap< int, float > resultsmap;
     try
     {
-        if ( !m_luceneReader )
+        snapshot_ptr index = snapshot();
+        if ( index.isNull() )
         {
-            if ( !IndexReader::indexExists( TomahawkUtils::appDataDir().absoluteFilePath( "tomahawk.lucene" ).toStdString().c_str() ) )
-            {
-                qDebug() << Q_FUNC_INFO << "index didn't exist.";
-                return resultsmap;
-            }
-
-            m_luceneReader = IndexReader::open( m_luceneDir );
-            m_luceneSearcher = _CLNEW IndexSearcher( m_luceneReader );
+            qDebug() << Q_FUNC_INFO << "index didn't exist.";
+            return resultsmap;
         }
 
         if ( name.isEmpty() )
@@ -177,7 +382,7 @@ FuzzyIndex::search( const QString& table, const QString& name )
         Hits* hits = 0;
 
         FuzzyQuery* qry = _CLNEW FuzzyQuery( _CLNEW Term( table.toStdWString().c_str(), DatabaseImpl::sortname( name ).toStdWString().c_str() ) );
-        hits = m_luceneSearcher->search( qry );
+        hits = index->searcher->search( qry );
 
         for ( int i = 0; i < hits->length(); i++ )
         {
@@ -24,6 +24,7 @@
 #include <QHash>
 #include <QString>
 #include <QMutex>
+#include <QSharedPointer>
 
 namespace lucene
 {
@@ -46,6 +47,10 @@ namespace lucene
     }
 }
 
+// bump this whenever the layout of the indexed documents changes,
+// DatabaseImpl rebuilds the index from scratch then
+#define FUZZYINDEX_VERSION 2
+
 class DatabaseImpl;
 
 class FuzzyIndex : public QObject
@@ -56,27 +61,54 @@ public:
     explicit FuzzyIndex( DatabaseImpl& db, bool wipeIndex = false );
     ~FuzzyIndex();
 
+    // a rebuild holds the write lock from beginIndexing() until it ends or is aborted
     void beginIndexing();
     void endIndexing();
+    void abortIndexing();
     void appendFields( const QString& table, const QMap< unsigned int, QString >& fields );
-    
+
+    // incremental changes, without wiping the index first
+    void updateFields( const QString& table, const QMap< unsigned int, QString >& fields );
+    void removeFields( const QString& table, const QList< unsigned int >& ids );
+    void endUpdating();
+
 signals:
     void indexReady();
+    /// a rebuild was aborted and should be redone
+    void rebuildNeeded();
 
 public slots:
     void loadLuceneIndex();
+    bool indexExists() const;
 
     QMap< int, float > search( const QString& table, const QString& name );
 
 private:
+    // an immutable, point-in-time view of the index. searches hold on to
+    // the snapshot they started with, writers publish a new one when done.
+    class Snapshot;
+    typedef QSharedPointer< Snapshot > snapshot_ptr;
+
+    snapshot_ptr snapshot();
+    void publishSnapshot();
+
+    void addDocuments( lucene::index::IndexWriter& writer, const QString& table, const QMap< unsigned int, QString >& fields );
+    void deleteDocuments( const QString& table, const QList< unsigned int >& ids );
+    void optimize();
+
     DatabaseImpl& m_db;
-    QMutex m_mutex;
+    QMutex m_mutex; // only guards m_snapshot and m_dirty
+    QMutex m_writeMutex;
     QString m_lucenePath;
 
     lucene::analysis::SimpleAnalyzer* m_analyzer;
     lucene::store::Directory* m_luceneDir;
-    lucene::index::IndexReader* m_luceneReader;
-    lucene::search::IndexSearcher* m_luceneSearcher;
+    snapshot_ptr m_snapshot;
+    // the index on disk is left from an aborted rebuild
+    bool m_dirty;
+    int m_failedRebuilds;
+
+    int m_updatesSinceOptimize;
 };
 
 #endif // FUZZYINDEX_H
@@ -0,0 +1,204 @@
+/* === This file is part of Tomahawk Player - <http://tomahawk-player.org> ===
+ * 
+ *   Copyright 2010-2011, Christian Muehlhaeuser <muesli@tomahawk-player.org>
+ *
+ *   Tomahawk is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Tomahawk is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Tomahawk. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "playlistrevisiondelta.h"
+
+#include <QHash>
+#include <QSet>
+#include <QVector>
+
+#include <qjson/parser.h>
+
+#include "databaseimpl.h"
+#include "tomahawksqlquery.h"
+
+
+QVariantMap
+PlaylistRevisionDelta::diff( const QStringList& from, const QStringList& to )
+{
+    const QSet<QString> toSet = to.toSet();
+
+    // old position of every entry that stays
+    QVariantList removed;
+    QHash<QString, int> fromPos;
+    foreach( const QString& guid, from )
+    {
+        if ( toSet.contains( guid ) )
+            fromPos.insert( guid, fromPos.count() );
+        else
+            removed << guid;
+    }
+
+    // entries that stay put are the longest run in the new list whose old positions increase,
+    // found in O(n log n): tails[k] is the index in to of the smallest tail of a run of length k+1
+    QVector<int> tails, prev( to.count(), -1 );
+    for ( int i = 0; i < to.count(); i++ )
+    {
+        if ( !fromPos.contains( to.at( i ) ) )
+            continue;
+
+        const int pos = fromPos.value( to.at( i ) );
+        int lo = 0, hi = tails.count();
+        while ( lo < hi )
+        {
+            const int mid = ( lo + hi ) / 2;
+            if ( fromPos.value( to.at( tails.at( mid ) ) ) < pos )
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+
+        if ( lo > 0 )
+            prev[ i ] = tails.at( lo - 1 );
+        if ( lo == tails.count() )
+            tails << i;
+        else
+            tails[ lo ] = i;
+    }
+
+    QVector<bool> stays( to.count(), false );
+    for ( int i = tails.isEmpty() ? -1 : tails.last(); i >= 0; i = prev.at( i ) )
+        stays[ i ] = true;
+
+    // everything else goes right after its new predecessor, front to back
+    QVariantList placed;
+    for ( int i = 0; i < to.count(); i++ )
+    {
+        if ( !stays.at( i ) )
+            placed << QVariant( QVariantList() << ( i ? to.at( i - 1 ) : QString() ) << to.at( i ) );
+    }
+
+    QVariantMap delta;
+    delta.insert( "removed", removed );
+    delta.insert( "placed", placed );
+    return delta;
+}
+
+
+bool
+PlaylistRevisionDelta::apply( const QStringList& from, const QVariantMap& delta, QStringList& to )
+{
+    // a circular doubly linked list over the guids, "" being both its front and end
+    QHash<QString, QString> next, prev;
+    next.reserve( from.count() + 1 );
+    prev.reserve( from.count() + 1 );
+
+    QString last;
+    foreach( const QString& guid, from )
+    {
+        if ( guid.isEmpty() || next.contains( guid ) )
+            return false;
+
+        next.insert( last, guid );
+        prev.insert( guid, last );
+        last = guid;
+    }
+    next.insert( last, QString() );
+    prev.insert( QString(), last );
+
+    foreach( const QVariant& v, delta.value( "removed" ).toList() )
+    {
+        const QString guid = v.toString();
+        if ( guid.isEmpty() || !next.contains( guid ) )
+            return false;
+
+        const QString n = next.take( guid );
+        const QString p = prev.take( guid );
+        next[ p ] = n;
+        prev[ n ] = p;
+    }
+
+    foreach( const QVariant& v, delta.value( "placed" ).toList() )
+    {
+        const QVariantList op = v.toList();
+        const QString after = op.value( 0 ).toString();
+        const QString guid = op.value( 1 ).toString();
+        if ( guid.isEmpty() || guid == after || !next.contains( after ) )
+            return false;
+
+        if ( next.contains( guid ) )
+        {
+            const QString n = next.take( guid );
+            const QString p = prev.take( guid );
+            next[ p ] = n;
+            prev[ n ] = p;
+        }
+
+        const QString n = next.value( after );
+        next[ after ] = guid;
+        prev[ guid ] = after;
+        next[ guid ] = n;
+        prev[ n ] = guid;
+    }
+
+    to.clear();
+    for ( QString guid = next.value( QString() ); !guid.isEmpty(); guid = next.value( guid ) )
+        to << guid;
+
+    return true;
+}
+
+
+bool
+PlaylistRevisionDelta::loadEntries( DatabaseImpl* dbi, const QString& revguid, QStringList& entries, int* depth )
+{
+    TomahawkSqlQuery query = dbi->newquery();
+    query.prepare( "SELECT entries, previous_revision FROM playlist_revision WHERE guid = ?" );
+
+    // walk back to the last checkpoint, then replay the deltas from there
+    QJson::Parser parser;
+    QList<QVariantMap> deltas;
+    QString rev = revguid;
+    forever
+    {
+        query.bindValue( 0, rev );
+        if ( !query.exec() || !query.next() )
+        {
+            qDebug() << Q_FUNC_INFO << "Missing playlist revision" << rev << "of" << revguid;
+            return false;
+        }
+
+        bool ok;
+        const QVariant v = parser.parse( query.value( 0 ).toByteArray(), &ok );
+        if ( !ok )
+            return false;
+
+        if ( v.type() == QVariant::List )
+        {
+            entries = v.toStringList();
+            break;
+        }
+
+        deltas.prepend( v.toMap() );
+        rev = query.value( 1 ).toString();
+    }
+
+    if ( depth )
+        *depth = deltas.count();
+
+    foreach( const QVariantMap& delta, deltas )
+    {
+        QStringList prev = entries;
+        if ( !apply( prev, delta, entries ) )
+        {
+            qDebug() << Q_FUNC_INFO << "Broken delta in the history of playlist revision" << revguid;
+            return false;
+        }
+    }
+
+    return true;
+}
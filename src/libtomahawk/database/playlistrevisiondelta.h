@@ -0,0 +1,58 @@
+/* === This file is part of Tomahawk Player - <http://tomahawk-player.org> ===
+ * 
+ *   Copyright 2010-2011, Christian Muehlhaeuser <muesli@tomahawk-player.org>
+ *
+ *   Tomahawk is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Tomahawk is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Tomahawk. If not, see <http://www.gnu.org/licenses/>.
+ */
+/*
+    Playlist revisions are stored and synced as deltas against their
+    previous revision where that is smaller than the full list of entry
+    guids, with a full list (a checkpoint) every so often so loading a
+    revision only ever replays a bounded number of deltas.
+
+    A delta is a QVariantMap:
+        "removed": [ guid, ... ]              entries to drop
+        "placed":  [ [ after, guid ], ... ]   entries to insert, or move if
+                                              present, right after the entry
+                                              after ("" for the front)
+
+    In playlist_revision.entries a checkpoint is a JSON list of guids, as it
+    always was, and a delta is a JSON object that also carries its "depth",
+    the number of deltas back to the last checkpoint.
+*/
+#ifndef PLAYLISTREVISIONDELTA_H
+#define PLAYLISTREVISIONDELTA_H
+
+#include <QStringList>
+#include <QVariantMap>
+
+#include "dllmacro.h"
+
+class DatabaseImpl;
+
+namespace PlaylistRevisionDelta
+{
+
+/// the delta turning from into to, moving as few entries as possible
+DLLEXPORT QVariantMap diff( const QStringList& from, const QStringList& to );
+
+/// applies delta to from, false if it doesn't fit
+DLLEXPORT bool apply( const QStringList& from, const QVariantMap& delta, QStringList& to );
+
+/// the ordered entry guids of a revision in the db, false if it can't be rebuilt
+DLLEXPORT bool loadEntries( DatabaseImpl* dbi, const QString& revguid, QStringList& entries, int* depth = 0 );
+
+}
+
+#endif // PLAYLISTREVISIONDELTA_H
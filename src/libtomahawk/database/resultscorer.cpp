@@ -0,0 +1,213 @@
+/* === This file is part of Tomahawk Player - <http://tomahawk-player.org> ===
+ * 
+ *   Copyright 2010-2011, Christian Muehlhaeuser <muesli@tomahawk-player.org>
+ *
+ *   Tomahawk is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Tomahawk is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Tomahawk. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "resultscorer.h"
+
+#include <QVarLengthArray>
+
+#include <cmath>
+
+#include "album.h"
+#include "artist.h"
+#include "query.h"
+#include "result.h"
+#include "databaseimpl.h"
+
+// names up to this length are scored without touching the heap
+#define PREALLOC_LENGTH 128
+
+// weights of the single distances, out of 10
+#define WEIGHT_ARTIST 4
+#define WEIGHT_ALBUM 1
+#define WEIGHT_TRACK 5
+
+using namespace Tomahawk;
+
+
+ResultScorer::ResultScorer( const query_ptr& query )
+    : m_artist( DatabaseImpl::sortname( query->artist() ) )
+    , m_album( DatabaseImpl::sortname( query->album() ) )
+    , m_track( DatabaseImpl::sortname( query->track() ) )
+{
+}
+
+
+// TODO make clever (ft. featuring live (stuff) etc)
+float
+ResultScorer::score( const result_ptr& r, float minScore )
+{
+    // what the weighted distances have to sum up to
+    const float needed = minScore * 10;
+
+    // track title first, it's worth the most
+    const QString rTrackname = sortname( m_tracks, r->dbid(), r->track() );
+    int mltrk = qMax( m_track.length(), rTrackname.length() );
+    int trkbound = maxDistance( mltrk, ( needed - WEIGHT_ARTIST - WEIGHT_ALBUM ) / WEIGHT_TRACK );
+    if ( trkbound < 0 )
+        return 0.0;
+
+    int trkdist = levenshtein( m_track, rTrackname, trkbound );
+    if ( trkdist > trkbound )
+        return 0.0;
+    float dctrk = (float)( mltrk - trkdist ) / mltrk;
+
+    const QString rArtistname = sortname( m_artists, r->artist()->id(), r->artist()->name() );
+    int mlart = qMax( m_artist.length(), rArtistname.length() );
+    int artbound = maxDistance( mlart, ( needed - WEIGHT_ALBUM - dctrk * WEIGHT_TRACK ) / WEIGHT_ARTIST );
+    if ( artbound < 0 )
+        return 0.0;
+
+    int artdist = levenshtein( m_artist, rArtistname, artbound );
+    if ( artdist > artbound )
+        return 0.0;
+    float dcart = (float)( mlart - artdist ) / mlart;
+
+    // don't penalize for missing album name
+    float dcalb = 1.0;
+    if ( m_album.length() )
+    {
+        const QString rAlbumname = sortname( m_albums, r->album()->id(), r->album()->name() );
+        int mlalb = qMax( m_album.length(), rAlbumname.length() );
+        int albbound = maxDistance( mlalb, ( needed - dcart * WEIGHT_ARTIST - dctrk * WEIGHT_TRACK ) / WEIGHT_ALBUM );
+        if ( albbound < 0 )
+            return 0.0;
+
+        int albdist = levenshtein( m_album, rAlbumname, albbound );
+        if ( albdist > albbound )
+            return 0.0;
+        dcalb = (float)( mlalb - albdist ) / mlalb;
+    }
+
+    // weighted, so album match is worth less than track title
+    float combined = ( dcart*4 + dcalb + dctrk*5 ) / 10;
+    return combined;
+}
+
+
+QString
+ResultScorer::sortname( QHash< unsigned int, QString >& cache, unsigned int id, const QString& name )
+{
+    if ( id == 0 )
+        return DatabaseImpl::sortname( name );
+
+    QHash< unsigned int, QString >::const_iterator it = cache.constFind( id );
+    if ( it != cache.constEnd() )
+        return it.value();
+
+    return cache.insert( id, DatabaseImpl::sortname( name ) ).value();
+}
+
+
+/*
+    Largest edit distance that may still give a similarity of minSimilarity.
+    Rounded up by one to stay on the safe side of float rounding, so a
+    distance above it can never make the cut. Returns maxLength (which no
+    distance exceeds) when there is nothing to bound, and a negative value
+    when not even a perfect match would do.
+ */
+int
+ResultScorer::maxDistance( int maxLength, float minSimilarity )
+{
+    if ( !( minSimilarity > 0 ) )
+        return maxLength;
+
+    return (int)floor( maxLength * ( 1.0 - minSimilarity ) ) + 1;
+}
+
+
+/*
+    Edit distance covering deletion, insertion, substitution and transposition,
+    computed on three rolling rows instead of the full matrix.
+
+    The transposition step is taken from:
+    Berghel, Hal ; Roach, David : "An Extension of Ukkonen's
+    Enhanced Dynamic Programming ASM Algorithm"
+    (http://www.acm.org/~hlb/publications/asm/asm.html)
+
+    With maxDistance >= 0 it gives up as soon as the distance is known to exceed
+    it, and returns maxDistance + 1 in that case.
+ */
+int
+ResultScorer::levenshtein( const QString& source, const QString& target, int maxDistance )
+{
+    const int n = source.length();
+    const int m = target.length();
+
+    if ( n == 0 )
+        return m;
+    if ( m == 0 )
+        return n;
+
+    // every cell is at least as far from the diagonal as its row from its column
+    if ( maxDistance >= 0 && qAbs( n - m ) > maxDistance )
+        return maxDistance + 1;
+
+    const QChar* s = source.unicode();
+    const QChar* t = target.unicode();
+
+    QVarLengthArray< int, 3 * PREALLOC_LENGTH > rows( 3 * ( m + 1 ) );
+    int* before = rows.data();
+    int* above = before + m + 1;
+    int* row = above + m + 1;
+
+    for ( int j = 0; j <= m; j++ )
+        above[j] = j;
+
+    int aboveMin = 0;
+    for ( int i = 1; i <= n; i++ )
+    {
+        const QChar s_i = s[i - 1];
+        row[0] = i;
+        int rowMin = i;
+
+        for ( int j = 1; j <= m; j++ )
+        {
+            const QChar t_j = t[j - 1];
+            const int cost = ( s_i == t_j ) ? 0 : 1;
+
+            int cell = qMin( row[j - 1] + 1, above[j - 1] + cost );
+            if ( above[j] + 1 < cell )
+                cell = above[j] + 1;
+
+            if ( i > 2 && j > 2 )
+            {
+                int trans = before[j - 2] + 1;
+
+                if ( s[i - 2] != t_j ) trans++;
+                if ( s_i != t[j - 2] ) trans++;
+                if ( cell > trans ) cell = trans;
+            }
+
+            row[j] = cell;
+            if ( cell < rowMin )
+                rowMin = cell;
+        }
+
+        // no later cell can drop below the minimum of the two rows above it
+        if ( maxDistance >= 0 && rowMin > maxDistance && aboveMin > maxDistance )
+            return maxDistance + 1;
+
+        aboveMin = rowMin;
+        int* tmp = before;
+        before = above;
+        above = row;
+        row = tmp;
+    }
+
+    return above[m];
+}
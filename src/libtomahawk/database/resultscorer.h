@@ -0,0 +1,62 @@
+/* === This file is part of Tomahawk Player - <http://tomahawk-player.org> ===
+ * 
+ *   Copyright 2010-2011, Christian Muehlhaeuser <muesli@tomahawk-player.org>
+ *
+ *   Tomahawk is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Tomahawk is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Tomahawk. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RESULTSCORER_H
+#define RESULTSCORER_H
+
+#include <QHash>
+#include <QString>
+
+#include "typedefs.h"
+
+#include "dllmacro.h"
+
+/*
+    Scores candidate results against a single query.
+
+    The query's names are normalized once on construction, names of result
+    artists / albums / tracks are cached by id, and the edit distances are
+    computed on a few rolling rows kept on the stack.
+    When a minimum score is passed, distance calculations stop as soon as the
+    result can no longer reach it. Scores of results reaching the minimum are
+    exactly the same as without it.
+ */
+class DLLEXPORT ResultScorer
+{
+public:
+    explicit ResultScorer( const Tomahawk::query_ptr& query );
+
+    // returns a value below minScore for results that can't reach it
+    float score( const Tomahawk::result_ptr& result, float minScore = 0.0 );
+
+    static int levenshtein( const QString& source, const QString& target, int maxDistance = -1 );
+
+private:
+    static QString sortname( QHash< unsigned int, QString >& cache, unsigned int id, const QString& name );
+    static int maxDistance( int maxLength, float minSimilarity );
+
+    QString m_artist;
+    QString m_album;
+    QString m_track;
+
+    QHash< unsigned int, QString > m_artists;
+    QHash< unsigned int, QString > m_albums;
+    QHash< unsigned int, QString > m_tracks;
+};
+
+#endif // RESULTSCORER_H
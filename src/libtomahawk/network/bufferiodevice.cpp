@@ -24,6 +24,8 @@
 
 // Msgs are framed, this is the size each msg we send containing audio data:
 #define BLOCKSIZE 4096
+// largest file we buffer, the size comes from the peer
+#define MAX_BUFFERSIZE ( 1024 * 1024 * 1024 )
 
 
 BufferIODevice::BufferIODevice( unsigned int size, QObject* parent )
@@ -32,6 +34,13 @@ BufferIODevice::BufferIODevice( unsigned int size, QObject* parent )
     , m_received( 0 )
     , m_pos( 0 )
 {
+    // the buffer grows as data arrives, but never past a sane size
+    if ( m_size > MAX_BUFFERSIZE )
+    {
+        qDebug() << Q_FUNC_INFO << "Refusing to buffer" << m_size << "bytes";
+        setErrorString( "File too large" );
+        m_size = 0;
+    }
 }
 
 
@@ -92,30 +101,42 @@ BufferIODevice::inputComplete( const QString& errmsg )
 }
 
 
-void
+bool
 BufferIODevice::addData( int block, const QByteArray& ba )
 {
     {
         QMutexLocker lock( &m_mut );
 
-        while ( m_buffer.count() <= block )
-            m_buffer << QByteArray();
+        // block comes from the peer, data outside of the file is never accepted
+        const qint64 start = (qint64)block * BLOCKSIZE;
+        const qint64 end = start + ba.count();
+        if ( block < 0 || start >= m_size || end > m_size )
+        {
+            qDebug() << Q_FUNC_INFO << "Rejecting data out of range, block" << block << "length" << ba.count() << "size" << m_size;
+            return false;
+        }
+
+        // grow geometrically, so a file streamed front to back is copied a few times only
+        if ( end > m_buffer.size() )
+            m_buffer.resize( qMin( (qint64)m_size, qMax( end, (qint64)m_buffer.size() * 2 ) ) );
 
-        m_buffer.replace( block, ba );
+        memcpy( m_buffer.data() + start, ba.constData(), ba.count() );
+        addRange( start, end );
     }
 
     // If this was the last block of the transfer, check if we need to fill up gaps
     if ( block + 1 == maxBlocks() )
     {
-        if ( nextEmptyBlock() >= 0 )
+        int gap = nextEmptyBlock();
+        if ( gap >= 0 )
         {
-            emit blockRequest( nextEmptyBlock() );
+            emit blockRequest( gap );
         }
     }
 
-    m_received += ba.count();
     emit bytesWritten( ba.count() );
     emit readyRead();
+    return true;
 }
 
 
@@ -129,19 +150,20 @@ BufferIODevice::bytesAvailable() const
 qint64
 BufferIODevice::readData( char* data, qint64 maxSize )
 {
-//    qDebug() << Q_FUNC_INFO << m_pos << maxSize << 1;
-
     if ( atEnd() )
         return 0;
 
-    QByteArray ba;
-    ba.append( getData( m_pos, maxSize ) );
-    m_pos += ba.count();
+    QMutexLocker lock( &m_mut );
+
+    // straight out of the contiguous buffer, up to the next gap
+    const qint64 len = qMin( maxSize, qMin( receivedFrom( m_pos ), (qint64)m_size - m_pos ) );
+    if ( len <= 0 )
+        return 0;
 
-//    qDebug() << Q_FUNC_INFO << maxSize << ba.count() << 2;
-    memcpy( data, ba.data(), ba.count() );
+    memcpy( data, m_buffer.constData() + m_pos, len );
+    m_pos += len;
 
-    return ba.count();
+    return len;
 }
 
 
@@ -157,7 +179,6 @@ BufferIODevice::writeData( const char* data, qint64 maxSize )
 qint64
 BufferIODevice::size() const
 {
-    qDebug() << Q_FUNC_INFO << m_size;
     return m_size;
 }
 
@@ -176,7 +197,8 @@ BufferIODevice::clear()
     QMutexLocker lock( &m_mut );
 
     m_pos = 0;
-    m_buffer.clear();
+    m_ranges.clear();
+    m_received = 0;
 }
 
 
@@ -198,33 +220,67 @@ BufferIODevice::blockForPos( qint64 pos ) const
 }
 
 
-int
-BufferIODevice::offsetForPos( qint64 pos ) const
+void
+BufferIODevice::addRange( qint64 start, qint64 end )
 {
-    // 0 % 4096 -> offset 0
-    // 4095 % 4096 -> offset 4095
-    // 4096 % 4096 -> offset 0
+    // m_mut must be held by the caller
+    if ( start >= end )
+        return;
+
+    // merge with a range starting before and reaching into the new one
+    QMap<qint64, qint64>::iterator it = m_ranges.upperBound( start );
+    if ( it != m_ranges.begin() )
+    {
+        --it;
+        if ( it.value() >= end )
+            return; // got that already
+
+        if ( it.value() >= start )
+        {
+            start = it.key();
+            m_received -= it.value() - it.key();
+            m_ranges.erase( it );
+        }
+    }
+
+    // swallow the ranges starting inside (or right after) the new one
+    it = m_ranges.lowerBound( start );
+    while ( it != m_ranges.end() && it.key() <= end )
+    {
+        end = qMax( end, it.value() );
+        m_received -= it.value() - it.key();
+        it = m_ranges.erase( it );
+    }
 
-    return pos % BLOCKSIZE;
+    m_ranges.insert( start, end );
+    m_received += end - start;
+}
+
+
+qint64
+BufferIODevice::receivedFrom( qint64 pos ) const
+{
+    // m_mut must be held by the caller
+    QMap<qint64, qint64>::const_iterator it = m_ranges.upperBound( pos );
+    if ( it == m_ranges.constBegin() )
+        return 0;
+
+    --it;
+    return qMax( (qint64)0, it.value() - pos );
 }
 
 
 int
 BufferIODevice::nextEmptyBlock() const
 {
-    int i = 0;
-    foreach( const QByteArray& ba, m_buffer )
-    {
-        if ( ba.isEmpty() )
-            return i;
-
-        i++;
-    }
+    QMutexLocker lock( &m_mut );
 
-    if ( i == maxBlocks() )
+    // everything before the end of the first range is there, if it starts at 0
+    qint64 gap = receivedFrom( 0 );
+    if ( gap >= m_size )
         return -1;
 
-    return i;
+    return blockForPos( gap );
 }
 
 
@@ -243,33 +299,10 @@ BufferIODevice::maxBlocks() const
 bool
 BufferIODevice::isBlockEmpty( int block ) const
 {
-    if ( block >= m_buffer.count() )
-        return true;
-
-    return m_buffer.at( block ).isEmpty();
-}
-
-
-QByteArray
-BufferIODevice::getData( qint64 pos, qint64 size )
-{
-//    qDebug() << Q_FUNC_INFO << pos << size << 1;
-    QByteArray ba;
-    int block = blockForPos( pos );
-    int offset = offsetForPos( pos );
-
     QMutexLocker lock( &m_mut );
-    while( ba.count() < size )
-    {
-        if ( block > maxBlocks() )
-            break;
-
-        if ( isBlockEmpty( block ) )
-            break;
-
-        ba.append( m_buffer.at( block++ ).mid( offset ) );
-    }
 
-//    qDebug() << Q_FUNC_INFO << pos << size << 2;
-    return ba.left( size );
+    // a block counts as received if it's there in full (or up to the end of the file)
+    const qint64 start = (qint64)block * BLOCKSIZE;
+    const qint64 end = qMin( start + BLOCKSIZE, qMax( (qint64)m_size, start + 1 ) );
+    return receivedFrom( start ) < end - start;
 }
@@ -20,6 +20,7 @@
 #define BUFFERIODEVICE_H
 
 #include <QIODevice>
+#include <QMap>
 #include <QMutexLocker>
 #include <QDebug>
 #include <QFile>
@@ -29,6 +30,7 @@ class BufferIODevice : public QIODevice
 Q_OBJECT
 
 public:
+    /// sizes past what we're willing to buffer leave an empty device, with an error string set
     explicit BufferIODevice( unsigned int size = 0, QObject* parent = 0 );
 
     virtual bool open( OpenMode mode );
@@ -40,12 +42,13 @@ public:
     virtual qint64 bytesAvailable() const;
     virtual qint64 size() const;
     virtual bool atEnd() const;
-    virtual qint64 pos() const { qDebug() << Q_FUNC_INFO << m_pos; return m_pos; }
+    virtual qint64 pos() const { return m_pos; }
 
-    void addData( int block, const QByteArray& ba );
+    /// returns false and drops the data if it doesn't fit the file
+    bool addData( int block, const QByteArray& ba );
     void clear();
 
-    OpenMode openMode() const { qDebug() << "openMode"; return QIODevice::ReadOnly | QIODevice::Unbuffered; }
+    OpenMode openMode() const { return QIODevice::ReadOnly | QIODevice::Unbuffered; }
 
     void inputComplete( const QString& errmsg = "" );
 
@@ -66,10 +69,13 @@ protected:
 
 private:
     int blockForPos( qint64 pos ) const;
-    int offsetForPos( qint64 pos ) const;
-    QByteArray getData( qint64 pos, qint64 size );
+    void addRange( qint64 start, qint64 end );
+    qint64 receivedFrom( qint64 pos ) const;
 
-    QList<QByteArray> m_buffer;
+    // the file up to the furthest block received, with the received parts tracked in m_ranges:
+    QByteArray m_buffer;
+    // received byte ranges, start -> end (exclusive), merged and non-overlapping
+    QMap<qint64, qint64> m_ranges;
     mutable QMutex m_mut; //const methods need to lock
     unsigned int m_size, m_received;
 
@@ -84,6 +84,9 @@ public:
 
     qint64 bytesSent() const { return m_tx_bytes; }
     qint64 bytesReceived() const { return m_rx_bytes; }
+    // queued by sendMsg() but not yet handed to the OS:
+    qint64 bytesPending() const { return m_tx_bytes_requested - m_tx_bytes; }
+    bool isShuttingDown() const { return m_do_shutdown; }
 
     void setMsgProcessorModeOut( quint32 m ) { m_msgprocessor_out.setMode( m ); }
     void setMsgProcessorModeIn( quint32 m ) { m_msgprocessor_in.setMode( m ); }
@@ -26,6 +26,24 @@
 
     Synced.
 
+    Ops are loaded and sent a page at a time. Peers that announce a
+    "window" in fetchops get the next pages while the earlier ones are
+    still being applied; each page ends with an "opspage" msg, acked with
+    "ackops" once it is in our db, and at most window pages are unacked.
+    Other peers get one page per fetchops and simply ask again.
+    The lastop we resume from is only advanced once ops are applied.
+
+    A peer may have compacted its oplog since we last synced, dropping the
+    op we resume from. Peers that announce "snapshots" in fetchops are then
+    sent a "snapshot" msg followed by the whole compacted log, and replace
+    everything they have from us with it. For the other ones we remember
+    how far they got, and compaction keeps the deletions they still need.
+
+    Playlist revisions are logged as deltas against their previous revision
+    where that is smaller. Only peers that announce "playlistdeltas" in
+    fetchops get them as they are, everybody else gets the full list of
+    entries, as an empty one would wipe the playlist on their side.
+
 */
 
 #include "dbsyncconnection.h"
@@ -34,8 +52,10 @@
 
 #include "database/database.h"
 #include "database/databasecommand.h"
+#include "database/databasecommand_clearsource.h"
 #include "database/databasecommand_collectionstats.h"
 #include "database/databasecommand_loadops.h"
+#include "database/databasecommand_setpeerlastop.h"
 #include "remotecollection.h"
 #include "source.h"
 #include "sourcelist.h"
@@ -44,6 +64,16 @@
 // it's automatically reestablished as needed.
 #define IDLE_TIMEOUT 300000
 
+// apply at most this many incoming ops in one transaction
+#define MAX_BATCH_OPS 500
+
+// ops loaded and sent per page, one page is applied as one transaction
+#define OPS_PAGE MAX_BATCH_OPS
+// unacked pages in flight to a peer
+#define OPS_WINDOW 4
+// ops sent per fetchops to peers that don't ack pages
+#define OPS_LEGACY_PAGE 5000
+
 using namespace Tomahawk;
 
 
@@ -51,6 +81,12 @@ DBSyncConnection::DBSyncConnection( Servent* s, source_ptr src )
     : Connection( s )
     , m_source( src )
     , m_state( UNKNOWN )
+    , m_sendWindow( 0 )
+    , m_sendSnapshots( false )
+    , m_sendPlaylistDeltas( false )
+    , m_loadingPage( false )
+    , m_flushedBatches( 0 )
+    , m_appliedBatches( 0 )
 {
     qDebug() << Q_FUNC_INFO << src->id() << thread();
     connect( this,            SIGNAL( stateChanged( DBSyncConnection::State, DBSyncConnection::State, QString ) ),
@@ -180,6 +216,9 @@ DBSyncConnection::gotThemCache( const QVariantMap& m )
     QVariantMap msg;
     msg.insert( "method", "fetchops" );
     msg.insert( "lastop", m_themcache.value( "lastop" ).toString() );
+    msg.insert( "window", OPS_WINDOW );
+    msg.insert( "snapshots", true );
+    msg.insert( "playlistdeltas", true );
     sendMsg( msg );
 }
 
@@ -198,6 +237,7 @@ DBSyncConnection::handleMsg( msg_ptr msg )
          msg->payload() == "ok" )
     {
         qDebug() << "No ops to apply, we are synced.";
+        flushOps();
         changeState( SYNCED );
         // calc the collection stats, to updates the "X tracks" in the sidebar etc
         // this is done automatically if you run a dbcmd to add files.
@@ -227,33 +267,74 @@ DBSyncConnection::handleMsg( msg_ptr msg )
             qDebug() << "UNKNOWN DBOP CMD";
 
             if ( !msg->is( Msg::FRAGMENT ) ) // last msg in this batch
-                lastOpApplied();
+            {
+                if ( !flushOps( true ) )
+                    lastOpApplied();
+            }
             return;
         }
 
         qDebug() << "APPLYING CMD" << cmd->commandname() << cmd->guid();
 
+        m_pendingOps << QSharedPointer<DatabaseCommand>( cmd );
+
         if ( !msg->is( Msg::FRAGMENT ) ) // last msg in this batch
         {
             changeState( SAVING ); // just DB work left to complete
-            connect( cmd, SIGNAL( finished() ), SLOT( lastOpApplied() ) );
+            flushOps( true );
         }
+        else if ( m_pendingOps.count() >= MAX_BATCH_OPS )
+            flushOps();
+
+        return;
+    }
 
-        if ( !cmd->singletonCmd() )
-            m_source->setLastOpGuid( cmd->guid() );
+    if ( m.value( "method" ).toString() == "opspage" )
+    {
+        // end of a page, ack it once everything up to here is applied
+        flushOps();
+        m_pageEnds << qMakePair( m_flushedBatches, m.value( "lastop" ).toString() );
+        ackPages();
+        return;
+    }
 
-        Database::instance()->enqueue( QSharedPointer<DatabaseCommand>( cmd ) );
+    if ( m.value( "method" ).toString() == "snapshot" )
+    {
+        // the ops that follow are all there is, drop what we have from them first
+        qDebug() << "Got a snapshot from" << m_source->friendlyName();
+        flushOps();
+        m_pendingOps << QSharedPointer<DatabaseCommand>( new DatabaseCommand_ClearSource( m_source ) );
         return;
     }
 
     if ( m.value( "method" ).toString() == "fetchops" )
     {
         m_uscache = m;
+        m_sendWindow = qMin( m.value( "window" ).toInt(), OPS_WINDOW );
+        m_sendSnapshots = m.value( "snapshots" ).toBool();
+        m_sendPlaylistDeltas = m.value( "playlistdeltas" ).toBool();
+        m_sendCursor = m.value( "lastop" ).toString();
+        m_unackedPages.clear();
+
+        DatabaseCommand* cmd = new DatabaseCommand_SetPeerLastOp( m_source, m_sendCursor, m_sendSnapshots );
+        Database::instance()->enqueue( QSharedPointer<DatabaseCommand>( cmd ) );
+
         if ( !m_us.empty() )
             sendOps();
         return;
     }
 
+    if ( m.value( "method" ).toString() == "ackops" )
+    {
+        // acks are cumulative, drop every page up to the acked one
+        const int i = m_unackedPages.indexOf( m.value( "lastop" ).toString() );
+        if ( i >= 0 )
+            m_unackedPages.erase( m_unackedPages.begin(), m_unackedPages.begin() + i + 1 );
+
+        loadNextPage();
+        return;
+    }
+
     if ( m.value( "method" ).toString() == "trigger" )
     {
         qDebug() << "Got trigger msg on dbsyncconnection, checking for new stuff.";
@@ -266,6 +347,70 @@ DBSyncConnection::handleMsg( msg_ptr msg )
 }
 
 
+/// hand the ops received so far to the database, to be applied in one transaction
+bool
+DBSyncConnection::flushOps( bool last )
+{
+    if ( m_pendingOps.isEmpty() )
+        return false;
+
+    qDebug() << Q_FUNC_INFO << "Applying" << m_pendingOps.count() << "ops";
+
+    QString lastguid;
+    foreach ( const QSharedPointer<DatabaseCommand>& cmd, m_pendingOps )
+    {
+        if ( cmd->loggable() && !cmd->singletonCmd() )
+            lastguid = cmd->guid();
+    }
+    m_flushedGuids << lastguid;
+    m_flushedBatches++;
+
+    DatabaseCommand* cmd = m_pendingOps.last().data();
+    connect( cmd, SIGNAL( finished() ), SLOT( batchApplied() ) );
+    if ( last )
+        connect( cmd, SIGNAL( finished() ), SLOT( lastOpApplied() ) );
+
+    Database::instance()->enqueue( m_pendingOps );
+    m_pendingOps.clear();
+    return true;
+}
+
+
+/// a batch of remote ops is in our db, so a resync can start after it
+void
+DBSyncConnection::batchApplied()
+{
+    m_appliedBatches++;
+
+    if ( !m_flushedGuids.isEmpty() )
+    {
+        const QString guid = m_flushedGuids.takeFirst();
+        if ( !guid.isEmpty() )
+            m_source->setLastOpGuid( guid );
+    }
+
+    ackPages();
+}
+
+
+/// ack the pages whose ops are all applied
+void
+DBSyncConnection::ackPages()
+{
+    QString lastop;
+    while ( !m_pageEnds.isEmpty() && m_pageEnds.first().first <= m_appliedBatches )
+        lastop = m_pageEnds.takeFirst().second;
+
+    if ( lastop.isEmpty() || !isRunning() )
+        return;
+
+    QVariantMap msg;
+    msg.insert( "method", "ackops" );
+    msg.insert( "lastop", lastop );
+    sendMsg( msg );
+}
+
+
 void
 DBSyncConnection::lastOpApplied()
 {
@@ -283,30 +428,90 @@ DBSyncConnection::sendOps()
     qDebug() << Q_FUNC_INFO;
     qDebug() << "Will send peer all ops since" << m_uscache.value( "lastop" ).toString();
 
+    if ( m_sendWindow > 0 )
+    {
+        loadNextPage();
+        return;
+    }
+
     source_ptr src = SourceList::instance()->getLocal();
 
-    DatabaseCommand_loadOps* cmd = new DatabaseCommand_loadOps( src, m_uscache.value( "lastop" ).toString() );
-    connect( cmd,  SIGNAL( done( QString, QString, QList< dbop_ptr > ) ),
-                     SLOT( sendOpsData( QString, QString, QList< dbop_ptr > ) ) );
+    DatabaseCommand_loadOps* cmd = new DatabaseCommand_loadOps( src, m_uscache.value( "lastop" ).toString(), OPS_LEGACY_PAGE );
+    cmd->setExpandPlaylistDeltas( !m_sendPlaylistDeltas );
+    connect( cmd,  SIGNAL( done( QString, QString, QList< dbop_ptr >, bool ) ),
+                     SLOT( sendOpsData( QString, QString, QList< dbop_ptr >, bool ) ) );
 
     Database::instance()->enqueue( QSharedPointer<DatabaseCommand>( cmd ) );
 }
 
 
+/// load the page after m_sendCursor, unless the peer has a full window to ack first
 void
-DBSyncConnection::sendOpsData( QString sinceguid, QString lastguid, QList< dbop_ptr > ops )
+DBSyncConnection::loadNextPage()
 {
+    if ( m_sendWindow <= 0 || m_loadingPage || m_unackedPages.count() >= m_sendWindow )
+        return;
+
+    m_loadingPage = true;
+    source_ptr src = SourceList::instance()->getLocal();
+
+    DatabaseCommand_loadOps* cmd = new DatabaseCommand_loadOps( src, m_sendCursor, OPS_PAGE );
+    cmd->setExpandPlaylistDeltas( !m_sendPlaylistDeltas );
+    connect( cmd,  SIGNAL( done( QString, QString, QList< dbop_ptr >, bool ) ),
+                     SLOT( sendOpsData( QString, QString, QList< dbop_ptr >, bool ) ) );
+
+    Database::instance()->enqueue( QSharedPointer<DatabaseCommand>( cmd ) );
+}
+
+
+void
+DBSyncConnection::sendOpsData( QString sinceguid, QString lastguid, QList< dbop_ptr > ops, bool snapshot )
+{
+    bool paged = false;
+    if ( m_sendWindow > 0 )
+    {
+        m_loadingPage = false;
+
+        // loaded for a fetchops that has been superseded since
+        if ( sinceguid != m_sendCursor )
+        {
+            loadNextPage();
+            return;
+        }
+
+        paged = true;
+    }
+
     if ( m_lastSentOp == lastguid )
         ops.clear();
 
     qDebug() << Q_FUNC_INFO << sinceguid << lastguid << "Num ops to send:" << ops.length();
     m_lastSentOp = lastguid;
+
+    if ( snapshot )
+    {
+        if ( m_sendSnapshots )
+        {
+            QVariantMap msg;
+            msg.insert( "method", "snapshot" );
+            sendMsg( msg );
+        }
+        else
+            qDebug() << "Peer's lastop was compacted away and it doesn't take snapshots, replaying our whole oplog";
+    }
+
     if ( ops.length() == 0 )
     {
+        if ( paged )
+            m_sendWindow = 0; // all sent, wait for the next fetchops
+
         sendMsg( Msg::factory( "ok", Msg::DBOP ) );
         return;
     }
 
+    // a full page may be followed by more, the peer only stops at an op without FRAGMENT
+    const bool more = paged && ops.length() == OPS_PAGE;
+
     int i;
     for( i = 0; i < ops.length(); ++i )
     {
@@ -314,11 +519,29 @@ DBSyncConnection::sendOpsData( QString sinceguid, QString lastguid, QList< dbop_
 
         if ( ops.at( i )->compressed )
             flags |= Msg::COMPRESSED;
-        if ( i != ops.length() - 1 )
+        if ( i != ops.length() - 1 || more )
             flags |= Msg::FRAGMENT;
 
         sendMsg( Msg::factory( ops.at( i )->payload, flags ) );
     }
+
+    if ( !paged )
+        return;
+
+    if ( !more )
+    {
+        m_sendWindow = 0;
+        return;
+    }
+
+    QVariantMap msg;
+    msg.insert( "method", "opspage" );
+    msg.insert( "lastop", lastguid );
+    sendMsg( msg );
+
+    m_unackedPages << lastguid;
+    m_sendCursor = lastguid;
+    loadNextPage();
 }
 
 
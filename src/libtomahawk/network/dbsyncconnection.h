@@ -23,8 +23,10 @@
 #include <QTimer>
 #include <QSharedPointer>
 #include <QIODevice>
+#include <QStringList>
 
 #include "network/connection.h"
+#include "database/databasecommand.h"
 #include "database/op.h"
 #include "typedefs.h"
 
@@ -65,7 +67,8 @@ private slots:
     void gotUs( const QVariantMap& m );
     void gotThemCache( const QVariantMap& m );
     void lastOpApplied();
-    void sendOpsData( QString sinceguid, QString lastguid, QList< dbop_ptr > ops );
+    void batchApplied();
+    void sendOpsData( QString sinceguid, QString lastguid, QList< dbop_ptr > ops, bool snapshot );
     void check();
     void idleTimeout();
 
@@ -73,6 +76,9 @@ private:
     void compareAndRequest();
     void synced();
     void changeState( State newstate );
+    bool flushOps( bool last = false );
+    void ackPages();
+    void loadNextPage();
 
     Tomahawk::source_ptr m_source;
     QVariantMap m_us, m_uscache, m_themcache;
@@ -80,6 +86,22 @@ private:
 
     QString m_lastSentOp;
 
+    // sending ops to a peer that acks them page by page:
+    int m_sendWindow; // max unacked pages, 0 for peers that don't ack
+    bool m_sendSnapshots; // peer can replace our data with a snapshot of our compacted oplog
+    bool m_sendPlaylistDeltas; // peer can apply playlist revisions logged as deltas
+    QString m_sendCursor; // guid the next page starts after
+    QStringList m_unackedPages; // last guid of each page sent but not acked yet
+    bool m_loadingPage;
+
+    // remote ops waiting to be applied in a single transaction
+    QList< QSharedPointer<DatabaseCommand> > m_pendingOps;
+
+    // batches handed to the database, their last guid and the page ends to ack once they're applied
+    int m_flushedBatches, m_appliedBatches;
+    QStringList m_flushedGuids;
+    QList< QPair< int, QString > > m_pageEnds;
+
     QTimer m_timer;
 
 };
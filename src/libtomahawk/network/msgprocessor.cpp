@@ -18,13 +18,56 @@
 
 #include "msgprocessor.h"
 
+#include <QRunnable>
+#include <QThreadPool>
+
 #include "network/servent.h"
 
+#define MAX_WORKER_THREADS 4
+
+
+// works off the queue of one MsgProcessor, so its msgs stay in order
+class MsgProcessorJob : public QRunnable
+{
+public:
+    explicit MsgProcessorJob( MsgProcessor* processor ) : m_processor( processor ) {}
+    virtual void run() { m_processor->work(); }
+
+private:
+    MsgProcessor* m_processor;
+};
+
+
+static QThreadPool*
+workerPool()
+{
+    static QThreadPool* pool = 0;
+    if ( !pool )
+    {
+        pool = new QThreadPool;
+        pool->setMaxThreadCount( qBound( 1, QThread::idealThreadCount(), MAX_WORKER_THREADS ) );
+    }
+
+    return pool;
+}
+
 
 MsgProcessor::MsgProcessor( quint32 mode, quint32 t ) :
-    QObject(), m_mode( mode ), m_threshold( t ), m_totmsgsize( 0 )
+    QObject(), m_mode( mode ), m_threshold( t ), m_totmsgsize( 0 ), m_inFlight( 0 )
+    , m_jobRunning( false ), m_deleting( false )
 {
     moveToThread( Servent::instance()->thread() );
+    workerPool();
+}
+
+
+MsgProcessor::~MsgProcessor()
+{
+    // the job only touches us while it holds the mutex, wait for it to let go
+    QMutexLocker lock( &m_jobMutex );
+    m_deleting = true;
+    while ( m_jobRunning )
+        m_jobDone.wait( &m_jobMutex );
 }
 
 
@@ -38,66 +81,89 @@ MsgProcessor::append( msg_ptr msg )
         return;
     }
 
-    m_msgs.append( msg );
-    m_msg_ready.insert( msg.data(), false );
-
     m_totmsgsize += msg->payload().length();
 
-    if( m_mode & NOTHING )
+    // nothing to do and nothing ahead of it: pass it on right away
+    if( m_inFlight == 0 && !needsProcessing( msg, m_mode, m_threshold ) )
     {
-        //qDebug() << "MsgProcessor::NOTHING";
-        handleProcessedMsg( msg );
+        emit ready( msg );
+        emit empty();
         return;
     }
 
-    QFuture<msg_ptr> fut = QtConcurrent::run(&MsgProcessor::process, msg, m_mode, m_threshold);
-    QFutureWatcher<msg_ptr> * watcher = new QFutureWatcher<msg_ptr>;
-    connect( watcher, SIGNAL( finished() ),
-             this, SLOT( processed() ),
-             Qt::QueuedConnection );
+    m_inFlight++;
 
-    watcher->setFuture( fut );
+    QMutexLocker lock( &m_jobMutex );
+    m_jobQueue.enqueue( qMakePair( msg, m_mode ) );
+    if ( !m_jobRunning )
+    {
+        m_jobRunning = true;
+        workerPool()->start( new MsgProcessorJob( this ) );
+    }
 }
 
 
 void
-MsgProcessor::processed()
+MsgProcessor::work()
 {
-    QFutureWatcher<msg_ptr> * watcher = (QFutureWatcher<msg_ptr> *) sender();
-    msg_ptr msg = watcher->result();
-    watcher->deleteLater();
-    handleProcessedMsg( msg );
+    forever
+    {
+        QPair< msg_ptr, quint32 > job;
+        {
+            QMutexLocker lock( &m_jobMutex );
+            if ( m_deleting || m_jobQueue.isEmpty() )
+            {
+                m_jobRunning = false;
+                m_jobDone.wakeAll();
+                return;
+            }
+
+            job = m_jobQueue.dequeue();
+        }
+
+        process( job.first, job.second, m_threshold );
+
+        QMutexLocker lock( &m_jobMutex );
+        if ( !m_deleting )
+            QMetaObject::invokeMethod( this, "processed", Qt::QueuedConnection, Q_ARG( msg_ptr, job.first ) );
+    }
 }
 
 
 void
-MsgProcessor::handleProcessedMsg( msg_ptr msg )
+MsgProcessor::processed( msg_ptr msg )
 {
     Q_ASSERT( QThread::currentThread() == thread() );
 
-    m_msg_ready.insert( msg.data(), true );
+    m_inFlight--;
+    //qDebug() << Q_FUNC_INFO << "totmsgsize:" << m_totmsgsize;
+    emit ready( msg );
 
-    while( !m_msgs.isEmpty() )
+    if ( m_inFlight == 0 )
     {
-        if( m_msg_ready.value( m_msgs.first().data() ) )
-        {
-            msg_ptr m = m_msgs.takeFirst();
-            m_msg_ready.remove( m.data() );
-            //qDebug() << Q_FUNC_INFO << "totmsgsize:" << m_totmsgsize;
-            emit ready( m );
-        }
-        else
-        {
-            return;
-        }
+        //qDebug() << Q_FUNC_INFO << "EMPTY, no msgs left.";
+        emit empty();
     }
+}
+
+
+bool
+MsgProcessor::needsProcessing( const msg_ptr& msg, quint32 mode, quint32 threshold )
+{
+    if( (mode & UNCOMPRESS_ALL) && msg->is( Msg::COMPRESSED ) )
+        return true;
+
+    if( (mode & PARSE_JSON) && msg->is( Msg::JSON ) && msg->m_json_parsed == false )
+        return true;
+
+    if( (mode & COMPRESS_IF_LARGE) && !msg->is( Msg::COMPRESSED ) && msg->length() > threshold )
+        return true;
 
-    //qDebug() << Q_FUNC_INFO << "EMPTY, no msgs left.";
-    emit empty();
+    return false;
 }
 
 
-/// This method is run by QtConcurrent:
+/// This method is run by the worker pool:
 msg_ptr
 MsgProcessor::process( msg_ptr msg, quint32 mode, quint32 threshold )
 {
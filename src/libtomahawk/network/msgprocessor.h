@@ -23,7 +23,9 @@
     It can be configured to auto-compress, or de-compress msgs for sending
     or receiving.
 
-    It uses QtConcurrent, but preserves msg order.
+    Msgs that need no work are passed on right away. The others are handled
+    one after the other on a small worker pool shared by all processors,
+    which preserves msg order.
 
     NOT threadsafe.
 */
@@ -31,10 +33,10 @@
 #define MSGPROCESSOR_H
 
 #include <QObject>
+#include <QMutex>
+#include <QQueue>
+#include <QWaitCondition>
 #include "msg.h"
-#include <QtConcurrentRun>
-#include <QFuture>
-#include <QFutureWatcher>
 
 #include <qjson/parser.h>
 #include <qjson/serializer.h>
@@ -53,12 +55,14 @@ public:
     };
 
     explicit MsgProcessor( quint32 mode = NOTHING, quint32 t = 512 );
+    virtual ~MsgProcessor();
 
     void setMode( quint32 m ) { m_mode = m ; }
 
     static msg_ptr process( msg_ptr msg, quint32 mode, quint32 threshold );
+    static bool needsProcessing( const msg_ptr& msg, quint32 mode, quint32 threshold );
 
-    int length() const { return m_msgs.length(); }
+    int length() const { return m_inFlight; }
 
 signals:
     void ready( msg_ptr );
@@ -66,16 +70,26 @@ signals:
 
 public slots:
     void append( msg_ptr msg );
-    void processed();
+
+private slots:
+    void processed( msg_ptr msg );
 
 private:
-    void handleProcessedMsg( msg_ptr msg );
+    friend class MsgProcessorJob;
+    void work();
 
     quint32 m_mode;
     quint32 m_threshold;
-    QList<msg_ptr> m_msgs;
-    QMap< Msg*, bool> m_msg_ready;
     unsigned int m_totmsgsize;
+
+    // msgs handed to the worker pool and not back yet, owned by our thread:
+    int m_inFlight;
+
+    // shared with the worker job:
+    QMutex m_jobMutex;
+    QWaitCondition m_jobDone;
+    QQueue< QPair< msg_ptr, quint32 > > m_jobQueue;
+    bool m_jobRunning, m_deleting;
 };
 
 #endif // MSGPROCESSOR_H
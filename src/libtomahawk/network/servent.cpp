@@ -854,8 +854,9 @@ Servent::localFileIODeviceFactory( const Tomahawk::result_ptr& result )
 {
     // ignore "file://" at front of url
     QFile* io = new QFile( result->url().mid( QString( "file://" ).length() ) );
+    // everyone reads in large chunks, QIODevice's own buffer would just be another copy
     if ( io )
-        io->open( QIODevice::ReadOnly );
+        io->open( QIODevice::ReadOnly | QIODevice::Unbuffered );
 
     return QSharedPointer<QIODevice>( io );
 }
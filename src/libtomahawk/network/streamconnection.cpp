@@ -28,6 +28,20 @@
 #include "database/database.h"
 #include "sourcelist.h"
 
+/*
+    Data msgs are either "data" followed by one block, which the receiver
+    appends at its current block, or "bdata" followed by the big endian
+    index of the first block and up to m_chunkSize bytes of data.
+    The sender offers larger chunks with "chunkoffer<bytes>" and only
+    switches to "bdata" once the receiver answered "chunkaccept<bytes>", so
+    older peers keep talking plain "data".
+ */
+
+// largest chunk we send or accept in a single data msg
+#define MAX_CHUNKSIZE 65536
+// how many bytes we keep queued for the socket before waiting for it to drain
+#define SEND_WINDOW 262144
+
 using namespace Tomahawk;
 
 
@@ -37,6 +51,9 @@ StreamConnection::StreamConnection( Servent* s, ControlConnection* cc, QString f
     , m_fid( fid )
     , m_type( RECEIVING )
     , m_curBlock( 0 )
+    , m_chunkSize( 0 )
+    , m_sentLast( false )
+    , m_pendingBlock( -1 )
     , m_badded( 0 )
     , m_bsent( 0 )
     , m_allok( false )
@@ -70,6 +87,10 @@ StreamConnection::StreamConnection( Servent* s, ControlConnection* cc, QString f
     , m_cc( cc )
     , m_fid( fid )
     , m_type( SENDING )
+    , m_curBlock( 0 )
+    , m_chunkSize( 0 )
+    , m_sentLast( false )
+    , m_pendingBlock( -1 )
     , m_badded( 0 )
     , m_bsent( 0 )
     , m_allok( false )
@@ -150,12 +171,33 @@ StreamConnection::setup()
     if( m_type == RECEIVING )
     {
         qDebug() << "in RX mode";
+
+        // a bogus size from the peer, nothing could ever be buffered
+        BufferIODevice* bio = (BufferIODevice*)m_iodev.data();
+        if ( bio->size() == 0 )
+        {
+            qDebug() << "Invalid file size from peer:" << m_result->size();
+            bio->inputComplete( "Invalid file size" );
+            shutdown();
+            return;
+        }
+
+        // seeked before the connection was up
+        if ( m_pendingBlock >= 0 )
+        {
+            onBlockRequest( m_pendingBlock );
+            m_pendingBlock = -1;
+        }
+
         emit updated();
         return;
     }
 
     qDebug() << "in TX mode, fid:" << m_fid;
 
+    // keep the socket fed as it drains, instead of polling the event loop
+    connect( socket().data(), SIGNAL( bytesWritten( qint64 ) ), SLOT( sendSome() ), Qt::QueuedConnection );
+
     DatabaseCommand_LoadFile* cmd = new DatabaseCommand_LoadFile( m_fid );
     connect( cmd, SIGNAL( result( Tomahawk::result_ptr ) ), SLOT( startSending( Tomahawk::result_ptr ) ) );
     Database::instance()->enqueue( QSharedPointer<DatabaseCommand>( cmd ) );
@@ -184,6 +226,24 @@ StreamConnection::startSending( const Tomahawk::result_ptr& result )
     }
 
     m_readdev = QSharedPointer<QIODevice>( io );
+
+    QByteArray sm;
+    sm.append( QString( "chunkoffer%1" ).arg( MAX_CHUNKSIZE ) );
+    sendMsg( Msg::factory( sm, Msg::RAW | Msg::FRAGMENT ) );
+
+    // the receiver asked for a block while we were still looking up the file
+    if ( m_pendingBlock >= 0 )
+    {
+        m_readdev->seek( (qint64)m_pendingBlock * BufferIODevice::blockSize() );
+
+        // no chunks accepted yet, so the first data msgs need the marker
+        QByteArray db;
+        db.append( QString( "doneblock%1" ).arg( m_pendingBlock ) );
+        sendMsg( Msg::factory( db, Msg::RAW | Msg::FRAGMENT ) );
+
+        m_pendingBlock = -1;
+    }
+
     sendSome();
 
     emit updated();
@@ -195,23 +255,59 @@ StreamConnection::handleMsg( msg_ptr msg )
 {
     Q_ASSERT( msg->is( Msg::RAW ) );
 
-    if ( msg->payload().startsWith( "block" ) )
+    if ( m_type == SENDING )
     {
-        int block = QString( msg->payload() ).mid( 5 ).toInt();
-        m_readdev->seek( block * BufferIODevice::blockSize() );
+        if ( msg->payload().startsWith( "block" ) )
+        {
+            int block = QString( msg->payload() ).mid( 5 ).toInt();
+            if ( m_readdev.isNull() )
+            {
+                m_pendingBlock = block;
+                return;
+            }
+
+            m_readdev->seek( block * BufferIODevice::blockSize() );
+            m_sentLast = false;
 
-        qDebug() << "Seeked to block:" << block;
+            qDebug() << "Seeked to block:" << block;
 
-        QByteArray sm;
-        sm.append( QString( "doneblock%1" ).arg( block ) );
+            // bdata msgs carry their position, only plain data needs the marker
+            if ( !m_chunkSize )
+            {
+                QByteArray sm;
+                sm.append( QString( "doneblock%1" ).arg( block ) );
 
-        sendMsg( Msg::factory( sm, Msg::RAW | Msg::FRAGMENT ) );
-        QTimer::singleShot( 0, this, SLOT( sendSome() ) );
+                sendMsg( Msg::factory( sm, Msg::RAW | Msg::FRAGMENT ) );
+            }
+
+            sendSome();
+        }
+        else if ( msg->payload().startsWith( "chunkaccept" ) )
+        {
+            int size = QString( msg->payload() ).mid( 11 ).toInt();
+            if ( size > 0 && size <= MAX_CHUNKSIZE && size % BufferIODevice::blockSize() == 0 )
+            {
+                qDebug() << "Peer accepted chunks of" << size << "bytes";
+                m_chunkSize = size;
+            }
+        }
+
+        return;
     }
-    else if ( msg->payload().startsWith( "doneblock" ) )
+
+    BufferIODevice* bio = (BufferIODevice*)m_iodev.data();
+    if ( msg->payload().startsWith( "doneblock" ) )
     {
-        int block = QString( msg->payload() ).mid( 9 ).toInt();
-        ((BufferIODevice*)m_iodev.data())->seeked( block );
+        bool ok;
+        int block = QString( msg->payload() ).mid( 9 ).toInt( &ok );
+        if ( !ok || block < 0 || block >= bio->maxBlocks() )
+        {
+            qDebug() << "Invalid doneblock from peer:" << msg->payload().left( 32 );
+            shutdown();
+            return;
+        }
+
+        bio->seeked( block );
 
         m_curBlock = block;
         qDebug() << "Next block is now:" << block;
@@ -219,18 +315,68 @@ StreamConnection::handleMsg( msg_ptr msg )
     else if ( msg->payload().startsWith( "data" ) )
     {
         m_badded += msg->payload().length() - 4;
-        ((BufferIODevice*)m_iodev.data())->addData( m_curBlock++, msg->payload().mid( 4 ) );
+        if ( !bio->addData( m_curBlock++, msg->payload().mid( 4 ) ) )
+        {
+            shutdown();
+            return;
+        }
+    }
+    else if ( msg->payload().startsWith( "bdata" ) )
+    {
+        const QByteArray& payload = msg->payload();
+        const int header = 5 + sizeof( quint32 );
+        if ( payload.length() <= header )
+        {
+            qDebug() << "Invalid bdata from peer, length" << payload.length();
+            shutdown();
+            return;
+        }
+
+        const quint32 first = qFromBigEndian<quint32>( (const uchar*)payload.constData() + 5 );
+        if ( first >= (quint32)bio->maxBlocks() )
+        {
+            qDebug() << "Invalid bdata from peer, block" << first << "of" << bio->maxBlocks();
+            shutdown();
+            return;
+        }
+
+        int block = first;
+        for ( int offset = header; offset < payload.length(); offset += BufferIODevice::blockSize() )
+        {
+            const QByteArray ba = payload.mid( offset, BufferIODevice::blockSize() );
+            m_badded += ba.length();
+            if ( !bio->addData( block++, ba ) )
+            {
+                shutdown();
+                return;
+            }
+        }
+
+        m_curBlock = block;
+    }
+    else if ( msg->payload().startsWith( "chunkoffer" ) )
+    {
+        int size = qMin( QString( msg->payload() ).mid( 10 ).toInt(), MAX_CHUNKSIZE );
+        size -= size % BufferIODevice::blockSize();
+
+        if ( size > 0 )
+        {
+            QByteArray sm;
+            sm.append( QString( "chunkaccept%1" ).arg( size ) );
+
+            sendMsg( Msg::factory( sm, Msg::RAW | Msg::FRAGMENT ) );
+        }
     }
 
     //qDebug() << Q_FUNC_INFO << "flags" << (int) msg->flags()
     //         << "payload len" << msg->payload().length()
     //         << "written to device so far: " << m_badded;
 
-    if ( ((BufferIODevice*)m_iodev.data())->nextEmptyBlock() < 0 )
+    if ( bio->nextEmptyBlock() < 0 )
     {
         m_allok = true;
         // tell our iodev there is no more data to read, no args meaning a success:
-        ((BufferIODevice*)m_iodev.data())->inputComplete();
+        bio->inputComplete();
         shutdown();
     }
 }
@@ -249,24 +395,36 @@ StreamConnection::sendSome()
 {
     Q_ASSERT( m_type == StreamConnection::SENDING );
 
-    QByteArray ba = "data";
-    ba.append( m_readdev->read( BufferIODevice::blockSize() ) );
-    m_bsent += ba.length() - 4;
-
-    if( m_readdev->atEnd() )
-    {
-        sendMsg( Msg::factory( ba, Msg::RAW ) );
+    if ( m_readdev.isNull() )
         return;
-    }
-    else
+
+    // fill the window, the socket's bytesWritten() brings us back for more.
+    // HINT: a smaller window per time unit is where upload throttling could be implemented
+    while ( !m_sentLast && !isShuttingDown() && bytesPending() < SEND_WINDOW )
     {
+        QByteArray ba;
+        int header;
+        if ( m_chunkSize )
+        {
+            quint32 block = qToBigEndian<quint32>( m_readdev->pos() / BufferIODevice::blockSize() );
+            ba = "bdata";
+            ba.append( (const char*)&block, sizeof( quint32 ) );
+            header = ba.length();
+            ba.append( m_readdev->read( m_chunkSize ) );
+        }
+        else
+        {
+            ba = "data";
+            header = ba.length();
+            ba.append( m_readdev->read( BufferIODevice::blockSize() ) );
+        }
+
+        m_bsent += ba.length() - header;
+        m_sentLast = m_readdev->atEnd();
+
         // more to come -> FRAGMENT
-        sendMsg( Msg::factory( ba, Msg::RAW | Msg::FRAGMENT ) );
+        sendMsg( Msg::factory( ba, m_sentLast ? Msg::RAW : Msg::RAW | Msg::FRAGMENT ) );
     }
-
-    // HINT: change the 0 to 50 to transmit at 640Kbps, for example
-    //       (this is where upload throttling could be implemented)
-    QTimer::singleShot( 0, this, SLOT( sendSome() ) );
 }
 
 
@@ -278,6 +436,12 @@ StreamConnection::onBlockRequest( int block )
     if ( m_curBlock == block )
         return;
 
+    if ( !isReady() )
+    {
+        m_pendingBlock = block;
+        return;
+    }
+
     QByteArray sm;
     sm.append( QString( "block%1" ).arg( block ) );
 
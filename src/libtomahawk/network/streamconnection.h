@@ -84,6 +84,9 @@ private:
     QSharedPointer<QIODevice> m_readdev;
 
     int m_curBlock;
+    int m_chunkSize; // bytes per data msg, 0 until the receiver accepted our offer
+    bool m_sentLast; // TX: last data msg is out, only a seek restarts sending
+    int m_pendingBlock; // block asked for before we could act on it, -1 if none
 
     int m_badded, m_bsent;
     bool m_allok; // got last msg ok, transfer complete?
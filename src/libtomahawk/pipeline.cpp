@@ -25,7 +25,15 @@
 #include "functimeout.h"
 #include "database/database.h"
 
+// initial number of queries dispatched at once, adapted at runtime
+// depending on how quickly the resolvers report back
 #define CONCURRENT_QUERIES 8
+#define MIN_CONCURRENT_QUERIES 4
+#define MAX_CONCURRENT_QUERIES 64
+// average time (ms) a query may take to pass the pipeline before we stop widening
+#define TARGET_LATENCY 1000
+// don't bother purging expired queries / results below this size
+#define MIN_PURGE_THRESHOLD 1000
 
 using namespace Tomahawk;
 
@@ -41,6 +49,9 @@ Pipeline::instance()
 
 Pipeline::Pipeline( QObject* parent )
     : QObject( parent )
+    , m_maxConcurrent( CONCURRENT_QUERIES )
+    , m_avgLatency( 0 )
+    , m_purgeThreshold( MIN_PURGE_THRESHOLD )
     , m_index_ready( false )
 {
     s_instance = this;
@@ -57,7 +68,7 @@ Pipeline::databaseReady()
 
 void Pipeline::indexReady()
 {
-    qDebug() << Q_FUNC_INFO << "shunting this many pending queries:" << m_queries_pending.size();
+    qDebug() << Q_FUNC_INFO << "shunting this many pending queries:" << m_pending.count();
     m_index_ready = true;
 
     shuntNext();
@@ -99,30 +110,41 @@ Pipeline::resolve( const QList<query_ptr>& qlist, bool prioritized )
     {
         QMutexLocker lock( &m_mut );
 
-        int i = 0;
+        QList< query_ptr > prioritizedList;
         foreach( const query_ptr& q, qlist )
         {
-            qDebug() << Q_FUNC_INFO << (qlonglong)q.data() << q->toString();
-            if ( !m_qids.contains( q->id() ) )
+            if ( m_qids.value( q->id() ).isNull() )
             {
                 m_qids.insert( q->id(), q );
             }
 
-            if ( m_queries_pending.contains( q ) )
+            QHash< QID, bool >::iterator it = m_pending.find( q->id() );
+            if ( it != m_pending.end() )
             {
-                qDebug() << "Already queued for resolving:" << q->toString();
-                continue;
+                if ( !prioritized || it.value() )
+                {
+                    qDebug() << "Already queued for resolving:" << q->toString();
+                    continue;
+                }
+
+                // promote to the prioritized lane, the stale entry in the
+                // background lane gets skipped in takeNextPending()
+                it.value() = true;
             }
+            else
+                m_pending.insert( q->id(), prioritized );
 
             if ( prioritized )
-            {
-                m_queries_pending.insert( i++, q );
-            }
+                prioritizedList << q;
             else
-            {
-                m_queries_pending.append( q );
-            }
+                m_queries_pending << q;
         }
+
+        // newly prioritized queries go ahead of older prioritized ones
+        if ( !prioritizedList.isEmpty() )
+            m_queries_prioritized = prioritizedList + m_queries_prioritized;
+
+        checkPurge();
     }
 
     shuntNext();
@@ -148,28 +170,63 @@ Pipeline::resolve( QID qid, bool prioritized )
 }
 
 
+query_ptr
+Pipeline::query( const QID& qid ) const
+{
+    QMutexLocker lock( &m_mut );
+    return m_qids.value( qid ).toStrongRef();
+}
+
+
+result_ptr
+Pipeline::result( const RID& rid ) const
+{
+    QMutexLocker lock( &m_mut );
+    return m_rids.value( rid ).toStrongRef();
+}
+
+
+int
+Pipeline::queryCount() const
+{
+    QMutexLocker lock( &m_mut );
+    purge();
+    return m_qids.count();
+}
+
+
+int
+Pipeline::resultCount() const
+{
+    QMutexLocker lock( &m_mut );
+    purge();
+    return m_rids.count();
+}
+
+
 void
 Pipeline::reportResults( QID qid, const QList< result_ptr >& results )
 {
+    query_ptr q;
     {
         QMutexLocker lock( &m_mut );
 
-        if ( !m_qids.contains( qid ) )
+        if ( !m_qidsState.contains( qid ) )
         {
-            qDebug() << "reportResults called for unknown QID" << qid;
+            qDebug() << "reportResults called for unknown QID-state" << qid;
             Q_ASSERT( false );
             return;
         }
 
-        if ( !m_qidsState.contains( qid ) )
+        q = m_running.value( qid );
+        if ( q.isNull() )
         {
-            qDebug() << "reportResults called for unknown QID-state" << qid;
+            qDebug() << "reportResults called for unknown QID" << qid;
             Q_ASSERT( false );
             return;
         }
     }
 
-    const query_ptr& q = m_qids.value( qid );
     if ( !results.isEmpty() )
     {
         //qDebug() << Q_FUNC_INFO << qid;
@@ -177,9 +234,14 @@ Pipeline::reportResults( QID qid, const QList< result_ptr >& results )
 
         q->addResults( results );
 
-        foreach( const result_ptr& r, q->results() )
         {
-            m_rids.insert( r->id(), r );
+            QMutexLocker lock( &m_mut );
+            foreach( const result_ptr& r, q->results() )
+            {
+                m_rids.insert( r->id(), r );
+            }
+
+            checkPurge();
         }
 
         if ( q->solved() )
@@ -191,6 +253,12 @@ Pipeline::reportResults( QID qid, const QList< result_ptr >& results )
         // All resolvers have reported back their results for this query now
         qDebug() << "Finished resolving:" << q->toString();
 
+        {
+            QMutexLocker lock( &m_mut );
+            if ( m_dispatched.contains( qid ) )
+                adjustConcurrency( m_dispatched.take( qid ).elapsed() );
+        }
+
         if ( !q->solved() )
             q->onResolvingFinished();
 
@@ -205,35 +273,94 @@ Pipeline::shuntNext()
     if ( !m_index_ready )
         return;
 
-    query_ptr q;
+    QList< query_ptr > dispatch;
     {
         QMutexLocker lock( &m_mut );
 
-        if ( m_queries_pending.isEmpty() )
+        if ( m_pending.isEmpty() )
         {
+            // only stale, already dispatched entries can be left in the lanes
+            m_queries_prioritized.clear();
+            m_queries_pending.clear();
+
             if ( m_qidsState.isEmpty() )
                 emit idle();
             return;
         }
 
-        qDebug() << Q_FUNC_INFO << m_qidsState.count();
-        // Check if we are ready to dispatch more queries
-        if ( m_qidsState.count() >= CONCURRENT_QUERIES )
-            return;
+        qDebug() << Q_FUNC_INFO << m_qidsState.count() << "of" << m_maxConcurrent;
 
         /*
             Since resolvers are async, we now dispatch to the highest weighted ones
-            and after timeout, dispatch to next highest etc, aborting when solved
+            and after timeout, dispatch to next highest etc, aborting when solved.
+            Fill up all free slots at once, rather than one query per call.
         */
-        q = m_queries_pending.takeFirst();
-        q->setLastPipelineWeight( 101 );
+        while ( m_qidsState.count() + dispatch.count() < m_maxConcurrent )
+        {
+            query_ptr q = takeNextPending();
+            if ( q.isNull() )
+                break;
+
+            q->setLastPipelineWeight( 101 );
+
+            QTime t;
+            t.start();
+            m_dispatched.insert( q->id(), t );
+
+            dispatch << q;
+        }
     }
 
-    if ( !q.isNull() )
-    {
+    // mark all of them in-flight before shunting, shunt() may re-enter us
+    foreach( const query_ptr& q, dispatch )
         incQIDState( q );
+
+    foreach( const query_ptr& q, dispatch )
         shunt( q ); // bump into next stage of pipeline (highest weights are 100)
+}
+
+
+query_ptr
+Pipeline::takeNextPending()
+{
+    // m_mut must be locked by the caller
+    while ( !m_queries_prioritized.isEmpty() )
+    {
+        query_ptr q = m_queries_prioritized.takeFirst();
+        if ( m_pending.remove( q->id() ) )
+            return q;
     }
+
+    while ( !m_queries_pending.isEmpty() )
+    {
+        query_ptr q = m_queries_pending.takeFirst();
+
+        // skip entries which got promoted or dispatched in the meantime
+        QHash< QID, bool >::iterator it = m_pending.find( q->id() );
+        if ( it == m_pending.end() || it.value() )
+            continue;
+
+        m_pending.erase( it );
+        return q;
+    }
+
+    return query_ptr();
+}
+
+
+void
+Pipeline::adjustConcurrency( int latency )
+{
+    // m_mut must be locked by the caller
+    if ( m_avgLatency == 0 )
+        m_avgLatency = latency;
+    else
+        m_avgLatency = ( m_avgLatency * 7 + latency ) / 8;
+
+    if ( m_avgLatency < TARGET_LATENCY && m_maxConcurrent < MAX_CONCURRENT_QUERIES )
+        m_maxConcurrent++;
+    else if ( m_avgLatency > TARGET_LATENCY * 2 && m_maxConcurrent > MIN_CONCURRENT_QUERIES )
+        m_maxConcurrent--;
 }
 
 
@@ -328,6 +455,8 @@ Pipeline::incQIDState( const Tomahawk::query_ptr& query )
     {
         state = m_qidsState.value( query->id() ) + 1;
     }
+    else
+        m_running.insert( query->id(), query );
 
     qDebug() << Q_FUNC_INFO << "inserting to qidsstate:" << query->id() << state;
     m_qidsState.insert( query->id(), state );
@@ -351,7 +480,43 @@ Pipeline::decQIDState( const Tomahawk::query_ptr& query )
     {
         qDebug() << Q_FUNC_INFO << "removing" << query->id() << state;
         m_qidsState.remove( query->id() );
+        m_running.remove( query->id() );
     }
 
     return state;
 }
+
+
+void
+Pipeline::checkPurge()
+{
+    // m_mut must be locked by the caller
+    if ( m_qids.count() + m_rids.count() > m_purgeThreshold )
+        purge();
+}
+
+
+void
+Pipeline::purge() const
+{
+    // m_mut must be locked by the caller
+    QHash< QID, QWeakPointer< Query > >::iterator qit = m_qids.begin();
+    while ( qit != m_qids.end() )
+    {
+        if ( qit.value().isNull() )
+            qit = m_qids.erase( qit );
+        else
+            ++qit;
+    }
+
+    QHash< RID, QWeakPointer< Result > >::iterator rit = m_rids.begin();
+    while ( rit != m_rids.end() )
+    {
+        if ( rit.value().isNull() )
+            rit = m_rids.erase( rit );
+        else
+            ++rit;
+    }
+
+    m_purgeThreshold = qMax( MIN_PURGE_THRESHOLD, 2 * ( m_qids.count() + m_rids.count() ) );
+}
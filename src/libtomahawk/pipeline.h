@@ -22,7 +22,9 @@
 #include <QObject>
 #include <QList>
 #include <QMap>
+#include <QHash>
 #include <QMutex>
+#include <QTime>
 
 #include "typedefs.h"
 #include "query.h"
@@ -53,15 +55,15 @@ public:
     void addResolver( Resolver* r, bool sort = true );
     void removeResolver( Resolver* r );
 
-    query_ptr query( const QID& qid ) const
-    {
-        return m_qids.value( qid );
-    }
+    query_ptr query( const QID& qid ) const;
+    result_ptr result( const RID& rid ) const;
 
-    result_ptr result( const RID& rid ) const
-    {
-        return m_rids.value( rid );
-    }
+    /// number of queries / results still alive and known to the pipeline
+    int queryCount() const;
+    int resultCount() const;
+
+    /// number of queries currently allowed to be in-flight
+    int concurrentQueries() const { return m_maxConcurrent; }
 
 public slots:
     void resolve( const query_ptr& q, bool prioritized = false );
@@ -82,16 +84,40 @@ private:
     int incQIDState( const Tomahawk::query_ptr& query );
     int decQIDState( const Tomahawk::query_ptr& query );
 
+    query_ptr takeNextPending();
+    void adjustConcurrency( int latency );
+    void purge() const;
+    void checkPurge();
+
     QList< Resolver* > m_resolvers;
 
     QMap< QID, unsigned int > m_qidsState;
-    QMap< QID, query_ptr > m_qids;
-    QMap< RID, result_ptr > m_rids;
-
-    QMutex m_mut; // for m_qids, m_rids
 
-    // store queries here until DB index is loaded, then shunt them all
+    // we only keep weak references to queries and results, so they get
+    // freed as soon as nobody else is interested in them anymore. queries
+    // are held strongly by m_running while resolvers are working on them.
+    // expired entries get purged once the maps doubled in size.
+    mutable QHash< QID, QWeakPointer< Query > > m_qids;
+    mutable QHash< RID, QWeakPointer< Result > > m_rids;
+    QHash< QID, query_ptr > m_running;
+    mutable int m_purgeThreshold;
+
+    mutable QMutex m_mut; // for m_qids, m_rids
+
+    // store queries here until DB index is loaded, then shunt them all.
+    // prioritized (user-visible) queries are always dispatched before
+    // background ones. m_pending tracks which lane currently owns a QID,
+    // so duplicate checks are O(1) and promoted entries left behind in
+    // the background lane are skipped lazily.
+    QList< query_ptr > m_queries_prioritized;
     QList< query_ptr > m_queries_pending;
+    QHash< QID, bool > m_pending;
+
+    // dispatch time of in-flight queries, used to adapt m_maxConcurrent
+    QHash< QID, QTime > m_dispatched;
+    int m_maxConcurrent;
+    int m_avgLatency;
+
     bool m_index_ready;
 
     static Pipeline* s_instance;
@@ -335,7 +335,8 @@ Playlist::setNewRevision( const QString& rev,
     qDebug() << Q_FUNC_INFO << rev << is_newest_rev << m_title << addedmap.count() << neworderedguids.count() << oldorderedguids.count();
     // build up correctly ordered new list of plentry_ptrs from
     // existing ones, and the ones that have been added
-    QMap<QString, plentry_ptr> entriesmap;
+    QHash<QString, plentry_ptr> entriesmap;
+    entriesmap.reserve( m_entries.count() );
     foreach( const plentry_ptr& p, m_entries )
         entriesmap.insert( p->guid(), p );
     
@@ -380,22 +381,20 @@ Playlist::setNewRevision( const QString& rev,
             // NB: entriesmap will contain old/removed entries only if the removal was done
             // in the same session - after a restart, history is not in memory.
             if( entriesmap.contains( remid ) )
-            {
                 pr.removed << entriesmap.value( remid );
-                if( is_newest_rev )
-                {
-                    //qDebug() << "Removing from m_entries" << remid;
-                    for( int k = 0 ; k < m_entries.length(); ++k )
-                    {
-                        if( m_entries.at( k )->guid() == remid )
-                        {
-                            //qDebug() << "removed at" << k;
-                            m_entries.removeAt( k );
-                            break;
-                        }
-                    }
-                }
+        }
+
+        // drop them from m_entries in a single pass, not one scan per removed entry
+        if( is_newest_rev && !pr.removed.isEmpty() )
+        {
+            QList<plentry_ptr> kept;
+            kept.reserve( m_entries.count() );
+            foreach( const plentry_ptr& p, m_entries )
+            {
+                if( !removedguids.contains( p->guid() ) )
+                    kept << p;
             }
+            m_entries = kept;
         }
         
         pr.added = addedmap.values();
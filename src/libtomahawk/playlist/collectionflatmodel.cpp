@@ -20,11 +20,15 @@
 
 #include <QDebug>
 #include <QMimeData>
+#include <QSet>
 #include <QTreeView>
 
 #include "database/database.h"
 #include "sourcelist.h"
 
+// rows are created this many at a time, when the view scrolls towards them
+#define FETCH_CHUNK 1000
+
 using namespace Tomahawk;
 
 
@@ -66,6 +70,8 @@ CollectionFlatModel::addCollection( const collection_ptr& collection, bool sendN
 
     connect( collection.data(), SIGNAL( tracksAdded( QList<Tomahawk::query_ptr> ) ),
                                   SLOT( onTracksAdded( QList<Tomahawk::query_ptr> ) ) );
+    connect( collection.data(), SIGNAL( tracksLoaded() ),
+                                  SLOT( onTracksLoaded() ) );
     connect( collection.data(), SIGNAL( tracksRemoved( QList<Tomahawk::query_ptr> ) ),
                                   SLOT( onTracksRemoved( QList<Tomahawk::query_ptr> ) ) );
 
@@ -102,8 +108,8 @@ CollectionFlatModel::addFilteredCollection( const collection_ptr& collection, un
     cmd->setSortOrder( order );
     cmd->setSortDescending( true );
 
-    connect( cmd, SIGNAL( tracks( QList<Tomahawk::query_ptr>, Tomahawk::collection_ptr ) ),
-                    SLOT( onTracksAdded( QList<Tomahawk::query_ptr>, Tomahawk::collection_ptr ) ), Qt::QueuedConnection );
+    connect( cmd, SIGNAL( tracks( QList<Tomahawk::query_ptr> ) ),
+                    SLOT( onTracksAdded( QList<Tomahawk::query_ptr> ) ), Qt::QueuedConnection );
 
     Database::instance()->enqueue( QSharedPointer<DatabaseCommand>( cmd ) );
 }
@@ -184,30 +190,58 @@ CollectionFlatModel::onTracksAdded( const QList<Tomahawk::query_ptr>& tracks )
 {
     qDebug() << Q_FUNC_INFO << tracks.count() << rowCount( QModelIndex() );
 
-    if( !m_loadingCollections.isEmpty() && sender() && qobject_cast< Collection* >( sender() ) )
-    {
-        // we are keeping track and are called as a slot
-        m_loadingCollections.removeAll( qobject_cast< Collection* >( sender() ) );
-    }
-
-    bool kickOff = m_tracksToAdd.isEmpty();
     m_tracksToAdd << tracks;
 
     emit trackCountChanged( trackCount() );
 
-    if ( m_tracksToAdd.count() && kickOff )
-        processTracksToAdd();
-    else if ( m_tracksToAdd.isEmpty() && m_loadingCollections.isEmpty() )
+    // enough rows to fill the view right away, the rest once it scrolls there
+    int c = rowCount( QModelIndex() );
+    if ( c < FETCH_CHUNK )
+        processTracksToAdd( FETCH_CHUNK - c );
+
+    // collections we wait for finish in onTracksLoaded, once their last page is in
+    if ( m_loadingCollections.isEmpty() )
         emit loadingFinished();
 }
 
 
 void
-CollectionFlatModel::processTracksToAdd()
+CollectionFlatModel::onTracksLoaded()
+{
+    Collection* collection = qobject_cast< Collection* >( sender() );
+    if ( !collection || !m_loadingCollections.contains( collection ) )
+        return;
+
+    m_loadingCollections.removeAll( collection );
+    if ( m_loadingCollections.isEmpty() )
+        emit loadingFinished();
+}
+
+
+bool
+CollectionFlatModel::canFetchMore( const QModelIndex& parent ) const
+{
+    return !parent.isValid() && !m_tracksToAdd.isEmpty();
+}
+
+
+void
+CollectionFlatModel::fetchMore( const QModelIndex& parent )
 {
-    int chunkSize = 5000;
-    int maxc = qMin( chunkSize, m_tracksToAdd.count() );
+    if ( parent.isValid() )
+        return;
+
+    processTracksToAdd( FETCH_CHUNK );
+}
+
+
+void
+CollectionFlatModel::processTracksToAdd( int count )
+{
+    int maxc = qMin( count, m_tracksToAdd.count() );
     int c = rowCount( QModelIndex() );
+    if ( maxc <= 0 )
+        return;
 
     emit beginInsertRows( QModelIndex(), c, c + maxc - 1 );
     //beginResetModel();
@@ -227,21 +261,32 @@ CollectionFlatModel::processTracksToAdd()
 
     m_tracksToAdd.erase( m_tracksToAdd.begin(), iter );
 
-    if ( m_tracksToAdd.isEmpty() && m_loadingCollections.isEmpty() )
-        emit loadingFinished();
-
     //endResetModel();
     emit endInsertRows();
     qDebug() << Q_FUNC_INFO << rowCount( QModelIndex() );
-
-    if ( m_tracksToAdd.count() )
-        QTimer::singleShot( 250, this, SLOT( processTracksToAdd() ) );
 }
 
 
 void
 CollectionFlatModel::onTracksRemoved( const QList<Tomahawk::query_ptr>& tracks )
 {
+    if ( !m_tracksToAdd.isEmpty() )
+    {
+        // tracks without a row yet are simply forgotten
+        QSet<Tomahawk::Query*> removed;
+        foreach ( const query_ptr& query, tracks )
+            removed << query.data();
+
+        QMutableListIterator<Tomahawk::query_ptr> it( m_tracksToAdd );
+        while ( it.hasNext() )
+        {
+            if ( removed.contains( it.next().data() ) )
+                it.remove();
+        }
+
+        emit trackCountChanged( trackCount() );
+    }
+
     QList<Tomahawk::query_ptr> t = tracks;
     for ( int i = rowCount( QModelIndex() ); i >= 0 && t.count(); i-- )
     {
@@ -56,6 +56,9 @@ public:
 
     virtual void append( const Tomahawk::query_ptr& query ) {}
 
+    virtual bool canFetchMore( const QModelIndex& parent ) const;
+    virtual void fetchMore( const QModelIndex& parent );
+
 signals:
     void repeatModeChanged( PlaylistInterface::RepeatMode mode );
     void shuffleModeChanged( bool enabled );
@@ -66,14 +69,16 @@ private slots:
     void onDataChanged();
 
     void onTracksAdded( const QList<Tomahawk::query_ptr>& tracks );
+    void onTracksLoaded();
     void onTracksRemoved( const QList<Tomahawk::query_ptr>& tracks );
 
     void onSourceOffline( const Tomahawk::source_ptr& src );
 
-    void processTracksToAdd();
-
 private:
+    void processTracksToAdd( int count );
+
     QMap< Tomahawk::collection_ptr, QPair< int, int > > m_collectionRows;
+    // tracks we know about, but haven't created rows for yet
     QList<Tomahawk::query_ptr> m_tracksToAdd;
     // just to keep track of what we are waiting to be loaded
     QList<Tomahawk::Collection*> m_loadingCollections;
@@ -19,6 +19,8 @@
 #include "plitem.h"
 
 #include "utils/tomahawkutils.h"
+#include "album.h"
+#include "artist.h"
 #include "playlist.h"
 #include "query.h"
 
@@ -99,6 +101,33 @@ PlItem::query() const
 }
 
 
+QString
+PlItem::searchKey() const
+{
+    const Tomahawk::query_ptr& q = query();
+    if ( q.isNull() )
+        return QString();
+
+    Tomahawk::result_ptr r;
+    if ( q->numResults() )
+        r = q->results().first();
+
+    if ( !m_searchKey.isNull() && m_searchKeyFromResult == !r.isNull() && m_searchKeyResult.data() == r.data() )
+        return m_searchKey;
+
+    // the separator never shows up in a filter token, so a token can't match across fields
+    if ( !r.isNull() )
+        m_searchKey = ( r->artist()->name() + '\n' + r->album()->name() + '\n' + r->track() ).toLower();
+    else
+        m_searchKey = ( q->artist() + '\n' + q->album() + '\n' + q->track() ).toLower();
+
+    m_searchKeyResult = r;
+    m_searchKeyFromResult = !r.isNull();
+
+    return m_searchKey;
+}
+
+
 void
 PlItem::setupItem( const Tomahawk::query_ptr& query, PlItem* parent, int row )
 {
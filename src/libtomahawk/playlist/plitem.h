@@ -21,6 +21,7 @@
 
 #include <QHash>
 #include <QVector>
+#include <QWeakPointer>
 #include <QPersistentModelIndex>
 #include <QAbstractItemModel>
 
@@ -47,6 +48,9 @@ public:
     bool isPlaying() { return m_isPlaying; }
     void setIsPlaying( bool b ) { m_isPlaying = b; emit dataChanged(); }
 
+    // lowercased artist, album and track, one per line - what filters match against
+    QString searchKey() const;
+
     PlItem* parent;
     QVector<PlItem*> children;
     QHash<QString, PlItem*> hash;
@@ -65,6 +69,11 @@ private:
     Tomahawk::plentry_ptr m_entry;
     Tomahawk::query_ptr m_query;
     bool m_isPlaying;
+
+    // built on first use, again only once the query's top result changes
+    mutable QString m_searchKey;
+    mutable QWeakPointer<Tomahawk::Result> m_searchKeyResult;
+    mutable bool m_searchKeyFromResult;
 };
 
 #endif // PLITEM_H
@@ -19,12 +19,73 @@
 #include "trackproxymodel.h"
 
 #include <QDebug>
+#include <QThread>
 #include <QTreeView>
+#include <QtConcurrentMap>
 
 #include "album.h"
 #include "query.h"
 #include "collectionmodel.h"
 
+// models with at least this many rows are filtered on worker threads,
+// while the view keeps showing the previous results
+#define PARALLEL_FILTER_ROWS 20000
+
+
+struct FilterEntry
+{
+    PlItem* item;
+    QString key;
+    bool candidate;
+};
+
+struct FilterChunk
+{
+    QVector<FilterEntry> entries;
+    QStringList tokens;
+};
+
+
+static bool
+keyMatches( const QString& key, const QStringList& tokens )
+{
+    foreach ( const QString& token, tokens )
+    {
+        if ( !key.contains( token ) )
+            return false;
+    }
+
+    return true;
+}
+
+
+// runs on worker threads: only touches the chunk, never the items themselves
+static TrackProxyModel::FilterMatches
+matchChunk( const FilterChunk& chunk )
+{
+    TrackProxyModel::FilterMatches matches;
+    matches.reserve( chunk.entries.count() );
+
+    foreach ( const FilterEntry& entry, chunk.entries )
+    {
+        TrackProxyModel::FilterMatch match;
+        match.key = entry.key;
+        match.accepted = entry.candidate && keyMatches( entry.key, chunk.tokens );
+        matches.insert( entry.item, match );
+    }
+
+    return matches;
+}
+
+
+static void
+mergeMatches( TrackProxyModel::FilterMatches& result, const TrackProxyModel::FilterMatches& part )
+{
+    TrackProxyModel::FilterMatches::const_iterator it = part.constBegin();
+    for ( ; it != part.constEnd(); ++it )
+        result.insert( it.key(), it.value() );
+}
+
 
 TrackProxyModel::TrackProxyModel( QObject* parent )
     : QSortFilterProxyModel( parent )
@@ -34,6 +95,8 @@ TrackProxyModel::TrackProxyModel( QObject* parent )
     , m_shuffled( false )
     , m_showOfflineResults( true )
 {
+    connect( &m_filterWatcher, SIGNAL( finished() ), SLOT( onFilterFinished() ) );
+
     qsrand( QTime( 0, 0, 0 ).secsTo( QTime::currentTime() ) );
 
     setFilterCaseSensitivity( Qt::CaseInsensitive );
@@ -48,6 +111,7 @@ void
 TrackProxyModel::setSourceModel( TrackModel* sourceModel )
 {
     m_model = sourceModel;
+    m_filterMatches.clear();
 
     if ( m_model )
         connect( m_model, SIGNAL( trackCountChanged( unsigned int ) ),
@@ -62,6 +126,88 @@ TrackProxyModel::setFilter( const QString& pattern )
 {
     qDebug() << Q_FUNC_INFO;
     PlaylistInterface::setFilter( pattern );
+
+    if ( m_filterWatcher.isRunning() )
+        m_filterWatcher.cancel();
+
+    const QStringList tokens = pattern.toLower().split( " ", QString::SkipEmptyParts );
+    if ( tokens.isEmpty() || !m_model )
+    {
+        applyFilter( pattern, tokens, FilterMatches() );
+        return;
+    }
+
+    // a search has to cover rows the source didn't create yet, too
+    fetchAll();
+
+    // typing on only narrows the results: what the last filter rejected stays rejected
+    const bool narrowing = !m_filterTokens.isEmpty() && pattern.startsWith( filterRegExp().pattern() );
+
+    const int rows = m_model->rowCount( QModelIndex() );
+    const bool parallel = rows >= PARALLEL_FILTER_ROWS;
+    const int perChunk = parallel ? rows / QThread::idealThreadCount() + 1 : rows;
+
+    QList<FilterChunk> chunks;
+    for ( int i = 0; i < rows; i++ )
+    {
+        PlItem* pi = itemFromIndex( m_model->index( i, 0, QModelIndex() ) );
+        if ( !pi )
+            continue;
+
+        if ( chunks.isEmpty() || chunks.last().entries.count() >= perChunk )
+        {
+            chunks << FilterChunk();
+            chunks.last().entries.reserve( perChunk );
+            chunks.last().tokens = tokens;
+        }
+
+        FilterEntry entry;
+        entry.item = pi;
+        entry.key = pi->searchKey();
+        entry.candidate = true;
+
+        // a rejection made for another key, e.g. before the query resolved, doesn't count
+        if ( narrowing )
+        {
+            FilterMatches::const_iterator it = m_filterMatches.constFind( pi );
+            if ( it != m_filterMatches.constEnd() && it->key == entry.key )
+                entry.candidate = it->accepted;
+        }
+
+        chunks.last().entries << entry;
+    }
+
+    if ( !parallel )
+    {
+        FilterMatches matches;
+        foreach ( const FilterChunk& chunk, chunks )
+            mergeMatches( matches, matchChunk( chunk ) );
+
+        applyFilter( pattern, tokens, matches );
+        return;
+    }
+
+    m_pendingFilter = pattern;
+    m_pendingTokens = tokens;
+    m_filterWatcher.setFuture( QtConcurrent::mappedReduced( chunks, matchChunk, mergeMatches ) );
+}
+
+
+void
+TrackProxyModel::onFilterFinished()
+{
+    if ( m_filterWatcher.isCanceled() )
+        return;
+
+    applyFilter( m_pendingFilter, m_pendingTokens, m_filterWatcher.result() );
+}
+
+
+void
+TrackProxyModel::applyFilter( const QString& pattern, const QStringList& tokens, const FilterMatches& matches )
+{
+    m_filterTokens = tokens;
+    m_filterMatches = matches;
     setFilterRegExp( pattern );
 
     emit filterChanged( pattern );
@@ -69,10 +215,34 @@ TrackProxyModel::setFilter( const QString& pattern )
 }
 
 
+void
+TrackProxyModel::sort( int column, Qt::SortOrder order )
+{
+    // sources that create their rows lazily deliver them by artist,
+    // any other order needs all of them in place
+    if ( column != TrackModel::Artist || order != Qt::AscendingOrder )
+        fetchAll();
+
+    QSortFilterProxyModel::sort( column, order );
+}
+
+
+void
+TrackProxyModel::fetchAll()
+{
+    if ( !m_model )
+        return;
+
+    while ( m_model->canFetchMore( QModelIndex() ) )
+        m_model->fetchMore( QModelIndex() );
+}
+
+
 QList< Tomahawk::query_ptr >
 TrackProxyModel::tracks()
 {
     QList<Tomahawk::query_ptr> queries;
+    fetchAll();
 
     for ( int i = 0; i < rowCount( QModelIndex() ); i++ )
     {
@@ -90,6 +260,12 @@ TrackProxyModel::siblingItem( int itemsAway )
 {
     qDebug() << Q_FUNC_INFO;
 
+    // pick from all tracks, or play on past the rows created so far
+    if ( m_shuffled )
+        fetchAll();
+    else if ( currentItem().isValid() && currentItem().row() + itemsAway >= rowCount() && canFetchMore( QModelIndex() ) )
+        fetchMore( QModelIndex() );
+
     QModelIndex idx = index( 0, 0 );
     if( rowCount() )
     {
@@ -171,34 +347,17 @@ TrackProxyModel::filterAcceptsRow( int sourceRow, const QModelIndex& sourceParen
     if ( !m_showOfflineResults && !r.isNull() && !r->collection()->source()->isOnline() )
         return false;
 
-    if ( filterRegExp().isEmpty() )
+    if ( m_filterTokens.isEmpty() )
         return true;
 
-    QStringList sl = filterRegExp().pattern().split( " ", QString::SkipEmptyParts );
-    foreach( QString s, sl )
-    {
-        s = s.toLower();
-        if ( !r.isNull() )
-        {
-            if ( !r->artist()->name().toLower().contains( s ) &&
-                 !r->album()->name().toLower().contains( s ) &&
-                 !r->track().toLower().contains( s ) )
-            {
-                return false;
-            }
-        }
-        else
-        {
-            if ( !q->artist().toLower().contains( s ) &&
-                 !q->album().toLower().contains( s ) &&
-                 !q->track().toLower().contains( s ) )
-            {
-                return false;
-            }
-        }
-    }
+    // rows that showed up after the last filter pass, or got another key
+    // since (e.g. their query resolved), are matched right here
+    const QString key = pi->searchKey();
+    FilterMatches::const_iterator it = m_filterMatches.constFind( pi );
+    if ( it != m_filterMatches.constEnd() && it->key == key )
+        return it->accepted;
 
-    return true;
+    return keyMatches( key, m_filterTokens );
 }
 
 
@@ -20,6 +20,9 @@
 #define TRACKPROXYMODEL_H
 
 #include <QSortFilterProxyModel>
+#include <QFutureWatcher>
+#include <QHash>
+#include <QStringList>
 
 #include "playlistinterface.h"
 #include "playlist/trackmodel.h"
@@ -31,6 +34,14 @@ class DLLEXPORT TrackProxyModel : public QSortFilterProxyModel, public PlaylistI
 Q_OBJECT
 
 public:
+    // a filter verdict on an item, and the search key it was made for
+    struct FilterMatch
+    {
+        QString key;
+        bool accepted;
+    };
+    typedef QHash<PlItem*, FilterMatch> FilterMatches;
+
     explicit TrackProxyModel ( QObject* parent = 0 );
 
     virtual TrackModel* sourceModel() const { return m_model; }
@@ -53,6 +64,8 @@ public:
     virtual QString filter() const { return filterRegExp().pattern(); }
     virtual void setFilter( const QString& pattern );
 
+    virtual void sort( int column, Qt::SortOrder order = Qt::AscendingOrder );
+
     virtual PlaylistInterface::RepeatMode repeatMode() const { return m_repeatMode; }
     virtual bool shuffled() const { return m_shuffled; }
 
@@ -77,11 +90,27 @@ public slots:
 protected:
     bool filterAcceptsRow( int sourceRow, const QModelIndex& sourceParent ) const;
 
+private slots:
+    void onFilterFinished();
+
 private:
+    void fetchAll();
+    void applyFilter( const QString& pattern, const QStringList& tokens, const FilterMatches& matches );
+
     TrackModel* m_model;
     RepeatMode m_repeatMode;
     bool m_shuffled;
     bool m_showOfflineResults;
+
+    // lowercased words of the applied filter, and which items it accepts.
+    // a verdict only holds while the item's search key is the one it was made for
+    QStringList m_filterTokens;
+    FilterMatches m_filterMatches;
+
+    // a filter being matched on worker threads, applied once it's done
+    QString m_pendingFilter;
+    QStringList m_pendingTokens;
+    QFutureWatcher< FilterMatches > m_filterWatcher;
 };
 
 #endif // TRACKPROXYMODEL_H
@@ -65,6 +65,8 @@ Query::addResults( const QList< Tomahawk::result_ptr >& newresults )
     {
 //        QMutexLocker lock( &m_mut );
         m_results.append( newresults );
+        foreach( const result_ptr& rp, newresults )
+            m_arrivals << rp.toWeakRef();
         qStableSort( m_results.begin(), m_results.end(), Query::resultSorter );
 
         // hook up signals, and check solved status
@@ -134,6 +136,28 @@ Query::numResults() const
 }
 
 
+QList< result_ptr >
+Query::resultsSince( unsigned int cursor ) const
+{
+    QList< result_ptr > res;
+    for ( int i = cursor; i < m_arrivals.count(); i++ )
+    {
+        result_ptr rp = m_arrivals.at( i ).toStrongRef();
+        if ( !rp.isNull() && m_results.contains( rp ) )
+            res << rp;
+    }
+
+    return res;
+}
+
+
+unsigned int
+Query::resultCursor() const
+{
+    return m_arrivals.count();
+}
+
+
 QID
 Query::id() const
 {
@@ -23,6 +23,7 @@
 #include <QMutex>
 #include <QList>
 #include <QVariant>
+#include <QWeakPointer>
 
 #include "result.h"
 #include "typedefs.h"
@@ -54,6 +55,12 @@ public:
     /// how many results found so far?
     unsigned int numResults() const;
 
+    /// results still around that were added at or after cursor, in the order they were added.
+    /// cursors count every result ever added, so re-sorting or removing results doesn't move them
+    QList< result_ptr > resultsSince( unsigned int cursor ) const;
+    /// cursor just past the last result added so far
+    unsigned int resultCursor() const;
+
     QID id() const;
 
     /// sorter for list of results
@@ -106,6 +113,8 @@ private:
     void checkResults();
 
     QList< Tomahawk::result_ptr > m_results;
+    // every result ever added, in the order they were added
+    QList< QWeakPointer< Tomahawk::Result > > m_arrivals;
     bool m_solved;
     bool m_playable;
     mutable QID m_qid;
@@ -89,6 +89,49 @@ TomahawkSettings::hasScannerPath() const
     return contains( "scannerpath" );
 }
 
+
+int
+TomahawkSettings::scannerThreads() const
+{
+    return value( "scanner/threads", 0 ).toInt();
+}
+
+
+void
+TomahawkSettings::setScannerThreads( int threads )
+{
+    setValue( "scanner/threads", threads );
+}
+
+
+bool
+TomahawkSettings::scannerNetworkStorage() const
+{
+    return value( "scanner/networkstorage", false ).toBool();
+}
+
+
+void
+TomahawkSettings::setScannerNetworkStorage( bool network )
+{
+    setValue( "scanner/networkstorage", network );
+}
+
+
+int
+TomahawkSettings::audioPreloadSeconds() const
+{
+    return value( "audio/preloadseconds", 10 ).toInt();
+}
+
+
+void
+TomahawkSettings::setAudioPreloadSeconds( int seconds )
+{
+    setValue( "audio/preloadseconds", seconds );
+}
+
+
 void
 TomahawkSettings::setAcceptedLegalWarning( bool accept )
 {
@@ -44,6 +44,15 @@ public:
     QStringList scannerPath() const; /// QDesktopServices::MusicLocation by default
     void setScannerPath( const QStringList& path );
     bool hasScannerPath() const;
+
+    int scannerThreads() const; /// parallel tag readers, 0 (default) picks a number for the storage
+    void setScannerThreads( int threads );
+
+    bool scannerNetworkStorage() const; /// collection on a NAS etc, so reading tags waits on I/O more than CPU
+    void setScannerNetworkStorage( bool network );
+
+    int audioPreloadSeconds() const; /// how long before a track ends the next one gets opened, 10 by default
+    void setAudioPreloadSeconds( int seconds );
     
     bool acceptedLegalWarning() const;
     void setAcceptedLegalWarning( bool accept );
@@ -18,16 +18,70 @@
 
 #include "musicscanner.h"
 
+#include <QRunnable>
+
+#include <taglib.h>
+
 #include "tomahawk/tomahawkapp.h"
+#include "tomahawksettings.h"
 #include "sourcelist.h"
 #include "database/database.h"
 #include "database/databasecommand_dirmtimes.h"
 #include "database/databasecommand_addfiles.h"
 #include "database/databasecommand_deletefiles.h"
 
+// files handed to a tag reader at once
+#define SCAN_CHUNK_FILES 32
+// chunks listed ahead of the last one we took results from, per reader
+#define CHUNKS_PER_READER 4
+// readers per core for collections on network storage, where they mostly wait for I/O
+#define NETWORK_READERS_PER_CORE 4
+#define MAX_READERS 32
+
+// TagLib only counts its references atomically since 1.8, older versions get one reader
+#if TAGLIB_MAJOR_VERSION > 1 || ( TAGLIB_MAJOR_VERSION == 1 && TAGLIB_MINOR_VERSION >= 8 )
+#define TAGLIB_THREADSAFE_REFS
+#endif
+
 using namespace Tomahawk;
 
 
+// reads the tags of a chunk of files on one of the scanner's readers
+class TagReaderJob : public QRunnable
+{
+public:
+    TagReaderJob( MusicScanner* scanner, int seq, const QFileInfoList& files, const QStringList& mimetypes )
+        : m_scanner( scanner ), m_seq( seq ), m_files( files ), m_mimetypes( mimetypes ) {}
+
+    virtual void run()
+    {
+        QThread::currentThread()->setPriority( QThread::IdlePriority );
+
+        QVariantList scanned;
+        QStringList skipped;
+        for ( int i = 0; i < m_files.count(); i++ )
+        {
+            const QVariantMap m = MusicScanner::readFile( m_files.at( i ), m_mimetypes.at( i ) );
+            if ( m.isEmpty() )
+                skipped << m_files.at( i ).absoluteFilePath();
+            else
+                scanned << m;
+        }
+
+        QMetaObject::invokeMethod( m_scanner, "chunkScanned", Qt::QueuedConnection,
+                                   Q_ARG( int, m_seq ),
+                                   Q_ARG( QVariantList, scanned ),
+                                   Q_ARG( QStringList, skipped ) );
+    }
+
+private:
+    MusicScanner* m_scanner;
+    int m_seq;
+    QFileInfoList m_files;
+    QStringList m_mimetypes;
+};
+
+
 void
 DirLister::go()
 {
@@ -39,6 +93,9 @@ DirLister::go()
 void
 DirLister::scanDir( QDir dir, int depth )
 {
+    if ( m_aborted )
+        return;
+
     QFileInfoList dirs;
     const uint mtime = QFileInfo( dir.absolutePath() ).lastModified().toUTC().toTime_t();
     m_newdirmtimes.insert( dir.absolutePath(), mtime );
@@ -55,9 +112,13 @@ DirLister::scanDir( QDir dir, int depth )
         dir.setFilter( QDir::Files | QDir::Readable | QDir::NoDotAndDotDot );
         dir.setSorting( QDir::Name );
         dirs = dir.entryInfoList();
-        foreach( const QFileInfo& di, dirs )
+        for ( int i = 0; i < dirs.count(); i += SCAN_CHUNK_FILES )
         {
-            emit fileToScan( di );
+            m_chunkSlots->acquire();
+            if ( m_aborted )
+                return;
+
+            emit filesToScan( dirs.mid( i, SCAN_CHUNK_FILES ) );
         }
     }
     dir.setFilter( QDir::Dirs | QDir::Readable | QDir::NoDotAndDotDot );
@@ -76,6 +137,9 @@ MusicScanner::MusicScanner( const QStringList& dirs, quint32 bs )
     , m_batchsize( bs )
     , m_dirLister( 0 )
     , m_dirListerThreadController( 0 )
+    , m_nextChunk( 0 )
+    , m_flushedChunks( 0 )
+    , m_listerDone( false )
 {
     m_ext2mime.insert( "mp3", TomahawkUtils::extensionToMimetype( "mp3" ) );
 
@@ -85,6 +149,24 @@ MusicScanner::MusicScanner( const QStringList& dirs, quint32 bs )
 #ifndef NO_FLAC
     m_ext2mime.insert( "flac", TomahawkUtils::extensionToMimetype( "flac" ) );
 #endif
+
+    // reading tags from local disks is mostly CPU bound, from network storage mostly latency bound
+    int readers = TomahawkSettings::instance()->scannerThreads();
+    if ( readers <= 0 )
+    {
+        readers = QThread::idealThreadCount();
+        if ( TomahawkSettings::instance()->scannerNetworkStorage() )
+            readers *= NETWORK_READERS_PER_CORE;
+    }
+    readers = qBound( 1, readers, MAX_READERS );
+#ifndef TAGLIB_THREADSAFE_REFS
+    readers = 1;
+#endif
+
+    m_readers.setMaxThreadCount( readers );
+    m_maxChunks = readers * CHUNKS_PER_READER;
+    m_chunkSlots.release( m_maxChunks );
+    qDebug() << Q_FUNC_INFO << "Reading tags with" << readers << "threads";
 }
 
 
@@ -92,6 +174,12 @@ MusicScanner::~MusicScanner()
 {
     qDebug() << Q_FUNC_INFO;
 
+    // the lister may be waiting for a chunk slot, and readers still report back to us
+    if( m_dirLister )
+        m_dirLister->abort();
+    m_chunkSlots.release( m_maxChunks );
+    m_readers.waitForDone();
+
     if( m_dirListerThreadController )
     {
         m_dirListerThreadController->quit();
@@ -120,6 +208,9 @@ MusicScanner::startScan()
     qDebug() << "Loading mtimes...";
     m_scanned = m_skipped = 0;
     m_skippedFiles.clear();
+    m_nextChunk = m_flushedChunks = 0;
+    m_doneChunks.clear();
+    m_listerDone = false;
 
     // trigger the scan once we've loaded old mtimes for dirs below our path
     //FIXME: MULTIPLECOLLECTIONDIRS
@@ -151,11 +242,11 @@ MusicScanner::scan()
     m_dirListerThreadController = new QThread( this );
     
     //FIXME: MULTIPLECOLLECTIONDIRS
-    m_dirLister = new DirLister( QDir( m_dirs.first(), 0 ), m_dirmtimes );
+    m_dirLister = new DirLister( QDir( m_dirs.first(), 0 ), m_dirmtimes, &m_chunkSlots );
     m_dirLister->moveToThread( m_dirListerThreadController );
 
-    connect( m_dirLister, SIGNAL( fileToScan( QFileInfo ) ),
-                            SLOT( scanFile( QFileInfo ) ), Qt::QueuedConnection );
+    connect( m_dirLister, SIGNAL( filesToScan( QFileInfoList ) ),
+                            SLOT( scanFiles( QFileInfoList ) ), Qt::QueuedConnection );
 
     // queued, so will only fire after all dirs have been scanned:
     connect( m_dirLister, SIGNAL( finished( QMap<QString, unsigned int> ) ),
@@ -171,6 +262,20 @@ MusicScanner::listerFinished( const QMap<QString, unsigned int>& newmtimes )
 {
     qDebug() << Q_FUNC_INFO;
 
+    // the readers may still be busy with the last chunks
+    m_listerDone = true;
+    m_listedMtimes = newmtimes;
+    if ( m_flushedChunks == m_nextChunk )
+        finishScan();
+}
+
+
+void
+MusicScanner::finishScan()
+{
+    qDebug() << Q_FUNC_INFO;
+    const QMap<QString, unsigned int>& newmtimes = m_listedMtimes;
+
     // any remaining stuff that wasnt emitted as a batch:
     if( m_scannedfiles.length() )
     {
@@ -181,7 +286,7 @@ MusicScanner::listerFinished( const QMap<QString, unsigned int>& newmtimes )
     // remove obsolete / stale files
     foreach ( const QString& path, m_dirmtimes.keys() )
     {
-        if ( !newmtimes.keys().contains( path ) )
+        if ( !newmtimes.contains( path ) )
         {
             qDebug() << "Removing stale dir:" << path;
             Database::instance()->enqueue( QSharedPointer<DatabaseCommand>( new DatabaseCommand_DeleteFiles( path, SourceList::instance()->getLocal() ) ) );
@@ -245,40 +350,75 @@ MusicScanner::commitBatch( const QVariantList& tracks )
 }
 
 
+/// hands the audio files of a listed chunk to the readers
 void
-MusicScanner::scanFile( const QFileInfo& fi )
+MusicScanner::scanFiles( const QFileInfoList& files )
 {
-    QVariant m = readFile( fi );
-    if ( m.toMap().isEmpty() )
-        return;
+    const int seq = m_nextChunk++;
 
-    m_scannedfiles << m;
-    if ( m_batchsize != 0 && (quint32)m_scannedfiles.length() >= m_batchsize )
+    QFileInfoList audio;
+    QStringList mimetypes;
+    foreach( const QFileInfo& fi, files )
     {
-        qDebug() << "batchReady, size:" << m_scannedfiles.length();
-        emit batchReady( m_scannedfiles );
-        m_scannedfiles.clear();
+        const QString suffix = fi.suffix().toLower();
+        if ( !m_ext2mime.contains( suffix ) )
+        {
+            m_skipped++; // invalid extension
+            continue;
+        }
+
+        audio << fi;
+        mimetypes << m_ext2mime.value( suffix );
     }
+
+    if ( audio.isEmpty() )
+        chunkScanned( seq, QVariantList(), QStringList() );
+    else
+        m_readers.start( new TagReaderJob( this, seq, audio, mimetypes ) );
 }
 
 
-QVariant
-MusicScanner::readFile( const QFileInfo& fi )
+/// takes the results of chunks in listing order, so batches go to the db in that order too
+void
+MusicScanner::chunkScanned( int seq, const QVariantList& files, const QStringList& skipped )
 {
-    const QString suffix = fi.suffix().toLower();
+    m_doneChunks.insert( seq, qMakePair( files, skipped ) );
+    if ( !m_doneChunks.contains( m_flushedChunks ) )
+        return;
 
-    if ( ! m_ext2mime.contains( suffix ) )
+    while ( m_doneChunks.contains( m_flushedChunks ) )
     {
-        m_skipped++;
-        return QVariantMap(); // invalid extension
+        const QPair< QVariantList, QStringList > chunk = m_doneChunks.take( m_flushedChunks++ );
+        m_chunkSlots.release();
+
+        m_scanned += chunk.first.count();
+        m_skipped += chunk.second.count();
+        m_skippedFiles << chunk.second;
+
+        foreach( const QVariant& m, chunk.first )
+        {
+            m_scannedfiles << m;
+            if ( m_batchsize != 0 && (quint32)m_scannedfiles.length() >= m_batchsize )
+            {
+                qDebug() << "batchReady, size:" << m_scannedfiles.length();
+                emit batchReady( m_scannedfiles );
+                m_scannedfiles.clear();
+            }
+        }
     }
 
     if ( m_scanned )
-        if( m_scanned % 3 == 0 )
-            SourceList::instance()->getLocal()->scanningProgress( m_scanned );
-    if( m_scanned % 100 == 0 )
-        qDebug() << "SCAN" << m_scanned << fi.absoluteFilePath();
+        SourceList::instance()->getLocal()->scanningProgress( m_scanned );
+    qDebug() << "SCAN" << m_scanned << "files, skipped" << m_skipped;
+
+    if ( m_listerDone && m_flushedChunks == m_nextChunk )
+        finishScan();
+}
 
+
+QVariantMap
+MusicScanner::readFile( const QFileInfo& fi, const QString& mimetype )
+{
     #ifdef COMPLEX_TAGLIB_FILENAME
         const wchar_t *encodedName = reinterpret_cast< const wchar_t * >( fi.absoluteFilePath().utf16() );
     #else
@@ -290,8 +430,6 @@ MusicScanner::readFile( const QFileInfo& fi )
     if ( f.isNull() || !f.tag() )
     {
         // qDebug() << "Doesn't seem to be a valid audiofile:" << fi.absoluteFilePath();
-        m_skippedFiles << fi.absoluteFilePath();
-        m_skipped++;
         return QVariantMap();
     }
 
@@ -312,12 +450,9 @@ MusicScanner::readFile( const QFileInfo& fi )
     {
         // FIXME: do some clever filename guessing
         // qDebug() << "No tags found, skipping" << fi.absoluteFilePath();
-        m_skippedFiles << fi.absoluteFilePath();
-        m_skipped++;
         return QVariantMap();
     }
 
-    QString mimetype = m_ext2mime.value( suffix );
     QString url( "file://%1" );
 
     QVariantMap m;
@@ -334,6 +469,5 @@ MusicScanner::readFile( const QFileInfo& fi )
     m["year"]         = tag->year();
     m["hash"]         = ""; // TODO
     
-    m_scanned++;
     return m;
 }
@@ -30,17 +30,21 @@
 #include <QDebug>
 #include <QDateTime>
 #include <QTimer>
+#include <QAtomicInt>
+#include <QSemaphore>
+#include <QThreadPool>
 
 // descend dir tree comparing dir mtimes to last known mtime
-// emit signal for any dir with new content, so we can scan it.
+// emit the files of any dir with new content in chunks, so we can scan them.
+// each chunk takes one of the scanner's slots, so listing can't run away from tag reading.
 // finally, emit the list of new mtimes we observed.
 class DirLister : public QObject
 {
 Q_OBJECT
 
 public:
-    DirLister( QDir d, QMap<QString, unsigned int>& mtimes )
-        : QObject(), m_dir( d ), m_dirmtimes( mtimes )
+    DirLister( QDir d, QMap<QString, unsigned int>& mtimes, QSemaphore* chunkSlots )
+        : QObject(), m_dir( d ), m_dirmtimes( mtimes ), m_chunkSlots( chunkSlots )
     {
         qDebug() << Q_FUNC_INFO;
     }
@@ -50,8 +54,12 @@ public:
         qDebug() << Q_FUNC_INFO;
     }
 
+    /// stop listing, callable from any thread. doesn't wake a lister waiting for a chunk slot,
+    /// the scanner releases all of them before waiting for its readers.
+    void abort() { m_aborted.fetchAndStoreRelease( 1 ); }
+
 signals:
-    void fileToScan( QFileInfo );
+    void filesToScan( const QFileInfoList& );
     void finished( const QMap<QString, unsigned int>& );
 
 private slots:
@@ -62,6 +70,9 @@ private:
     QDir m_dir;
     QMap<QString, unsigned int> m_dirmtimes;
     QMap<QString, unsigned int> m_newdirmtimes;
+
+    QSemaphore* m_chunkSlots;
+    QAtomicInt m_aborted;
 };
 
 class MusicScanner : public QObject
@@ -72,26 +83,29 @@ public:
     MusicScanner( const QStringList& dirs, quint32 bs = 0 );
     ~MusicScanner();
 
+    /// tags etc of an audio file, empty if there are none we can use. safe to call from any thread.
+    static QVariantMap readFile( const QFileInfo& fi, const QString& mimetype );
+
 signals:
     //void fileScanned( QVariantMap );
     void finished();
     void batchReady( const QVariantList& );
 
-private:
-    QVariant readFile( const QFileInfo& fi );
-
 private slots:
     void listerFinished( const QMap<QString, unsigned int>& newmtimes );
     void deleteLister();
     void listerQuit();
     void listerDestroyed( QObject* dirLister );
-    void scanFile( const QFileInfo& fi );
+    void scanFiles( const QFileInfoList& files );
+    void chunkScanned( int seq, const QVariantList& files, const QStringList& skipped );
     void startScan();
     void scan();
     void setMtimes( const QMap<QString, unsigned int>& m );
     void commitBatch( const QVariantList& );
 
 private:
+    void finishScan();
+
     QStringList m_dirs;
     QMap<QString, QString> m_ext2mime; // eg: mp3 -> audio/mpeg
     unsigned int m_scanned;
@@ -107,6 +121,17 @@ private:
 
     DirLister* m_dirLister;
     QThread* m_dirListerThreadController;
+
+    // tag reading: chunks of files go to a pool of readers, their results are
+    // taken back in the order they were listed in
+    QThreadPool m_readers;
+    QSemaphore m_chunkSlots;
+    int m_maxChunks;
+    int m_nextChunk, m_flushedChunks;
+    QMap< int, QPair< QVariantList, QStringList > > m_doneChunks;
+
+    bool m_listerDone;
+    QMap<QString, unsigned int> m_listedMtimes;
 };
 
 #endif
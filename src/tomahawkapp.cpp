@@ -36,6 +36,7 @@
 #include "database/database.h"
 #include "database/databasecollection.h"
 #include "database/databasecommand_collectionstats.h"
+#include "database/databasecommand_compactoplog.h"
 #include "database/databaseresolver.h"
 #include "sip/SipHandler.h"
 #include "playlist/dynamic/GeneratorFactory.h"
@@ -339,6 +340,7 @@ TomahawkApp::registerMetaTypes()
     qRegisterMetaType< QTcpSocket* >("QTcpSocket*");
     qRegisterMetaType< QSharedPointer<QIODevice> >("QSharedPointer<QIODevice>");
     qRegisterMetaType< QFileInfo >("QFileInfo");
+    qRegisterMetaType< QFileInfoList >("QFileInfoList");
     qRegisterMetaType< QHostAddress >("QHostAddress");
     qRegisterMetaType< QMap<QString, unsigned int> >("QMap<QString, unsigned int>");
     qRegisterMetaType< QMap< QString, plentry_ptr > >("QMap< QString, plentry_ptr >");
@@ -457,6 +459,9 @@ TomahawkApp::initLocalCollection()
     SourceList::instance()->setLocal( src );
 //    src->collection()->tracks();
 
+    // shrink our oplog before any peer starts syncing from it
+    Database::instance()->enqueue( QSharedPointer<DatabaseCommand>( new DatabaseCommand_CompactOplog() ) );
+
     // to make the stats signal be emitted by our local source
     // this will update the sidebar, etc.
     DatabaseCommand_CollectionStats* cmd = new DatabaseCommand_CollectionStats( src );
@@ -20,6 +20,33 @@
 
 #include <QHash>
 
+#include "rangeiodevice.h"
+
+// how many resolved queries we keep around for get_results
+#define MAX_QUERIES 1000
+// most queries a single resolve_batch call may carry
+#define MAX_BATCH 500
+// longest a get_results call may be held open, and how often we check
+#define MAX_WAIT 30000
+#define WAIT_CHECK_INTERVAL 250
+
+
+Api_v1::Api_v1( QxtAbstractWebSessionManager* sm, QObject* parent )
+    : QxtWebSlotService( sm, parent )
+{
+    m_waitTimer.setInterval( WAIT_CHECK_INTERVAL );
+    connect( &m_waitTimer, SIGNAL( timeout() ), SLOT( onWaitTimeout() ) );
+}
+
+
+Api_v1::~Api_v1()
+{
+    qDeleteAll( m_statRequests );
+    foreach ( const Waiter& w, m_waiters )
+        delete w.event;
+}
+
+
 void
 Api_v1::auth_1( QxtWebRequestEvent* event, QString arg )
 {
@@ -133,8 +160,9 @@ Api_v1::api( QxtWebRequestEvent* event )
         const QString method = url.queryItemValue( "method" );
 
         if( method == "stat" )        return stat( event );
-        if( method == "resolve" )     return resolve( event );
-        if( method == "get_results" ) return get_results( event );
+        if( method == "resolve" )       return resolve( event );
+        if( method == "resolve_batch" ) return resolve_batch( event );
+        if( method == "get_results" )   return get_results( event );
     }
 
     send404( event );
@@ -155,20 +183,115 @@ Api_v1::sid( QxtWebRequestEvent* event, QString unused )
         return send404( event );
     }
 
+    QString range;
+    QMultiHash<QString, QString>::const_iterator it = event->headers.constBegin();
+    for ( ; it != event->headers.constEnd(); ++it )
+    {
+        if ( it.key().toLower() == "range" )
+            range = it.value();
+    }
+
+    const qint64 size = rp->size();
+    qint64 start = 0, end = size - 1;
+    const bool partial = !range.isEmpty() && size > 0 && parseRange( range, size, &start, &end );
+    if ( !range.isEmpty() && size > 0 && !partial && start >= size )
+    {
+        QxtWebPageEvent* e = new QxtWebPageEvent( event->sessionID, event->requestID, QByteArray() );
+        e->status = 416;
+        e->statusMessage = "Requested Range Not Satisfiable";
+        e->headers.insert( "Content-Range", QString( "bytes */%1" ).arg( size ) );
+        postEvent( e );
+        return;
+    }
+
     QSharedPointer<QIODevice> iodev = Servent::instance()->getIODeviceForUrl( rp );
     if( iodev.isNull() )
     {
         return send404( event ); // 503?
     }
 
+    // local files are seeked directly, remote ones request the blocks from the peer.
+    // plain http results can't seek, they are always sent whole
+    const bool seekable = !iodev->isSequential();
+    if ( partial && seekable )
+    {
+        qDebug() << "Range request for sid" << rid << start << end;
+        iodev = QSharedPointer<QIODevice>( new RangeIODevice( iodev, start, end - start + 1 ) );
+    }
+    else
+    {
+        start = 0;
+        end = size - 1;
+    }
+
     QxtWebPageEvent* e = new QxtWebPageEvent( event->sessionID, event->requestID, iodev );
-    e->streaming = iodev->isSequential();
+    e->streaming = !seekable;
     e->contentType = rp->mimetype().toAscii();
-    e->headers.insert( "Content-Length", QString::number( rp->size() ) );
+    if ( seekable )
+        e->headers.insert( "Accept-Ranges", "bytes" );
+    e->headers.insert( "Content-Length", QString::number( end - start + 1 ) );
+    if ( partial && seekable )
+    {
+        e->status = 206;
+        e->statusMessage = "Partial Content";
+        e->headers.insert( "Content-Range", QString( "bytes %1-%2/%3" ).arg( start ).arg( end ).arg( size ) );
+    }
     postEvent( e );
 }
 
 
+bool
+Api_v1::parseRange( const QString& header, qint64 size, qint64* start, qint64* end )
+{
+    // only a single range is supported, anything else gets the whole file
+    QString spec = header.trimmed();
+    if ( !spec.startsWith( "bytes=" ) || spec.contains( ',' ) )
+        return false;
+
+    spec = spec.mid( 6 ).trimmed();
+    const int dash = spec.indexOf( '-' );
+    if ( dash < 0 )
+        return false;
+
+    bool ok = true;
+    const QString first = spec.left( dash ).trimmed();
+    const QString last = spec.mid( dash + 1 ).trimmed();
+
+    if ( first.isEmpty() )
+    {
+        // "bytes=-N": the last N bytes
+        const qint64 suffix = last.toLongLong( &ok );
+        if ( !ok || suffix <= 0 )
+            return false;
+
+        *start = qMax( (qint64)0, size - suffix );
+        *end = size - 1;
+        return true;
+    }
+
+    *start = first.toLongLong( &ok );
+    if ( !ok || *start < 0 )
+    {
+        *start = 0;
+        return false;
+    }
+
+    *end = size - 1;
+    if ( !last.isEmpty() )
+    {
+        *end = qMin( last.toLongLong( &ok ), size - 1 );
+        if ( !ok || *end < *start )
+        {
+            *start = 0;
+            *end = size - 1;
+            return false;
+        }
+    }
+
+    return *start < size;
+}
+
+
 void
 Api_v1::send404( QxtWebRequestEvent* event )
 {
@@ -184,36 +307,52 @@ void
 Api_v1::stat( QxtWebRequestEvent* event )
 {
     qDebug() << "Got Stat request:" << event->url.toString();
-    m_storedEvent = event;
 
     if( !event->content.isNull() )
         qDebug() << "BODY:" << event->content->readAll();
 
     if( event->url.hasQueryItem( "auth" ) )
     {
-        // check for auth status
-        DatabaseCommand_ClientAuthValid* dbcmd = new DatabaseCommand_ClientAuthValid( event->url.queryItemValue( "auth" ) );
+        // check for auth status, the answer comes back for the token
+        const QString token = event->url.queryItemValue( "auth" );
+        const bool checking = m_statRequests.contains( token );
+        m_statRequests.insert( token, detachRequest( event ) );
+        if ( checking )
+            return;
+
+        DatabaseCommand_ClientAuthValid* dbcmd = new DatabaseCommand_ClientAuthValid( token );
         connect( dbcmd, SIGNAL( authValid( QString, QString, bool ) ), this, SLOT( statResult( QString, QString, bool ) ) );
         Database::instance()->enqueue( QSharedPointer<DatabaseCommand>(dbcmd) );
     }
     else
     {
-        statResult( QString(), QString(), false );
+        sendStat( event, false );
     }
 }
 
 
 void
 Api_v1::statResult( const QString& clientToken, const QString& name, bool valid )
+{
+    foreach ( QxtWebRequestEvent* event, m_statRequests.values( clientToken ) )
+    {
+        sendStat( event, valid );
+        delete event;
+    }
+
+    m_statRequests.remove( clientToken );
+}
+
+
+void
+Api_v1::sendStat( QxtWebRequestEvent* event, bool valid )
 {
     QVariantMap m;
     m.insert( "name", "playdar" );
     m.insert( "version", "0.1.1" ); // TODO (needs to be >=0.1.1 for JS to work)
     m.insert( "authenticated", valid ); // TODO
     m.insert( "capabilities", QVariantList() );
-    sendJSON( m, m_storedEvent );
-
-    m_storedEvent = 0;
+    sendJSON( m, event );
 }
 
 
@@ -225,6 +364,7 @@ Api_v1::resolve( QxtWebRequestEvent* event )
     {
         qDebug() << "Malformed HTTP resolve request";
         send404( event );
+        return;
     }
 
     QString qid;
@@ -234,6 +374,7 @@ Api_v1::resolve( QxtWebRequestEvent* event )
         qid = uuid();
 
     Tomahawk::query_ptr qry = Tomahawk::Query::get( event->url.queryItemValue( "artist" ), event->url.queryItemValue( "track" ), event->url.queryItemValue( "album" ), qid );
+    keepQuery( qry );
 
     QVariantMap r;
     r.insert( "qid", qid );
@@ -241,6 +382,60 @@ Api_v1::resolve( QxtWebRequestEvent* event )
 }
 
 
+// many resolves in one call: a JSON list of {artist, track, album, qid} objects, either in
+// the "queries" parameter or as the request body. Answers with their qids, in the same order
+void
+Api_v1::resolve_batch( QxtWebRequestEvent* event )
+{
+    QByteArray json;
+    if ( event->url.hasQueryItem( "queries" ) )
+        json = event->url.queryItemValue( "queries" ).toUtf8();
+    else if ( !event->content.isNull() )
+        json = event->content->readAll();
+
+    QJson::Parser parser;
+    bool ok;
+    const QVariantList queries = parser.parse( json, &ok ).toList();
+    if ( !ok || queries.isEmpty() || queries.count() > MAX_BATCH )
+    {
+        qDebug() << "Malformed HTTP resolve_batch request";
+        send404( event );
+        return;
+    }
+
+    QVariantList qids;
+    foreach ( const QVariant& q, queries )
+    {
+        const QVariantMap m = q.toMap();
+        if ( m.value( "artist" ).toString().isEmpty() || m.value( "track" ).toString().isEmpty() )
+        {
+            qids << QVariant();
+            continue;
+        }
+
+        QString qid = m.value( "qid" ).toString();
+        if ( qid.isEmpty() )
+            qid = uuid();
+
+        keepQuery( Tomahawk::Query::get( m.value( "artist" ).toString(), m.value( "track" ).toString(), m.value( "album" ).toString(), qid ) );
+        qids << qid;
+    }
+
+    QVariantMap r;
+    r.insert( "qids", qids );
+    sendJSON( r, event );
+}
+
+
+void
+Api_v1::keepQuery( const Tomahawk::query_ptr& qry )
+{
+    m_queries.enqueue( qry );
+    if ( m_queries.count() > MAX_QUERIES )
+        m_queries.dequeue();
+}
+
+
 void
 Api_v1::staticdata( QxtWebRequestEvent* event, const QString& str )
 {
@@ -264,6 +459,7 @@ Api_v1::get_results( QxtWebRequestEvent* event )
     {
         qDebug() << "Malformed HTTP get_results request";
         send404(event);
+        return;
     }
 
     using namespace Tomahawk;
@@ -274,6 +470,118 @@ Api_v1::get_results( QxtWebRequestEvent* event )
         return;
     }
 
+    // "since": only send the results found after the ones the client already has, i.e. the
+    //          "next" of its last answer. results are re-ranked as they come in, so this is
+    //          a cursor into the order they were found in, not an index into "results"
+    // "wait": if there are none yet, hold the request up to that many ms until there are
+    const int since = qMax( 0, event->url.queryItemValue( "since" ).toInt() );
+    const int wait = qBound( 0, event->url.queryItemValue( "wait" ).toInt(), MAX_WAIT );
+
+    if ( wait > 0 && !qry->solved() && qry->resultsSince( since ).isEmpty() )
+    {
+        Waiter w;
+        w.event = detachRequest( event );
+        w.query = qry;
+        w.since = since;
+        w.timeout = wait;
+        w.started.start();
+        m_waiters << w;
+
+        connect( qry.data(), SIGNAL( resultsAdded( QList<Tomahawk::result_ptr> ) ), SLOT( onQueryResults() ), Qt::UniqueConnection );
+        connect( qry.data(), SIGNAL( resolvingFinished( bool ) ), SLOT( onQueryResolved() ), Qt::UniqueConnection );
+
+        if ( !m_waitTimer.isActive() )
+            m_waitTimer.start();
+
+        return;
+    }
+
+    sendResults( qry, event, since );
+}
+
+
+void
+Api_v1::onQueryResults()
+{
+    Tomahawk::Query* q = qobject_cast< Tomahawk::Query* >( sender() );
+    if ( q )
+        answerWaiters( q, false );
+}
+
+
+void
+Api_v1::onQueryResolved()
+{
+    // no more results coming, everyone gets what there is
+    Tomahawk::Query* q = qobject_cast< Tomahawk::Query* >( sender() );
+    if ( q )
+        answerWaiters( q, true );
+}
+
+
+void
+Api_v1::answerWaiters( Tomahawk::Query* q, bool finished )
+{
+    bool waiting = false;
+
+    QList< Waiter >::iterator it = m_waiters.begin();
+    while ( it != m_waiters.end() )
+    {
+        if ( it->query.data() != q )
+        {
+            ++it;
+            continue;
+        }
+
+        // a waiter only cares about results past the ones it already has
+        if ( finished || q->solved() || !q->resultsSince( it->since ).isEmpty() )
+        {
+            sendResults( it->query, it->event, it->since );
+            delete it->event;
+            it = m_waiters.erase( it );
+        }
+        else
+        {
+            waiting = true;
+            ++it;
+        }
+    }
+
+    // stay connected for the waiters that got nothing new yet
+    if ( !waiting )
+        disconnect( q, 0, this, 0 );
+}
+
+
+void
+Api_v1::onWaitTimeout()
+{
+    QList< Waiter >::iterator it = m_waiters.begin();
+    while ( it != m_waiters.end() )
+    {
+        if ( it->started.elapsed() >= it->timeout )
+        {
+            // nothing new, the client gets what there is and asks again
+            sendResults( it->query, it->event, it->since );
+            delete it->event;
+            it = m_waiters.erase( it );
+        }
+        else
+            ++it;
+    }
+
+    if ( m_waiters.isEmpty() )
+        m_waitTimer.stop();
+}
+
+
+void
+Api_v1::sendResults( const Tomahawk::query_ptr& qry, QxtWebRequestEvent* event, int since )
+{
+    const QList< Tomahawk::result_ptr > results = qry->results();
+    // a first request gets everything ranked, later ones what was found since
+    const QList< Tomahawk::result_ptr > sent = since > 0 ? qry->resultsSince( since ) : results;
+
     QVariantMap r;
     r.insert( "qid", qry->id() );
     r.insert( "poll_interval", 1000 );
@@ -281,9 +589,11 @@ Api_v1::get_results( QxtWebRequestEvent* event )
     r.insert( "poll_limit", 6 );
     r.insert( "solved", qry->solved() );
     r.insert( "query", qry->toVariant() );
+    r.insert( "total", results.count() );
+    r.insert( "next", qry->resultCursor() );
 
     QVariantList res;
-    foreach( Tomahawk::result_ptr rp, qry->results() )
+    foreach ( const Tomahawk::result_ptr& rp, sent )
     {
         res << rp->toVariant();
     }
@@ -293,6 +603,14 @@ Api_v1::get_results( QxtWebRequestEvent* event )
 }
 
 
+QxtWebRequestEvent*
+Api_v1::detachRequest( QxtWebRequestEvent* event )
+{
+    // all we need for answering: the ids, and the url for jsonp
+    return new QxtWebRequestEvent( event->sessionID, event->requestID, event->url );
+}
+
+
 void
 Api_v1::sendJSON( const QVariantMap& m, QxtWebRequestEvent* event )
 {
@@ -34,8 +34,12 @@
 #include <qjson/qobjecthelper.h>
 
 #include <QFile>
+#include <QHash>
+#include <QQueue>
 #include <QSharedPointer>
 #include <QStringList>
+#include <QTime>
+#include <QTimer>
 
 #include "network/servent.h"
 #include "tomahawkutils.h"
@@ -51,10 +55,8 @@ Q_OBJECT
 
 public:
 
-    Api_v1( QxtAbstractWebSessionManager* sm, QObject* parent = 0 )
-        : QxtWebSlotService( sm, parent )
-    {
-    }
+    Api_v1( QxtAbstractWebSessionManager* sm, QObject* parent = 0 );
+    ~Api_v1();
 
 public slots:
     // authenticating uses /auth_1
@@ -71,6 +73,7 @@ public slots:
     void stat( QxtWebRequestEvent* event );
     void statResult( const QString& clientToken, const QString& name, bool valid );
     void resolve( QxtWebRequestEvent* event );
+    void resolve_batch( QxtWebRequestEvent* event );
     void staticdata( QxtWebRequestEvent* event,const QString& );
     void get_results( QxtWebRequestEvent* event );
     void sendJSON( const QVariantMap& m, QxtWebRequestEvent* event );
@@ -81,8 +84,43 @@ public slots:
 
     void index( QxtWebRequestEvent* event );
 
+private slots:
+    void onQueryResults();
+    void onQueryResolved();
+    void onWaitTimeout();
+
 private:
-    QxtWebRequestEvent* m_storedEvent;
+    // a get_results request held open until its query has news
+    struct Waiter
+    {
+        QxtWebRequestEvent* event;
+        Tomahawk::query_ptr query;
+        int since;
+        int timeout;
+        QTime started;
+    };
+
+    // parses a "Range: bytes=..." header into an inclusive byte range within size
+    static bool parseRange( const QString& header, qint64 size, qint64* start, qint64* end );
+
+    // copy of a request, for answering it after its handler returned. Owned by the caller
+    static QxtWebRequestEvent* detachRequest( QxtWebRequestEvent* event );
+
+    void keepQuery( const Tomahawk::query_ptr& qry );
+    void sendStat( QxtWebRequestEvent* event, bool valid );
+    void sendResults( const Tomahawk::query_ptr& qry, QxtWebRequestEvent* event, int since );
+    // answers the waiters on q that have news, or all of them once q finished resolving
+    void answerWaiters( Tomahawk::Query* q, bool finished );
+
+    // stat requests waiting for their auth token to be checked, by token
+    QMultiHash< QString, QxtWebRequestEvent* > m_statRequests;
+
+    QList< Waiter > m_waiters;
+    QTimer m_waitTimer;
+
+    // the pipeline only keeps weak references to queries, so we hold on
+    // to the most recent ones until the client had a chance to poll them
+    QQueue< Tomahawk::query_ptr > m_queries;
 };
 
 #endif
@@ -0,0 +1,84 @@
+/* === This file is part of Tomahawk Player - <http://tomahawk-player.org> ===
+ *
+ *   Copyright 2010-2011, Christian Muehlhaeuser <muesli@tomahawk-player.org>
+ *
+ *   Tomahawk is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Tomahawk is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Tomahawk. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "rangeiodevice.h"
+
+#include <QDebug>
+
+
+RangeIODevice::RangeIODevice( const QSharedPointer<QIODevice>& source, qint64 start, qint64 length, QObject* parent )
+    : QIODevice( parent )
+    , m_source( source )
+    , m_remaining( length )
+{
+    if ( !m_source->seek( start ) )
+    {
+        qDebug() << Q_FUNC_INFO << "Can't seek to" << start;
+        m_remaining = 0;
+    }
+
+    connect( m_source.data(), SIGNAL( readyRead() ), SIGNAL( readyRead() ) );
+    connect( m_source.data(), SIGNAL( aboutToClose() ), SLOT( finish() ) );
+
+    open( QIODevice::ReadOnly | QIODevice::Unbuffered );
+}
+
+
+qint64
+RangeIODevice::bytesAvailable() const
+{
+    return qMin( m_source->bytesAvailable(), m_remaining ) + QIODevice::bytesAvailable();
+}
+
+
+bool
+RangeIODevice::atEnd() const
+{
+    return m_remaining <= 0;
+}
+
+
+qint64
+RangeIODevice::readData( char* data, qint64 maxSize )
+{
+    if ( m_remaining <= 0 )
+        return -1;
+
+    const qint64 len = m_source->read( data, qMin( maxSize, m_remaining ) );
+    if ( len > 0 )
+        m_remaining -= len;
+
+    return len;
+}
+
+
+qint64
+RangeIODevice::writeData( const char* data, qint64 maxSize )
+{
+    Q_UNUSED( data );
+    Q_UNUSED( maxSize );
+    return -1;
+}
+
+
+void
+RangeIODevice::finish()
+{
+    if ( isOpen() )
+        close();
+}
@@ -0,0 +1,55 @@
+/* === This file is part of Tomahawk Player - <http://tomahawk-player.org> ===
+ *
+ *   Copyright 2010-2011, Christian Muehlhaeuser <muesli@tomahawk-player.org>
+ *
+ *   Tomahawk is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Tomahawk is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Tomahawk. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RANGEIODEVICE_H
+#define RANGEIODEVICE_H
+
+#include <QIODevice>
+#include <QSharedPointer>
+
+/*
+    Read-only window of length bytes into another, seekable device, starting
+    at start. Used to answer HTTP Range requests: the source is seeked once
+    and then read on demand, so a file or a BufferIODevice is never copied
+    whole. bytesAvailable() never reaches past the window, which is what
+    tells the web server that the response is complete.
+*/
+class RangeIODevice : public QIODevice
+{
+Q_OBJECT
+
+public:
+    RangeIODevice( const QSharedPointer<QIODevice>& source, qint64 start, qint64 length, QObject* parent = 0 );
+
+    virtual bool isSequential() const { return true; }
+    virtual qint64 bytesAvailable() const;
+    virtual bool atEnd() const;
+
+protected:
+    virtual qint64 readData( char* data, qint64 maxSize );
+    virtual qint64 writeData( const char* data, qint64 maxSize );
+
+private slots:
+    void finish();
+
+private:
+    QSharedPointer<QIODevice> m_source;
+    qint64 m_remaining;
+};
+
+#endif // RANGEIODEVICE_H
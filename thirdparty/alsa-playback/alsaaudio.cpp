@@ -28,6 +28,7 @@
  ***************************************************************************/
 
 #include "alsaaudio.h"
+#include "pcmconvert.h"
 
 #include <qendian.h>
 #include <QDebug>
@@ -39,10 +40,7 @@
 
 pthread_t AlsaAudio::audio_thread;
 
-char* AlsaAudio::thread_buffer = NULL;
-int AlsaAudio::thread_buffer_size = 0;
-int AlsaAudio::rd_index = 0;
-int AlsaAudio::wr_index = 0;
+PcmRingBuffer AlsaAudio::thread_buffer;
 unsigned int AlsaAudio::pcmCounter = 0;
 
 snd_output_t* AlsaAudio::logs = NULL;
@@ -411,15 +409,15 @@ AlsaAudio::alsaOpen( QString device, AFormat format, unsigned int rate,
     }
 
     hw_buffer_size = snd_pcm_frames_to_bytes( alsa_pcm, alsa_buffer_size );
-    thread_buffer_size = minBufferCapacity * 4;
+    int thread_buffer_size = minBufferCapacity * 4;
     if ( thread_buffer_size < hw_buffer_size )
         thread_buffer_size = hw_buffer_size * 2;
     if ( thread_buffer_size < 8192 )
         thread_buffer_size = 8192;
     thread_buffer_size += hw_buffer_size;
-    thread_buffer_size -= thread_buffer_size % hw_period_size;
 
-    thread_buffer = (char*)calloc(thread_buffer_size, sizeof(char));
+    // rounded up to a power of two by the ring buffer
+    thread_buffer.reset( thread_buffer_size );
 
 //    qDebug() << "Device setup: period size:" << hw_period_size;
 //    qDebug() << "Device setup: hw_period_size_in:" << hw_period_size_in;
@@ -457,9 +455,8 @@ AlsaAudio::startPlayback()
 void
 AlsaAudio::clearBuffer( void )
 {
-    wr_index = rd_index = pcmCounter = 0;
-    if ( thread_buffer )
-        memset( thread_buffer, 0, thread_buffer_size );
+    pcmCounter = 0;
+    thread_buffer.discard();
 }
 
 
@@ -470,32 +467,17 @@ AlsaAudio::clearBuffer( void )
 void
 AlsaAudio::alsaWrite( const QByteArray& input )
 {
-    int cnt;
-    const char *src = input.data();
-    int length = input.size();
-    //qDebug() << "alsaWrite length:" << length;
-
-    while ( length > 0 )
-    {
-        int wr;
-        cnt = qMin(length, thread_buffer_size - wr_index);
-        memcpy(thread_buffer + wr_index, src, cnt);
-        wr = (wr_index + cnt) % thread_buffer_size;
-        wr_index = wr;
-        length -= cnt;
-        src += cnt;
-    }
+    //qDebug() << "alsaWrite length:" << input.size();
+    int written = thread_buffer.write( input.constData(), input.size() );
+    if ( written < input.size() )
+        qDebug() << "Thread buffer full, dropping" << input.size() - written << "bytes";
 }
 
 
 int
 AlsaAudio::get_thread_buffer_filled() const
 {
-    if ( wr_index >= rd_index )
-    {
-        return wr_index - rd_index;
-    }
-    return ( thread_buffer_size - ( rd_index - wr_index ) );
+    return thread_buffer.fill();
 }
 
 
@@ -518,8 +500,8 @@ AlsaAudio::hasData()
 int
 AlsaAudio::alsa_free() const
 {
-    //qDebug() << "alsa_free:" << thread_buffer_size - get_thread_buffer_filled() - 1;
-    return thread_buffer_size - get_thread_buffer_filled() - 1;
+    //qDebug() << "alsa_free:" << thread_buffer.freeSpace();
+    return thread_buffer.freeSpace();
 }
 
 
@@ -554,11 +536,7 @@ AlsaAudio::alsaClose()
     xmms_convert_buffers_destroy( convertb );
     convertb = NULL;
 
-    if ( thread_buffer )
-    {
-        free(thread_buffer);
-        thread_buffer = NULL;
-    }
+    thread_buffer.reset( 0 );
     if ( inputf )
     {
         free( inputf );
@@ -606,7 +584,7 @@ AlsaAudio::run()
 
     while ( going && alsa_pcm )
     {
-        if ( !paused && get_thread_buffer_filled() >= hw_period_size_in )
+        if ( !paused && thread_buffer.readable() >= hw_period_size_in )
         {
             wr = snd_pcm_wait( alsa_pcm, 10 );
 
@@ -632,8 +610,7 @@ AlsaAudio::run()
     err = snd_pcm_drop( alsa_pcm );
     if ( err < 0 )
         qDebug() << "snd_pcm_drop error:" << snd_strerror( err );
-    wr_index = rd_index = 0;
-    memset( thread_buffer, 0, thread_buffer_size );
+    thread_buffer.consume( thread_buffer.readable() );
 
 //    qDebug() << "Exiting thread";
 
@@ -647,16 +624,18 @@ AlsaAudio::alsa_write_out_thread_data( void )
 {
     ssize_t length;
     int cnt;
-    length = qMin( hw_period_size_in, ssize_t(get_thread_buffer_filled()) );
+    length = qMin( hw_period_size_in, ssize_t(thread_buffer.readable()) );
     length = qMin( length, snd_pcm_frames_to_bytes( alsa_pcm, alsa_get_avail() ) );
 
     while (length > 0)
     {
-        int rd;
-        cnt = qMin(int(length), thread_buffer_size - rd_index);
-        alsa_do_write( thread_buffer + rd_index, cnt);
-        rd = (rd_index + cnt) % thread_buffer_size;
-        rd_index = rd;
+        const char* data;
+        cnt = qMin(int(length), thread_buffer.peek( &data ));
+        if ( cnt <= 0 )
+            break;
+
+        alsa_do_write( (void*)data, cnt);
+        thread_buffer.consume( cnt );
         length -= cnt;
     }
 }
@@ -739,13 +718,21 @@ AlsaAudio::volume_adjust( void* data, ssize_t length, AFormat fmt )
     switch ( fmt )
     {
         case FMT_S16_LE:
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+            PcmConvert::scaleInt16( (qint16*)data, (qint16*)data, length / 2, volume );
+#else
             VOLUME_ADJUST( qint16, LittleEndian );
+#endif
             break;
         case FMT_U16_LE:
             VOLUME_ADJUST( quint16, LittleEndian );
             break;
         case FMT_S16_BE:
+#if Q_BYTE_ORDER == Q_BIG_ENDIAN
+            PcmConvert::scaleInt16( (qint16*)data, (qint16*)data, length / 2, volume );
+#else
             VOLUME_ADJUST( qint16, BigEndian );
+#endif
             break;
         case FMT_U16_BE:
             VOLUME_ADJUST( quint16, BigEndian );
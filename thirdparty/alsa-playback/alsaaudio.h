@@ -28,6 +28,7 @@
 
 #include <alsa/asoundlib.h>
 #include "xconvert.h"
+#include "pcmringbuffer.h"
 
 struct AlsaDeviceInfo
 {
@@ -119,9 +120,8 @@ private:
     void alsa_write_audio( char *data, ssize_t length );
     //int get_thread_buffer_filled() const;
 
-    static char* thread_buffer;
-    static int thread_buffer_size;
-    static int rd_index, wr_index;
+    // filled by alsaWrite, drained by the audio thread without locking
+    static PcmRingBuffer thread_buffer;
 
     snd_pcm_sframes_t alsa_get_avail( void );
     int alsa_handle_error( int err );